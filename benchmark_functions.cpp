@@ -0,0 +1,408 @@
+#include "benchmark_functions.h"
+
+#include <chrono>
+#include <cmath>
+#include <execution>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "log_duration.h"
+#include "process_queries.h"
+#include "remove_duplicates.h"
+
+using namespace std::string_literals;
+
+std::string GenerateWord(std::mt19937& generator, int max_length) {
+    const int length = std::uniform_int_distribution(1, max_length)(generator);
+    std::string word;
+    word.reserve(length);
+    for (int i = 0; i < length; ++i) {
+        word.push_back(std::uniform_int_distribution('a', 'z')(generator));
+    }
+    return word;
+}
+
+std::vector<std::string> GenerateDictionary(std::mt19937& generator, int word_count, int max_length) {
+    std::vector<std::string> words;
+    words.reserve(word_count);
+    for (int i = 0; i < word_count; ++i) {
+        words.push_back(GenerateWord(generator, max_length));
+    }
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+    std::shuffle(words.begin(), words.end(), generator);
+    return words;
+}
+
+const std::string& PickWord(std::mt19937& generator, const std::vector<std::string>& dictionary) {
+    // Inverse CDF of the continuous 1/x density on [1, n + 1): word ranks follow Zipf's law.
+    const double rank = std::pow(dictionary.size() + 1.0, std::uniform_real_distribution<double>(0, 1)(generator));
+    return dictionary[std::min(static_cast<size_t>(rank) - 1, dictionary.size() - 1)];
+}
+
+std::string GenerateQuery(std::mt19937& generator, const std::vector<std::string>& dictionary, int word_count, double minus_prob) {
+    std::string query;
+    for (int i = 0; i < word_count; ++i) {
+        if (!query.empty()) {
+            query.push_back(' ');
+        }
+        if (std::uniform_real_distribution<>(0, 1)(generator) < minus_prob) {
+            query.push_back('-');
+        }
+        query += PickWord(generator, dictionary);
+    }
+    return query;
+}
+
+std::vector<std::string> GenerateQueries(std::mt19937& generator, const std::vector<std::string>& dictionary, int query_count, int max_word_count) {
+    std::vector<std::string> queries;
+    queries.reserve(query_count);
+    for (int i = 0; i < query_count; ++i) {
+        queries.push_back(GenerateQuery(generator, dictionary, max_word_count));
+    }
+    return queries;
+}
+
+void BenchmarkRetrievalModes() {
+    std::mt19937 generator(42);
+    const auto dictionary = GenerateDictionary(generator, 20'000, 10);
+    SearchServer search_server(dictionary[0]);
+    for (int id = 0; id < 100'000; ++id) {
+        search_server.AddDocument(id, GenerateQuery(generator, dictionary, 30), DocumentStatus::ACTUAL, { id % 10 });
+    }
+    // Queries of a dozen words drawn from the 500 most frequent ones.
+    const std::vector<std::string> frequent_words(dictionary.begin(), dictionary.begin() + 500);
+    const auto queries = GenerateQueries(generator, frequent_words, 200, 12);
+
+    for (const RetrievalMode mode : { RetrievalMode::EXHAUSTIVE, RetrievalMode::MAX_SCORE }) {
+        search_server.SetRetrievalMode(mode);
+        const std::string name = mode == RetrievalMode::EXHAUSTIVE ? "EXHAUSTIVE"s : "MAX_SCORE"s;
+        double total_relevance = 0.0;
+        {
+            LOG_DURATION_STREAM(name, std::cerr);
+            for (const std::string& query : queries) {
+                for (const Document& document : search_server.FindTopDocuments(query)) {
+                    total_relevance += document.relevance;
+                }
+            }
+        }
+        std::cerr << name << " checksum: "s << total_relevance << std::endl;
+    }
+}
+
+void BenchmarkMinusWords() {
+    std::mt19937 generator(42);
+    const auto dictionary = GenerateDictionary(generator, 20'000, 10);
+    SearchServer search_server(dictionary[0]);
+    for (int id = 0; id < 100'000; ++id) {
+        search_server.AddDocument(id, GenerateQuery(generator, dictionary, 30), DocumentStatus::ACTUAL, { id % 10 });
+    }
+    // Four plus-words from the 500 most frequent words and three minus-words from the 10 most frequent.
+    const std::vector<std::string> frequent_words(dictionary.begin() + 1, dictionary.begin() + 500);
+    const std::vector<std::string> most_frequent_words(dictionary.begin() + 1, dictionary.begin() + 10);
+    std::vector<std::string> queries;
+    for (int i = 0; i < 200; ++i) {
+        std::string query = GenerateQuery(generator, frequent_words, 4);
+        for (int j = 0; j < 3; ++j) {
+            query += " -"s + PickWord(generator, most_frequent_words);
+        }
+        queries.push_back(std::move(query));
+    }
+
+    for (const RetrievalMode mode : { RetrievalMode::EXHAUSTIVE, RetrievalMode::MAX_SCORE }) {
+        search_server.SetRetrievalMode(mode);
+        const std::string name = mode == RetrievalMode::EXHAUSTIVE ? "EXHAUSTIVE"s : "MAX_SCORE"s;
+        double total_relevance = 0.0;
+        {
+            LOG_DURATION_STREAM(name + " seq"s, std::cerr);
+            for (const std::string& query : queries) {
+                for (const Document& document : search_server.FindTopDocuments(query)) {
+                    total_relevance += document.relevance;
+                }
+            }
+        }
+        {
+            LOG_DURATION_STREAM(name + " par"s, std::cerr);
+            for (const std::string& query : queries) {
+                for (const Document& document : search_server.FindTopDocuments(std::execution::par, query)) {
+                    total_relevance += document.relevance;
+                }
+            }
+        }
+        std::cerr << name << " checksum: "s << total_relevance << std::endl;
+    }
+}
+
+void BenchmarkProcessQueries() {
+    std::mt19937 generator(42);
+    const auto dictionary = GenerateDictionary(generator, 20'000, 10);
+    SearchServer search_server(dictionary[0]);
+    for (int id = 0; id < 100'000; ++id) {
+        search_server.AddDocument(id, GenerateQuery(generator, dictionary, 30), DocumentStatus::ACTUAL, { id % 10 });
+    }
+    // One query in ten has a dozen frequent words; the rest have two words from the whole dictionary.
+    const std::vector<std::string> frequent_words(dictionary.begin() + 1, dictionary.begin() + 200);
+    std::vector<std::string> queries;
+    for (int i = 0; i < 5'000; ++i) {
+        queries.push_back(i % 10 == 0 ? GenerateQuery(generator, frequent_words, 12) : GenerateQuery(generator, dictionary, 2));
+    }
+
+    const size_t core_count = std::max(1u, std::thread::hardware_concurrency());
+    for (const size_t thread_count : { size_t{ 1 }, std::max(size_t{ 1 }, core_count / 2), core_count }) {
+        QueryExecutor executor(thread_count);
+        const std::string name = std::to_string(thread_count) + " threads"s;
+        double total_relevance = 0.0;
+        {
+            LOG_DURATION_STREAM(name, std::cerr);
+            for (const Document& document : ProcessQueriesJoined(executor, search_server, queries)) {
+                total_relevance += document.relevance;
+            }
+        }
+        std::cerr << name << " checksum: "s << total_relevance << std::endl;
+    }
+}
+
+void BenchmarkIndexMemory() {
+    std::mt19937 generator(42);
+    const auto dictionary = GenerateDictionary(generator, 20'000, 10);
+    SearchServer search_server(dictionary[0]);
+    {
+        LOG_DURATION_STREAM("AddDocument x100000"s, std::cerr);
+        for (int id = 0; id < 100'000; ++id) {
+            search_server.AddDocument(id, GenerateQuery(generator, dictionary, 30), DocumentStatus::ACTUAL, { id % 10 });
+        }
+    }
+    const IndexMemoryUsage usage = search_server.GetMemoryUsage();
+    std::cerr << "postings: "s << usage.posting_count << std::endl;
+    std::cerr << "posting bytes: "s << usage.posting_bytes << " (flat pairs: "s << usage.uncompressed_posting_bytes << ")"s << std::endl;
+    std::cerr << "dictionary bytes: "s << usage.dictionary_bytes << std::endl;
+    std::cerr << "document bytes: "s << usage.document_bytes << std::endl;
+    std::cerr << "word frequency bytes: "s << usage.word_frequency_bytes << std::endl;
+    std::cerr << "total bytes: "s << usage.GetTotal() << std::endl;
+}
+
+CorpusGenerator::CorpusGenerator(const CorpusOptions& options)
+    : options_(options)
+    , engine_(options.seed)
+    , recent_documents_(kRecentDocumentCount) {
+    if (options.vocabulary_size <= 0 || options.max_word_length < 4 || options.min_document_length < 1
+        || options.max_document_length < options.min_document_length) {
+        throw std::invalid_argument("Invalid corpus options");
+    }
+    std::unordered_set<std::string> words;
+    dictionary_.reserve(options.vocabulary_size);
+    while (dictionary_.size() < static_cast<size_t>(options.vocabulary_size)) {
+        const size_t length = 2 + NextBelow(options.max_word_length - 1);
+        std::string word(length, 'a');
+        for (char& letter : word) {
+            letter = static_cast<char>('a' + NextBelow(26));
+        }
+        if (words.insert(word).second) {
+            dictionary_.push_back(std::move(word));
+        }
+    }
+}
+
+CorpusGenerator::GeneratedDocument CorpusGenerator::GenerateDocument(int id) {
+    std::vector<const std::string*> words;
+    if (document_count_ > 0 && NextUnit() < options_.duplicate_share) {
+        words = recent_documents_[NextBelow(std::min(document_count_, kRecentDocumentCount))];
+        for (size_t i = words.size(); i > 1; --i) {
+            std::swap(words[i - 1], words[NextBelow(i)]);
+        }
+    }
+    else {
+        const size_t length = options_.min_document_length + NextBelow(options_.max_document_length - options_.min_document_length + 1);
+        words.reserve(length);
+        for (size_t i = 0; i < length; ++i) {
+            words.push_back(&PickWord());
+        }
+    }
+
+    GeneratedDocument document;
+    document.id = id;
+    for (const std::string* word : words) {
+        if (!document.text.empty()) {
+            document.text.push_back(' ');
+        }
+        document.text += *word;
+    }
+    double status_point = NextUnit() * std::accumulate(options_.status_weights.begin(), options_.status_weights.end(), 0.0);
+    size_t status = 0;
+    while (status + 1 < options_.status_weights.size() && status_point >= options_.status_weights[status]) {
+        status_point -= options_.status_weights[status];
+        ++status;
+    }
+    document.status = static_cast<DocumentStatus>(status);
+    const size_t rating_count = 1 + NextBelow(3);
+    for (size_t i = 0; i < rating_count; ++i) {
+        document.ratings.push_back(static_cast<int>(NextBelow(21)) - 10);
+    }
+    recent_documents_[document_count_ % kRecentDocumentCount] = std::move(words);
+    ++document_count_;
+    return document;
+}
+
+std::string CorpusGenerator::GenerateQuery(int min_word_count, int max_word_count, double minus_share) {
+    const size_t word_count = min_word_count + NextBelow(max_word_count - min_word_count + 1);
+    std::string query;
+    for (size_t i = 0; i < word_count; ++i) {
+        if (!query.empty()) {
+            query.push_back(' ');
+        }
+        if (NextUnit() < minus_share) {
+            query.push_back('-');
+        }
+        query += PickWord();
+    }
+    return query;
+}
+
+const std::vector<std::string>& CorpusGenerator::GetDictionary() const {
+    return dictionary_;
+}
+
+double CorpusGenerator::NextUnit() {
+    return static_cast<double>(engine_() >> 11) * 0x1.0p-53;
+}
+
+uint64_t CorpusGenerator::NextBelow(uint64_t bound) {
+    return std::min(static_cast<uint64_t>(NextUnit() * bound), bound - 1);
+}
+
+// Inverse CDF of the continuous density x^-s on [1, n + 1), as in PickWord above.
+const std::string& CorpusGenerator::PickWord() {
+    const double n = static_cast<double>(dictionary_.size());
+    const double s = options_.zipf_exponent;
+    const double unit = NextUnit();
+    const double rank = std::abs(s - 1.0) < 1e-9
+        ? std::pow(n + 1.0, unit)
+        : std::pow(1.0 + unit * (std::pow(n + 1.0, 1.0 - s) - 1.0), 1.0 / (1.0 - s));
+    return dictionary_[std::min(static_cast<size_t>(rank) - 1, dictionary_.size() - 1)];
+}
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // Latencies of the operations in nanoseconds.
+    template <typename Operation>
+    std::vector<int64_t> TimeEach(size_t count, Operation operation) {
+        std::vector<int64_t> latencies;
+        latencies.reserve(count);
+        for (size_t index = 0; index < count; ++index) {
+            const Clock::time_point start_time = Clock::now();
+            operation(index);
+            latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_time).count());
+        }
+        return latencies;
+    }
+
+    void WriteRecord(std::ostream& output, const std::string& benchmark, const std::string& policy, int document_count,
+        std::vector<int64_t> latencies, double checksum) {
+        const int64_t total = std::accumulate(latencies.begin(), latencies.end(), int64_t{ 0 });
+        const auto percentile = [&latencies](double fraction) -> int64_t {
+            if (latencies.empty()) {
+                return 0;
+            }
+            const auto position = latencies.begin() + static_cast<ptrdiff_t>(fraction * (latencies.size() - 1));
+            std::nth_element(latencies.begin(), position, latencies.end());
+            return *position;
+        };
+        std::ostringstream line;
+        line << std::setprecision(17) << "{\"benchmark\": \"" << benchmark << "\", \"policy\": \"" << policy
+            << "\", \"documents\": " << document_count << ", \"operations\": " << latencies.size()
+            << ", \"total_ns\": " << total << ", \"ns_per_operation\": " << (latencies.empty() ? 0 : total / static_cast<int64_t>(latencies.size()))
+            << ", \"p50_ns\": " << percentile(0.5) << ", \"p99_ns\": " << percentile(0.99) << ", \"checksum\": " << checksum << "}";
+        output << line.str() << std::endl;
+    }
+
+    template <class ExecutionPolicy>
+    void BenchmarkFindAndMatch(std::ostream& output, const std::string& policy_name, const ExecutionPolicy& policy,
+        const SearchServer& search_server, const std::vector<std::string>& queries, int document_count) {
+        double checksum = 0.0;
+        auto latencies = TimeEach(queries.size(), [&](size_t index) {
+            for (const Document& document : search_server.FindTopDocuments(policy, queries[index])) {
+                checksum += document.relevance + document.id;
+            }
+            });
+        WriteRecord(output, "find_top_documents", policy_name, document_count, std::move(latencies), checksum);
+
+        checksum = 0.0;
+        latencies = TimeEach(queries.size(), [&](size_t index) {
+            const int document_id = static_cast<int>(index * 7919 % document_count);
+            const auto [words, status] = search_server.MatchDocument(policy, queries[index], document_id);
+            checksum += words.size() + static_cast<int>(status);
+            });
+        WriteRecord(output, "match_document", policy_name, document_count, std::move(latencies), checksum);
+    }
+
+    void RunBenchmarkScale(const BenchmarkSuiteOptions& options, int document_count, std::ostream& output) {
+        CorpusGenerator generator(options.corpus);
+        SearchServer search_server(std::string{});
+        // Generation is not timed, only AddDocument.
+        std::vector<int64_t> latencies;
+        latencies.reserve(document_count);
+        for (int id = 0; id < document_count; ++id) {
+            const CorpusGenerator::GeneratedDocument document = generator.GenerateDocument(id);
+            const Clock::time_point start_time = Clock::now();
+            search_server.AddDocument(document.id, document.text, document.status, document.ratings);
+            latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_time).count());
+        }
+        WriteRecord(output, "add_document", "seq", document_count, std::move(latencies),
+            static_cast<double>(search_server.GetMemoryUsage().posting_count));
+
+        std::vector<std::string> queries;
+        queries.reserve(options.query_count);
+        for (int i = 0; i < options.query_count; ++i) {
+            queries.push_back(generator.GenerateQuery(1, options.max_query_word_count, 0.1));
+        }
+        BenchmarkFindAndMatch(output, "seq", std::execution::seq, search_server, queries, document_count);
+        BenchmarkFindAndMatch(output, "par", std::execution::par, search_server, queries, document_count);
+
+        double checksum = 0.0;
+        latencies = TimeEach(1, [&](size_t) {
+            for (const std::vector<Document>& documents : ProcessQueries(search_server, queries)) {
+                for (const Document& document : documents) {
+                    checksum += document.relevance + document.id;
+                }
+            }
+            });
+        WriteRecord(output, "process_queries", "par", document_count, std::move(latencies), checksum);
+
+        // Sequential removal takes ids step * k, parallel removal ids step * k + 1.
+        const int removal_count = std::min(options.removal_count, document_count / 2);
+        const int step = removal_count > 0 ? document_count / removal_count : 1;
+        latencies = TimeEach(removal_count, [&](size_t index) {
+            search_server.RemoveDocument(std::execution::seq, static_cast<int>(index) * step);
+            });
+        WriteRecord(output, "remove_document", "seq", document_count, std::move(latencies), search_server.GetDocumentCount());
+        latencies = TimeEach(removal_count, [&](size_t index) {
+            search_server.RemoveDocument(std::execution::par, static_cast<int>(index) * step + 1);
+            });
+        WriteRecord(output, "remove_document", "par", document_count, std::move(latencies), search_server.GetDocumentCount());
+
+        // RemoveDuplicates reports every duplicate on std::cout; the report is not timed output.
+        const int count_before = search_server.GetDocumentCount();
+        std::streambuf* const cout_buffer = std::cout.rdbuf(nullptr);
+        latencies = TimeEach(1, [&](size_t) {
+            RemoveDuplicates(search_server);
+            });
+        std::cout.rdbuf(cout_buffer);
+        WriteRecord(output, "remove_duplicates", "par", document_count, std::move(latencies), count_before - search_server.GetDocumentCount());
+    }
+}
+
+void RunBenchmarkSuite(const BenchmarkSuiteOptions& options, std::ostream& output) {
+    for (const int document_count : options.document_counts) {
+        if (document_count <= 0) {
+            throw std::invalid_argument("Benchmark document counts must be positive");
+        }
+    }
+    for (const int document_count : options.document_counts) {
+        RunBenchmarkScale(options, document_count, output);
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "search_server.h"
+
+// Deterministic synthetic data for benchmarks. Words are drawn with a skew
+// towards the head of the dictionary, so low-index words are frequent.
+std::string GenerateWord(std::mt19937& generator, int max_length);
+
+std::vector<std::string> GenerateDictionary(std::mt19937& generator, int word_count, int max_length);
+
+const std::string& PickWord(std::mt19937& generator, const std::vector<std::string>& dictionary);
+
+std::string GenerateQuery(std::mt19937& generator, const std::vector<std::string>& dictionary, int word_count, double minus_prob = 0);
+
+std::vector<std::string> GenerateQueries(std::mt19937& generator, const std::vector<std::string>& dictionary, int query_count, int max_word_count);
+
+// Long queries made of frequent words, EXHAUSTIVE vs MAX_SCORE retrieval.
+void BenchmarkRetrievalModes();
+
+// Queries whose minus-words are among the most frequent words, so they exclude
+// most of what the plus-words match; sequential and parallel, both retrieval modes.
+void BenchmarkMinusWords();
+
+// ProcessQueriesJoined over a log of mostly light queries with some heavy ones,
+// on executors of one thread, half the cores and all of them.
+void BenchmarkProcessQueries();
+
+// GetMemoryUsage breakdown of a 100K-document index, compressed postings vs flat pairs.
+void BenchmarkIndexMemory();
+
+struct CorpusOptions {
+    uint64_t seed = 42;
+    int vocabulary_size = 50'000;
+    int max_word_length = 10;
+    // Skew of the word ranks: the word of rank r is drawn with weight 1 / r^zipf_exponent.
+    double zipf_exponent = 1.0;
+    // Document lengths in words are uniform over [min_document_length, max_document_length].
+    int min_document_length = 10;
+    int max_document_length = 60;
+    // Weights of ACTUAL, IRRELEVANT, BANNED and REMOVED.
+    std::array<double, 4> status_weights = { 0.85, 0.05, 0.05, 0.05 };
+    // Share of documents that repeat the words of a recent document in another order.
+    double duplicate_share = 0.01;
+};
+
+// Seeded Zipfian corpus. Draws come straight from std::mt19937_64, whose output
+// the standard fixes, rather than from the std distributions, whose algorithms it
+// leaves to the library: the same options give the same corpus everywhere.
+class CorpusGenerator {
+public:
+    struct GeneratedDocument {
+        int id = 0;
+        std::string text;
+        DocumentStatus status = DocumentStatus::ACTUAL;
+        std::vector<int> ratings;
+    };
+
+    explicit CorpusGenerator(const CorpusOptions& options);
+
+    // Documents come out in order, so the n-th call gives the same document for the same options.
+    GeneratedDocument GenerateDocument(int id);
+
+    // Words drawn as for documents; each is a minus-word with probability minus_share.
+    std::string GenerateQuery(int min_word_count, int max_word_count, double minus_share);
+
+    // Ordered by rank: the first word is the most frequent.
+    const std::vector<std::string>& GetDictionary() const;
+
+private:
+    static constexpr size_t kRecentDocumentCount = 64;
+
+    double NextUnit();
+
+    // Uniform over [0, bound).
+    uint64_t NextBelow(uint64_t bound);
+
+    const std::string& PickWord();
+
+    CorpusOptions options_;
+    std::mt19937_64 engine_;
+    std::vector<std::string> dictionary_;
+    // Last documents' words, for duplicates.
+    std::vector<std::vector<const std::string*>> recent_documents_;
+    size_t document_count_ = 0;
+};
+
+struct BenchmarkSuiteOptions {
+    CorpusOptions corpus;
+    std::vector<int> document_counts = { 10'000, 1'000'000, 10'000'000 };
+    int query_count = 1'000;
+    // Queries have 1 to max_query_word_count words, one in ten of them a minus-word.
+    int max_query_word_count = 6;
+    // Documents removed by each of the sequential and the parallel RemoveDocument runs.
+    int removal_count = 1'000;
+};
+
+// For every document count, builds a corpus and times AddDocument,
+// FindTopDocuments, MatchDocument and RemoveDocument (sequential and parallel),
+// ProcessQueries and RemoveDuplicates on it. Writes one JSON object per line
+// and scenario: {"benchmark", "policy", "documents", "operations", "total_ns",
+// "ns_per_operation", "p50_ns", "p99_ns", "checksum"}. The checksum depends only on
+// the options, so a changed one means changed results, not just a changed speed.
+// Throws std::invalid_argument, before running anything, if a document count is not positive.
+void RunBenchmarkSuite(const BenchmarkSuiteOptions& options, std::ostream& output);
@@ -0,0 +1,46 @@
+#include "compiled_query.h"
+
+#include <algorithm>
+
+// Queries have a handful of words, so sorted insertion beats sorting at the end.
+void QueryTerms::Insert(std::string_view word, uint32_t id) {
+    Term* const data = GetData();
+    Term* const position = std::lower_bound(data, data + size_, word, [](const Term& term, std::string_view word) {
+        return term.word < word;
+        });
+    if (position != data + size_ && position->word == word) {
+        return;
+    }
+    const size_t index = position - data;
+    if (size_ < kInlineSize) {
+        std::copy_backward(position, data + size_, data + size_ + 1);
+        inline_terms_[index] = { word, id };
+    }
+    else {
+        if (size_ == kInlineSize) {
+            heap_terms_.assign(inline_terms_.begin(), inline_terms_.end());
+        }
+        heap_terms_.insert(heap_terms_.begin() + index, { word, id });
+    }
+    ++size_;
+}
+
+const QueryTerms::Term* QueryTerms::begin() const {
+    return size_ <= kInlineSize ? inline_terms_.data() : heap_terms_.data();
+}
+
+const QueryTerms::Term* QueryTerms::end() const {
+    return begin() + size_;
+}
+
+size_t QueryTerms::size() const {
+    return size_;
+}
+
+bool QueryTerms::empty() const {
+    return size_ == 0;
+}
+
+QueryTerms::Term* QueryTerms::GetData() {
+    return size_ <= kInlineSize ? inline_terms_.data() : heap_terms_.data();
+}
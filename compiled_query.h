@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Words of one part of a query (plus or minus) with their term ids, sorted by
+// word and unique. The first kInlineSize terms live inside the object, so a
+// typical query is parsed without allocating.
+class QueryTerms {
+public:
+    struct Term {
+        std::string_view word;
+        uint32_t id = 0;
+    };
+
+    static constexpr size_t kInlineSize = 8;
+
+    // Does nothing if the word is already there.
+    void Insert(std::string_view word, uint32_t id);
+
+    const Term* begin() const;
+
+    const Term* end() const;
+
+    size_t size() const;
+
+    bool empty() const;
+
+private:
+    Term* GetData();
+
+    std::array<Term, kInlineSize> inline_terms_;
+    // All terms once there are more than kInlineSize of them.
+    std::vector<Term> heap_terms_;
+    size_t size_ = 0;
+};
+
+// A query parsed once and resolved against the dictionary of a search server, for
+// queries that run many times. Made by SearchServer::CompileQuery for that server
+// (or a copy of it, or a server loaded from its snapshot while the snapshot keeps
+// its term numbers). It keeps a copy of its words, so the text it came from may go.
+// Words the dictionary did not have are kept too: if the dictionary has grown when
+// the query runs, they are looked up again.
+class CompiledQuery {
+private:
+    friend class SearchServer;
+
+    static constexpr uint32_t kUnknownTerm = std::numeric_limits<uint32_t>::max();
+
+    // A word of the query: a range of text_, in plus-words then minus-words order.
+    struct Word {
+        uint32_t offset = 0;
+        uint32_t size = 0;
+        uint32_t term_id = kUnknownTerm;
+        bool is_minus = false;
+    };
+
+    std::string text_;
+    std::vector<Word> words_;
+    // Identity of the term numbering the ids refer to.
+    uint64_t dictionary_id_ = 0;
+    // Terms in the dictionary when the query was compiled.
+    size_t dictionary_size_ = 0;
+};
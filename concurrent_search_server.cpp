@@ -0,0 +1,94 @@
+#include "concurrent_search_server.h"
+
+#include <functional>
+#include <thread>
+#include <utility>
+
+ConcurrentSearchServer::ConcurrentSearchServer(SearchServer search_server)
+    : copies_{ std::make_unique<SearchServer>(search_server), std::make_unique<SearchServer>(std::move(search_server)) }
+{
+}
+
+// A reader announces itself in the current version before it looks at which copy
+// to read. A writer flips the version and waits for both versions to drain, so any
+// reader that could have picked the old copy is gone before the copy is changed.
+ConcurrentSearchServer::ReadHandle ConcurrentSearchServer::Read() const {
+    std::atomic<int64_t>& read_count = read_indicators_[version_.load()][GetReadIndicatorStripe()].count;
+    read_count.fetch_add(1);
+    return ReadHandle(copies_[reading_copy_.load()].get(), &read_count);
+}
+
+void ConcurrentSearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings) {
+    Update([&](SearchServer& search_server) {
+        search_server.AddDocument(document_id, document, status, ratings);
+        });
+}
+
+void ConcurrentSearchServer::AddDocuments(const std::vector<DocumentInput>& documents) {
+    Update([&documents](SearchServer& search_server) {
+        search_server.AddDocuments(documents);
+        });
+}
+
+void ConcurrentSearchServer::RemoveDocument(int document_id) {
+    Update([document_id](SearchServer& search_server) {
+        search_server.RemoveDocument(document_id);
+        });
+}
+
+size_t ConcurrentSearchServer::GetReadIndicatorStripe() {
+    thread_local const size_t stripe = std::hash<std::thread::id>{}(std::this_thread::get_id()) % kReadIndicatorStripes;
+    return stripe;
+}
+
+void ConcurrentSearchServer::WaitForReaders() {
+    const int version = version_.load();
+    while (HasReaders(1 - version)) {
+        std::this_thread::yield();
+    }
+    version_.store(1 - version);
+    while (HasReaders(version)) {
+        std::this_thread::yield();
+    }
+}
+
+// Only reads the published copy, which readers may use at the same time: its caches
+// are atomics or behind locks. The stale copy stays in place until the new one is made.
+void ConcurrentSearchServer::RestoreStandbyCopy() {
+    const int reading_copy = reading_copy_.load();
+    copies_[1 - reading_copy] = std::make_unique<SearchServer>(*copies_[reading_copy]);
+    is_standby_stale_ = false;
+}
+
+bool ConcurrentSearchServer::HasReaders(int version) const {
+    for (const ReadIndicator& indicator : read_indicators_[version]) {
+        if (indicator.count.load() != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+ConcurrentSearchServer::ReadHandle::ReadHandle(const SearchServer* search_server, std::atomic<int64_t>* read_count)
+    : search_server_(search_server)
+    , read_count_(read_count) {
+}
+
+ConcurrentSearchServer::ReadHandle::ReadHandle(ReadHandle&& other) noexcept
+    : search_server_(std::exchange(other.search_server_, nullptr))
+    , read_count_(std::exchange(other.read_count_, nullptr)) {
+}
+
+ConcurrentSearchServer::ReadHandle::~ReadHandle() {
+    if (read_count_ != nullptr) {
+        read_count_->fetch_sub(1);
+    }
+}
+
+const SearchServer& ConcurrentSearchServer::ReadHandle::operator*() const {
+    return *search_server_;
+}
+
+const SearchServer* ConcurrentSearchServer::ReadHandle::operator->() const {
+    return search_server_;
+}
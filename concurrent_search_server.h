@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+
+// A search server that any number of threads can query while others add and
+// remove documents. Readers never wait for writers: they take a read handle,
+// which pins a version of the index that no writer touches until the handle
+// is released.
+//
+// SearchServer updates its containers in place, so a copy-on-write version
+// per update would copy whole posting lists. Instead two copies of the index
+// are kept (the left-right scheme): readers use one while a writer applies
+// the update to the other, then the writer publishes the updated copy with
+// one atomic store, waits for the readers still on the old copy to leave and
+// applies the same update to it. Every update is applied twice and the index
+// is held twice; a server loaded from a snapshot shares the mapping between
+// the copies until the first update.
+class ConcurrentSearchServer {
+public:
+    class ReadHandle;
+
+    explicit ConcurrentSearchServer(SearchServer search_server);
+
+    ConcurrentSearchServer(const ConcurrentSearchServer&) = delete;
+    ConcurrentSearchServer& operator=(const ConcurrentSearchServer&) = delete;
+
+    // Wait-free. The version stays fixed while the handle lives; a writer waits
+    // for it to be released, so keep handles short-lived.
+    ReadHandle Read() const;
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+
+    void AddDocuments(const std::vector<DocumentInput>& documents);
+
+    void RemoveDocument(int document_id);
+
+    // Calls mutation(SearchServer&) on each copy of the index in turn. It must do
+    // the same to both, and leave a copy unchanged when it throws, as the SearchServer
+    // mutators do for bad input. If it throws on the first copy, nothing is published
+    // and the exception propagates. If it throws on the second copy, the update is
+    // already visible and stays so: the lagging copy is replaced by a copy of the
+    // published one and Update returns normally. Should that copy fail as well, it is
+    // made again at the start of the next update, before anything else changes.
+    template <typename Mutation>
+    void Update(Mutation mutation);
+
+private:
+    static constexpr size_t kReadIndicatorStripes = 16;
+
+    // Readers of one version increment their thread's stripe, so that they do not
+    // all contend for one cache line.
+    struct alignas(64) ReadIndicator {
+        std::atomic<int64_t> count{ 0 };
+    };
+
+    static size_t GetReadIndicatorStripe();
+
+    // Makes sure that no reader still uses the copy that was published before the last store to reading_copy_.
+    void WaitForReaders();
+
+    bool HasReaders(int version) const;
+
+    // Replaces the copy that readers do not use with a copy of the one they do.
+    void RestoreStandbyCopy();
+
+    // Behind pointers, so that a lagging copy can be replaced whole.
+    std::unique_ptr<SearchServer> copies_[2];
+    // The copy that new readers use.
+    std::atomic<int> reading_copy_{ 0 };
+    // The read indicators that new readers increment; flipped by every update.
+    std::atomic<int> version_{ 0 };
+    mutable ReadIndicator read_indicators_[2][kReadIndicatorStripes];
+    std::mutex update_mutex_;
+    // Set while the copy that readers do not use may differ from the one they do.
+    bool is_standby_stale_ = false;
+};
+
+class ConcurrentSearchServer::ReadHandle {
+public:
+    ReadHandle(ReadHandle&& other) noexcept;
+    ReadHandle& operator=(ReadHandle&&) = delete;
+
+    ~ReadHandle();
+
+    const SearchServer& operator*() const;
+
+    const SearchServer* operator->() const;
+
+private:
+    friend class ConcurrentSearchServer;
+
+    ReadHandle(const SearchServer* search_server, std::atomic<int64_t>* read_count);
+
+    const SearchServer* search_server_ = nullptr;
+    std::atomic<int64_t>* read_count_ = nullptr;
+};
+
+template <typename Mutation>
+void ConcurrentSearchServer::Update(Mutation mutation) {
+    std::lock_guard<std::mutex> lock(update_mutex_);
+    if (is_standby_stale_) {
+        RestoreStandbyCopy();
+    }
+    const int reading_copy = reading_copy_.load();
+    mutation(*copies_[1 - reading_copy]);
+    reading_copy_.store(1 - reading_copy);
+    WaitForReaders();
+    try {
+        mutation(*copies_[reading_copy]);
+    }
+    catch (...) {
+        is_standby_stale_ = true;
+    }
+    if (is_standby_stale_) {
+        try {
+            RestoreStandbyCopy();
+        }
+        catch (...) {
+            // Left for the next update; the published copy is complete.
+        }
+    }
+}
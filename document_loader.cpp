@@ -0,0 +1,325 @@
+#include "document_loader.h"
+
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <execution>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "index_snapshot.h"
+
+namespace {
+    // Text of one batch; a batch ends at the first line end after this many bytes.
+    const size_t kBatchBytes = 1 << 22;
+    // Parsed batches waiting to be indexed.
+    const size_t kQueueDepth = 2;
+
+    using AddDocumentsFunction = std::function<void(const std::vector<DocumentInput>&)>;
+
+    struct DocumentBatch {
+        // Holds the text of the records when they are read from a stream; unused for a mapped file.
+        std::vector<char> buffer;
+        std::vector<DocumentInput> documents;
+    };
+
+    // Blocking queue between the reader and the indexer. Once it is closed, Push
+    // refuses batches and Pop returns the ones left, then null.
+    class BatchQueue {
+    public:
+        explicit BatchQueue(size_t capacity)
+            : capacity_(capacity) {
+        }
+
+        bool Push(std::unique_ptr<DocumentBatch> batch) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            is_not_full_.wait(lock, [this] {
+                return is_closed_ || batches_.size() < capacity_;
+                });
+            if (is_closed_) {
+                return false;
+            }
+            batches_.push_back(std::move(batch));
+            is_not_empty_.notify_one();
+            return true;
+        }
+
+        std::unique_ptr<DocumentBatch> Pop() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            is_not_empty_.wait(lock, [this] {
+                return is_closed_ || !batches_.empty();
+                });
+            if (batches_.empty()) {
+                return nullptr;
+            }
+            std::unique_ptr<DocumentBatch> batch = std::move(batches_.front());
+            batches_.pop_front();
+            is_not_full_.notify_one();
+            return batch;
+        }
+
+        void Close() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            is_closed_ = true;
+            is_not_empty_.notify_all();
+            is_not_full_.notify_all();
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable is_not_empty_;
+        std::condition_variable is_not_full_;
+        std::deque<std::unique_ptr<DocumentBatch>> batches_;
+        const size_t capacity_;
+        bool is_closed_ = false;
+    };
+
+    // Reads a stream into the batch buffers. The part of the last line that did not
+    // fit is kept and goes to the front of the next buffer.
+    class StreamChunkReader {
+    public:
+        explicit StreamChunkReader(std::istream& input)
+            : input_(input) {
+        }
+
+        // Points lines at the whole lines read into the batch; false at the end of the input.
+        bool operator()(DocumentBatch& batch, std::string_view& lines) {
+            if (is_end_) {
+                return false;
+            }
+            std::vector<char>& buffer = batch.buffer;
+            // Grows once per batch, then only for a line longer than a buffer.
+            if (buffer.size() < std::max(kBatchBytes, 2 * partial_line_.size())) {
+                buffer.resize(std::max(kBatchBytes, 2 * partial_line_.size()));
+            }
+            std::copy(partial_line_.begin(), partial_line_.end(), buffer.begin());
+            size_t size = partial_line_.size();
+            while (true) {
+                if (size == buffer.size()) {
+                    buffer.resize(2 * buffer.size());
+                }
+                input_.read(buffer.data() + size, buffer.size() - size);
+                size += static_cast<size_t>(input_.gcount());
+                if (input_.bad()) {
+                    throw std::runtime_error("Cannot read the document stream");
+                }
+                if (!input_) {
+                    is_end_ = true;
+                    partial_line_.clear();
+                    lines = std::string_view(buffer.data(), size);
+                    return size > 0;
+                }
+                const std::string_view text(buffer.data(), size);
+                // The partial line and earlier reads of this call have no line end.
+                const size_t last_line_end = text.rfind('\n');
+                if (last_line_end != std::string_view::npos) {
+                    partial_line_.assign(text.substr(last_line_end + 1));
+                    lines = text.substr(0, last_line_end + 1);
+                    return true;
+                }
+            }
+        }
+
+    private:
+        std::istream& input_;
+        std::string partial_line_;
+        bool is_end_ = false;
+    };
+
+    // Cuts a mapped file into batches; the lines stay in the mapping.
+    class MappedChunkReader {
+    public:
+        explicit MappedChunkReader(std::string_view data)
+            : data_(data) {
+        }
+
+        bool operator()(DocumentBatch&, std::string_view& lines) {
+            if (position_ == data_.size()) {
+                return false;
+            }
+            size_t end = std::min(position_ + kBatchBytes, data_.size());
+            end = std::min(data_.find('\n', end - 1), data_.size() - 1) + 1;
+            lines = data_.substr(position_, end - position_);
+            position_ = end;
+            return true;
+        }
+
+    private:
+        std::string_view data_;
+        size_t position_ = 0;
+    };
+
+    template <typename Number>
+    bool ParseNumber(std::string_view text, Number& number) {
+        const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+        return error == std::errc() && end == text.data() + text.size();
+    }
+
+    bool ParseStatus(std::string_view text, DocumentStatus& status) {
+        static const std::pair<std::string_view, DocumentStatus> statuses[] = {
+            { "ACTUAL", DocumentStatus::ACTUAL },
+            { "IRRELEVANT", DocumentStatus::IRRELEVANT },
+            { "BANNED", DocumentStatus::BANNED },
+            { "REMOVED", DocumentStatus::REMOVED },
+        };
+        for (const auto& [name, value] : statuses) {
+            if (text == name) {
+                status = value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Cuts the next field off line; false if no tab ends it. The text is the rest of the line.
+    bool TakeField(std::string_view& line, std::string_view& field) {
+        const size_t tab = line.find('\t');
+        if (tab == std::string_view::npos) {
+            return false;
+        }
+        field = line.substr(0, tab);
+        line.remove_prefix(tab + 1);
+        return true;
+    }
+
+    bool ParseRecord(std::string_view line, DocumentInput& document) {
+        std::string_view id;
+        std::string_view status;
+        std::string_view ratings;
+        if (!TakeField(line, id) || !TakeField(line, status) || !TakeField(line, ratings)
+            || !ParseNumber(id, document.id) || !ParseStatus(status, document.status)) {
+            return false;
+        }
+        document.text = line;
+        document.ratings.clear();
+        while (!ratings.empty()) {
+            const size_t space = ratings.find(' ');
+            const std::string_view rating = ratings.substr(0, space);
+            ratings.remove_prefix(space == std::string_view::npos ? ratings.size() : space + 1);
+            if (!rating.empty()) {
+                document.ratings.push_back(0);
+                if (!ParseNumber(rating, document.ratings.back())) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // line_number counts the lines parsed so far, across batches.
+    void ParseRecords(std::string_view lines, size_t& line_number, std::vector<DocumentInput>& documents) {
+        documents.clear();
+        while (!lines.empty()) {
+            const size_t line_end = lines.find('\n');
+            std::string_view line = lines.substr(0, line_end);
+            lines.remove_prefix(line_end == std::string_view::npos ? lines.size() : line_end + 1);
+            ++line_number;
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            if (line.empty()) {
+                continue;
+            }
+            documents.emplace_back();
+            if (!ParseRecord(line, documents.back())) {
+                throw std::invalid_argument("Invalid document record at line " + std::to_string(line_number));
+            }
+        }
+    }
+
+    // The reader thread takes an empty batch, fills and parses it and queues it; the
+    // calling thread indexes queued batches and hands them back. If either side
+    // throws, closing both queues stops the other one.
+    template <typename ChunkReader>
+    size_t RunPipeline(ChunkReader read_chunk, const AddDocumentsFunction& add_documents) {
+        BatchQueue free_batches(kQueueDepth + 2);
+        BatchQueue parsed_batches(kQueueDepth);
+        for (size_t i = 0; i < kQueueDepth + 2; ++i) {
+            free_batches.Push(std::make_unique<DocumentBatch>());
+        }
+
+        std::exception_ptr reader_error;
+        std::thread reader([&] {
+            try {
+                size_t line_number = 0;
+                std::string_view lines;
+                while (std::unique_ptr<DocumentBatch> batch = free_batches.Pop()) {
+                    if (!read_chunk(*batch, lines)) {
+                        break;
+                    }
+                    ParseRecords(lines, line_number, batch->documents);
+                    if (!parsed_batches.Push(std::move(batch))) {
+                        break;
+                    }
+                }
+            }
+            catch (...) {
+                reader_error = std::current_exception();
+            }
+            parsed_batches.Close();
+            });
+
+        size_t document_count = 0;
+        try {
+            while (std::unique_ptr<DocumentBatch> batch = parsed_batches.Pop()) {
+                if (!batch->documents.empty()) {
+                    add_documents(batch->documents);
+                    document_count += batch->documents.size();
+                }
+                free_batches.Push(std::move(batch));
+            }
+        }
+        catch (...) {
+            free_batches.Close();
+            parsed_batches.Close();
+            reader.join();
+            throw;
+        }
+        reader.join();
+        if (reader_error) {
+            std::rethrow_exception(reader_error);
+        }
+        return document_count;
+    }
+
+    size_t LoadFromStream(std::istream& input, const AddDocumentsFunction& add_documents) {
+        return RunPipeline(StreamChunkReader(input), add_documents);
+    }
+
+    size_t LoadFromFile(const std::string& path, const AddDocumentsFunction& add_documents) {
+        const MappedFile file(path);
+        const std::string_view data(reinterpret_cast<const char*>(file.GetData()), file.GetSize());
+        return RunPipeline(MappedChunkReader(data), add_documents);
+    }
+}
+
+size_t LoadDocuments(SearchServer& search_server, std::istream& input) {
+    return LoadFromStream(input, [&search_server](const std::vector<DocumentInput>& documents) {
+        search_server.AddDocuments(std::execution::par, documents);
+        });
+}
+
+size_t LoadDocuments(SearchServer& search_server, const std::string& path) {
+    return LoadFromFile(path, [&search_server](const std::vector<DocumentInput>& documents) {
+        search_server.AddDocuments(std::execution::par, documents);
+        });
+}
+
+size_t LoadDocuments(ConcurrentSearchServer& search_server, std::istream& input) {
+    return LoadFromStream(input, [&search_server](const std::vector<DocumentInput>& documents) {
+        search_server.AddDocuments(documents);
+        });
+}
+
+size_t LoadDocuments(ConcurrentSearchServer& search_server, const std::string& path) {
+    return LoadFromFile(path, [&search_server](const std::vector<DocumentInput>& documents) {
+        search_server.AddDocuments(documents);
+        });
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <istream>
+#include <string>
+
+#include "concurrent_search_server.h"
+#include "search_server.h"
+
+// Loads a document dump: one document per line, fields separated by tabs,
+//     id <TAB> status <TAB> ratings <TAB> text
+// where status is ACTUAL, IRRELEVANT, BANNED or REMOVED and ratings are integers
+// separated by spaces, possibly none. Lines may end in "\r\n"; blank lines are skipped.
+//
+// A reader thread cuts the input into batches of whole lines and parses them while
+// the calling thread indexes the previous batch with AddDocuments. Texts are views
+// of the mapped file or of the batch's read buffer, so no line is copied. At most a
+// few batches are in flight and their buffers are reused, which bounds memory.
+//
+// Returns the number of documents added. Throws std::invalid_argument for a
+// malformed line (naming it) or a document AddDocuments rejects; the batches
+// before it stay in the index. The path overloads throw std::runtime_error if
+// the file cannot be opened.
+size_t LoadDocuments(SearchServer& search_server, std::istream& input);
+size_t LoadDocuments(SearchServer& search_server, const std::string& path);
+size_t LoadDocuments(ConcurrentSearchServer& search_server, std::istream& input);
+size_t LoadDocuments(ConcurrentSearchServer& search_server, const std::string& path);
@@ -0,0 +1,428 @@
+#include "index_snapshot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(PostingList::BlockHeader) == 16, "Block headers are stored in snapshots as is");
+static_assert(sizeof(PostingList::Posting) == 8, "Postings are stored in snapshots as is");
+static_assert(sizeof(IndexSnapshot::TermRecord) == 72, "Snapshot records must not have padding");
+static_assert(sizeof(IndexSnapshot::DocumentRecord) == 32, "Snapshot records must not have padding");
+
+namespace {
+    const size_t kSectionAlignment = 8;
+
+    size_t AlignSection(size_t offset) {
+        return (offset + kSectionAlignment - 1) / kSectionAlignment * kSectionAlignment;
+    }
+
+    // True if [offset, offset + size) lies inside [0, limit), without overflowing.
+    bool IsInside(uint64_t offset, uint64_t size, uint64_t limit) {
+        return offset <= limit && size <= limit - offset;
+    }
+
+    [[noreturn]] void ThrowInvalidSnapshot(const std::string& reason) {
+        throw std::invalid_argument("Invalid index snapshot: " + reason);
+    }
+
+    // Replaces `to` with `from` in one step, so a reader never sees a partly written file.
+    bool RenameOver(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+        return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+    }
+}
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) {
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) {
+        file_ = nullptr;
+        throw std::runtime_error("Cannot open " + path);
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file_, &size)) {
+        CloseHandle(file_);
+        throw std::runtime_error("Cannot read the size of " + path);
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+    if (size_ == 0) {
+        return;
+    }
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = mapping_ != nullptr ? MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (view == nullptr) {
+        if (mapping_ != nullptr) {
+            CloseHandle(mapping_);
+        }
+        CloseHandle(file_);
+        throw std::runtime_error("Cannot map " + path);
+    }
+    data_ = static_cast<const uint8_t*>(view);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        UnmapViewOfFile(data_);
+    }
+    if (mapping_ != nullptr) {
+        CloseHandle(mapping_);
+    }
+    if (file_ != nullptr) {
+        CloseHandle(file_);
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) {
+    const int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0) {
+        close(file);
+        throw std::runtime_error("Cannot read the size of " + path);
+    }
+    size_ = static_cast<size_t>(status.st_size);
+    if (size_ > 0) {
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, file, 0);
+        if (data == MAP_FAILED) {
+            close(file);
+            throw std::runtime_error("Cannot map " + path);
+        }
+        data_ = static_cast<const uint8_t*>(data);
+    }
+    // The mapping keeps the file alive on its own.
+    close(file);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(const_cast<uint8_t*>(data_), size_);
+    }
+}
+
+#endif
+
+const uint8_t* MappedFile::GetData() const {
+    return data_;
+}
+
+size_t MappedFile::GetSize() const {
+    return size_;
+}
+
+IndexSnapshot::IndexSnapshot(const std::string& path, SnapshotVerification verification)
+    : file_(path)
+{
+    if (file_.GetSize() < sizeof(Header)) {
+        ThrowInvalidSnapshot("the file is too short");
+    }
+    header_ = reinterpret_cast<const Header*>(file_.GetData());
+    if (std::memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0) {
+        ThrowInvalidSnapshot("not a snapshot file");
+    }
+    if (header_->byte_order_mark != kByteOrderMark) {
+        ThrowInvalidSnapshot("written on a host with another byte order");
+    }
+    if (header_->version != kVersion) {
+        ThrowInvalidSnapshot("unsupported version " + std::to_string(header_->version));
+    }
+    if (header_->file_size != file_.GetSize()) {
+        ThrowInvalidSnapshot("the file is truncated");
+    }
+    if (verification == SnapshotVerification::CHECKSUM
+        && header_->checksum != ComputeChecksum(file_.GetData() + sizeof(Header), file_.GetSize() - sizeof(Header))) {
+        ThrowInvalidSnapshot("checksum mismatch");
+    }
+    stop_word_count_ = MapSection(kStopWords, stop_words_);
+    strings_size_ = MapSection(kStrings, strings_);
+    term_count_ = MapSection(kTerms, terms_);
+    block_count_ = MapSection(kBlocks, blocks_);
+    posting_data_size_ = MapSection(kPostingData, posting_data_);
+    tail_posting_count_ = MapSection(kTailPostings, tail_postings_);
+    document_count_ = MapSection(kDocuments, documents_);
+    document_term_count_ = MapSection(kDocumentTerms, document_terms_);
+    Validate();
+}
+
+// FNV-1a over 64-bit words instead of bytes, with the high half folded back in
+// after every step: a multiplication only carries changes upwards. Sections are
+// padded to 8 bytes, so the byte loop only runs for a damaged file size.
+uint64_t IndexSnapshot::ComputeChecksum(const uint8_t* data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+template <typename Record>
+size_t IndexSnapshot::MapSection(Section section, const Record*& items) const {
+    const SectionRecord& record = header_->sections[section];
+    if (record.offset < sizeof(Header) || record.offset % kSectionAlignment != 0 || record.size % sizeof(Record) != 0
+        || !IsInside(record.offset, record.size, file_.GetSize())) {
+        ThrowInvalidSnapshot("bad section bounds");
+    }
+    items = reinterpret_cast<const Record*>(file_.GetData() + record.offset);
+    return record.size / sizeof(Record);
+}
+
+// The checksum catches damage; these checks keep a damaged file, or one from a
+// buggy writer, from sending queries out of bounds. Of block bodies only the gaps
+// are read, and the terms of documents are checked by MakeWordFrequencies, which reads them.
+void IndexSnapshot::Validate() const {
+    for (size_t i = 0; i < stop_word_count_; ++i) {
+        if (!IsInside(stop_words_[i].offset, stop_words_[i].size, strings_size_)) {
+            ThrowInvalidSnapshot("bad stop word");
+        }
+    }
+    for (size_t term = 0; term < term_count_; ++term) {
+        const TermRecord& record = terms_[term];
+        if (!IsInside(record.word_offset, record.word_size, strings_size_) || !IsInside(record.first_block, record.block_count, block_count_)
+            || !IsInside(record.data_offset, record.data_size, posting_data_size_)
+            || !IsInside(record.first_tail_posting, record.tail_size, tail_posting_count_)) {
+            ThrowInvalidSnapshot("bad term record");
+        }
+        if (term > 0 && GetWord(term - 1) >= GetWord(term)) {
+            ThrowInvalidSnapshot("terms are not sorted");
+        }
+        const PostingList::Storage storage = GetPostings(term);
+        if (!PostingList::IsValidStorage(storage)) {
+            ThrowInvalidSnapshot("bad posting list");
+        }
+        const bool is_ordinal_out_of_range = storage.tail_size > 0
+            ? storage.tail[storage.tail_size - 1].ordinal >= document_count_
+            : storage.block_count > 0 && storage.blocks[storage.block_count - 1].last_ordinal >= document_count_;
+        if (is_ordinal_out_of_range) {
+            ThrowInvalidSnapshot("posting of an unknown document");
+        }
+    }
+    for (size_t ordinal = 0; ordinal < document_count_; ++ordinal) {
+        const DocumentRecord& record = documents_[ordinal];
+        if (record.status < 0 || record.status > static_cast<int32_t>(DocumentStatus::REMOVED)
+            || !IsInside(record.first_term, record.term_count, document_term_count_)
+            || (record.term_count > 0 && record.word_count == 0)) {
+            ThrowInvalidSnapshot("bad document record");
+        }
+    }
+}
+
+std::vector<std::string> IndexSnapshot::GetStopWords() const {
+    std::vector<std::string> stop_words;
+    stop_words.reserve(stop_word_count_);
+    for (size_t i = 0; i < stop_word_count_; ++i) {
+        stop_words.emplace_back(strings_ + stop_words_[i].offset, stop_words_[i].size);
+    }
+    return stop_words;
+}
+
+size_t IndexSnapshot::GetTermCount() const {
+    return term_count_;
+}
+
+std::string_view IndexSnapshot::GetWord(size_t term) const {
+    return { strings_ + terms_[term].word_offset, terms_[term].word_size };
+}
+
+const IndexSnapshot::TermRecord& IndexSnapshot::GetTerm(size_t term) const {
+    return terms_[term];
+}
+
+size_t IndexSnapshot::FindTerm(std::string_view word) const {
+    size_t begin = 0;
+    size_t end = term_count_;
+    while (begin < end) {
+        const size_t middle = begin + (end - begin) / 2;
+        const int comparison = GetWord(middle).compare(word);
+        if (comparison == 0) {
+            return middle;
+        }
+        if (comparison < 0) {
+            begin = middle + 1;
+        }
+        else {
+            end = middle;
+        }
+    }
+    return term_count_;
+}
+
+PostingList::Storage IndexSnapshot::GetPostings(size_t term) const {
+    const TermRecord& record = terms_[term];
+    PostingList::Storage storage;
+    storage.blocks = blocks_ + record.first_block;
+    storage.block_count = record.block_count;
+    storage.data = posting_data_ + record.data_offset;
+    storage.data_size = record.data_size;
+    storage.tail = tail_postings_ + record.first_tail_posting;
+    storage.tail_size = record.tail_size;
+    storage.posting_count = record.posting_count;
+    return storage;
+}
+
+size_t IndexSnapshot::GetDocumentCount() const {
+    return document_count_;
+}
+
+const IndexSnapshot::DocumentRecord& IndexSnapshot::GetDocument(size_t ordinal) const {
+    return documents_[ordinal];
+}
+
+std::map<std::string, double, std::less<>> IndexSnapshot::MakeWordFrequencies(size_t ordinal) const {
+    const DocumentRecord& document = documents_[ordinal];
+    // The same expression AddDocument used, so the frequencies come out bit-identical.
+    const double inv_word_count = 1.0 / document.word_count;
+    std::map<std::string, double, std::less<>> word_freqs;
+    for (uint64_t i = document.first_term; i < document.first_term + document.term_count; ++i) {
+        const DocumentTerm& term = document_terms_[i];
+        if (term.term >= term_count_) {
+            ThrowInvalidSnapshot("document of an unknown term");
+        }
+        word_freqs.emplace_hint(word_freqs.end(), GetWord(term.term), term.count * inv_word_count);
+    }
+    return word_freqs;
+}
+
+const std::map<std::string, double, std::less<>>& IndexSnapshot::GetWordFrequencies(size_t ordinal) const {
+    std::lock_guard<std::mutex> lock(word_frequencies_mutex_);
+    auto it = word_frequencies_.find(ordinal);
+    if (it == word_frequencies_.end()) {
+        it = word_frequencies_.emplace(ordinal, MakeWordFrequencies(ordinal)).first;
+    }
+    return it->second;
+}
+
+uint64_t IndexSnapshot::GetDictionaryId() const {
+    return header_->dictionary_id;
+}
+
+size_t IndexSnapshot::GetFileSize() const {
+    return file_.GetSize();
+}
+
+void IndexSnapshotWriter::AddStopWord(std::string_view word) {
+    const uint64_t offset = AddString(word);
+    stop_words_.push_back({ offset, word.size() });
+}
+
+uint32_t IndexSnapshotWriter::AddTerm(std::string_view word, const PostingList& postings, double max_term_freq) {
+    if (!terms_.empty() && word <= last_word_) {
+        throw std::invalid_argument("Snapshot terms must be added in increasing word order");
+    }
+    last_word_ = std::string{ word };
+    const PostingList::Storage storage = postings.GetStorage();
+    IndexSnapshot::TermRecord record;
+    record.word_offset = AddString(word);
+    record.word_size = static_cast<uint32_t>(word.size());
+    record.first_block = blocks_.size();
+    record.block_count = static_cast<uint32_t>(storage.block_count);
+    record.data_offset = posting_data_.size();
+    record.data_size = storage.data_size;
+    record.first_tail_posting = tail_postings_.size();
+    record.tail_size = static_cast<uint32_t>(storage.tail_size);
+    record.posting_count = storage.posting_count;
+    record.max_term_freq = max_term_freq;
+    blocks_.insert(blocks_.end(), storage.blocks, storage.blocks + storage.block_count);
+    posting_data_.insert(posting_data_.end(), storage.data, storage.data + storage.data_size);
+    tail_postings_.insert(tail_postings_.end(), storage.tail, storage.tail + storage.tail_size);
+    terms_.push_back(record);
+    return static_cast<uint32_t>(terms_.size() - 1);
+}
+
+void IndexSnapshotWriter::AddDocument(int id, int rating, DocumentStatus status, bool is_live,
+    const std::vector<IndexSnapshot::DocumentTerm>& terms) {
+    IndexSnapshot::DocumentRecord record;
+    record.id = id;
+    record.rating = rating;
+    record.status = static_cast<int32_t>(status);
+    record.is_live = is_live ? 1 : 0;
+    for (const IndexSnapshot::DocumentTerm& term : terms) {
+        record.word_count += term.count;
+    }
+    record.term_count = static_cast<uint32_t>(terms.size());
+    record.first_term = document_terms_.size();
+    document_terms_.insert(document_terms_.end(), terms.begin(), terms.end());
+    documents_.push_back(record);
+}
+
+void IndexSnapshotWriter::SetDictionaryId(uint64_t dictionary_id) {
+    dictionary_id_ = dictionary_id;
+}
+
+void IndexSnapshotWriter::Write(const std::string& path) const {
+    using Header = IndexSnapshot::Header;
+    const std::pair<const void*, size_t> sections[IndexSnapshot::kSectionCount] = {
+        { stop_words_.data(), stop_words_.size() * sizeof(IndexSnapshot::WordRecord) },
+        { strings_.data(), strings_.size() },
+        { terms_.data(), terms_.size() * sizeof(IndexSnapshot::TermRecord) },
+        { blocks_.data(), blocks_.size() * sizeof(PostingList::BlockHeader) },
+        { posting_data_.data(), posting_data_.size() },
+        { tail_postings_.data(), tail_postings_.size() * sizeof(PostingList::Posting) },
+        { documents_.data(), documents_.size() * sizeof(IndexSnapshot::DocumentRecord) },
+        { document_terms_.data(), document_terms_.size() * sizeof(IndexSnapshot::DocumentTerm) },
+    };
+    Header header;
+    std::memcpy(header.magic, IndexSnapshot::kMagic, sizeof(header.magic));
+    header.version = IndexSnapshot::kVersion;
+    header.byte_order_mark = IndexSnapshot::kByteOrderMark;
+    header.dictionary_id = dictionary_id_;
+    size_t file_size = AlignSection(sizeof(Header));
+    for (size_t section = 0; section < IndexSnapshot::kSectionCount; ++section) {
+        header.sections[section] = { file_size, sections[section].second };
+        file_size = AlignSection(file_size + sections[section].second);
+    }
+    header.file_size = file_size;
+
+    std::vector<uint8_t> bytes(file_size, 0);
+    for (size_t section = 0; section < IndexSnapshot::kSectionCount; ++section) {
+        if (sections[section].second > 0) {
+            std::memcpy(bytes.data() + header.sections[section].offset, sections[section].first, sections[section].second);
+        }
+    }
+    header.checksum = IndexSnapshot::ComputeChecksum(bytes.data() + sizeof(Header), bytes.size() - sizeof(Header));
+    std::memcpy(bytes.data(), &header, sizeof(Header));
+
+    // Snapshots of this path may still be mapped, so the old file is replaced rather than truncated.
+    const std::string temporary_path = path + ".tmp";
+    std::ofstream output(temporary_path, std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    output.close();
+    if (!output) {
+        std::remove(temporary_path.c_str());
+        throw std::runtime_error("Cannot write " + temporary_path);
+    }
+    if (!RenameOver(temporary_path, path)) {
+        std::remove(temporary_path.c_str());
+        throw std::runtime_error("Cannot replace " + path);
+    }
+}
+
+uint64_t IndexSnapshotWriter::AddString(std::string_view text) {
+    const uint64_t offset = strings_.size();
+    strings_.append(text);
+    return offset;
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "document.h"
+#include "posting_list.h"
+
+// A whole file mapped read-only into memory.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile();
+
+    const uint8_t* GetData() const;
+
+    size_t GetSize() const;
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
+
+// How much of a snapshot file is checked when it is mapped.
+enum class SnapshotVerification {
+    // Header, sections, term and document records, block headers and the gaps in
+    // block bodies: enough to keep queries in bounds. Reads the gap bytes of the
+    // postings but not their counts; the terms of each document are checked when
+    // they are first read.
+    STRUCTURE,
+    // Also the checksum, which reads every byte of the file.
+    CHECKSUM,
+};
+
+// Immutable on-disk image of a search index: stop words, the term dictionary,
+// the posting lists, per-document metadata and the terms of every document.
+// Every record has a fixed size and natural alignment, and sections start at
+// multiples of 8, so a mapped file is used in place: posting lists view their
+// blocks right in the mapping and the dictionary is binary-searched there.
+// Numbers are in the byte order of the host that wrote the file.
+class IndexSnapshot {
+public:
+    // Bumped whenever the layout of any record changes.
+    static constexpr uint32_t kVersion = 3;
+
+    // Terms are sorted by word; a term's index is its position in that order.
+    struct TermRecord {
+        uint64_t word_offset = 0;
+        uint64_t first_block = 0;
+        // Offset of the term's block bodies in the posting data section.
+        uint64_t data_offset = 0;
+        uint64_t data_size = 0;
+        uint64_t first_tail_posting = 0;
+        uint64_t posting_count = 0;
+        double max_term_freq = 0.0;
+        uint32_t word_size = 0;
+        uint32_t block_count = 0;
+        uint32_t tail_size = 0;
+        uint32_t reserved = 0;
+    };
+
+    // One per document ordinal, including removed documents: postings refer to ordinals.
+    struct DocumentRecord {
+        int32_t id = 0;
+        int32_t rating = 0;
+        int32_t status = 0;
+        uint32_t is_live = 0;
+        // Non-stop words in the document, repeats included.
+        uint32_t word_count = 0;
+        uint32_t term_count = 0;
+        uint64_t first_term = 0;
+    };
+
+    // Terms of a document are sorted by term index.
+    struct DocumentTerm {
+        uint32_t term = 0;
+        uint32_t count = 0;
+    };
+
+    struct WordRecord {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+    // Maps the file and checks its magic, version and record bounds, and its checksum
+    // if asked to. Throws std::invalid_argument for a file that is not a valid snapshot.
+    explicit IndexSnapshot(const std::string& path, SnapshotVerification verification = SnapshotVerification::STRUCTURE);
+
+    std::vector<std::string> GetStopWords() const;
+
+    size_t GetTermCount() const;
+
+    std::string_view GetWord(size_t term) const;
+
+    const TermRecord& GetTerm(size_t term) const;
+
+    // Index of the term with the given word, GetTermCount() if there is none.
+    size_t FindTerm(std::string_view word) const;
+
+    PostingList::Storage GetPostings(size_t term) const;
+
+    size_t GetDocumentCount() const;
+
+    const DocumentRecord& GetDocument(size_t ordinal) const;
+
+    // Throws std::invalid_argument if the document refers to an unknown term.
+    std::map<std::string, double, std::less<>> MakeWordFrequencies(size_t ordinal) const;
+
+    // Same as MakeWordFrequencies, but built once per document and kept with the
+    // snapshot, so the reference stays valid while the snapshot lives.
+    const std::map<std::string, double, std::less<>>& GetWordFrequencies(size_t ordinal) const;
+
+    // Identity of the term numbering, see SearchServer::CompileQuery.
+    uint64_t GetDictionaryId() const;
+
+    size_t GetFileSize() const;
+
+private:
+    friend class IndexSnapshotWriter;
+
+    enum Section : uint32_t {
+        kStopWords,
+        kStrings,
+        kTerms,
+        kBlocks,
+        kPostingData,
+        kTailPostings,
+        kDocuments,
+        kDocumentTerms,
+        kSectionCount,
+    };
+
+    struct SectionRecord {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+    struct Header {
+        char magic[8] = {};
+        uint32_t version = 0;
+        // kByteOrderMark as the writer saw it; a host with the other byte order reads it reversed.
+        uint32_t byte_order_mark = 0;
+        uint64_t file_size = 0;
+        // Checksum of everything after the header.
+        uint64_t checksum = 0;
+        SectionRecord sections[kSectionCount];
+        uint64_t dictionary_id = 0;
+    };
+
+    static constexpr char kMagic[8] = { 'S', 'R', 'C', 'H', 'I', 'D', 'X', '\0' };
+    static constexpr uint32_t kByteOrderMark = 0x01020304;
+
+    static uint64_t ComputeChecksum(const uint8_t* data, size_t size);
+
+    // Points items at the section and returns the number of records in it.
+    template <typename Record>
+    size_t MapSection(Section section, const Record*& items) const;
+
+    void Validate() const;
+
+    MappedFile file_;
+    const Header* header_ = nullptr;
+    const WordRecord* stop_words_ = nullptr;
+    size_t stop_word_count_ = 0;
+    const char* strings_ = nullptr;
+    size_t strings_size_ = 0;
+    const TermRecord* terms_ = nullptr;
+    size_t term_count_ = 0;
+    const PostingList::BlockHeader* blocks_ = nullptr;
+    size_t block_count_ = 0;
+    const uint8_t* posting_data_ = nullptr;
+    size_t posting_data_size_ = 0;
+    const PostingList::Posting* tail_postings_ = nullptr;
+    size_t tail_posting_count_ = 0;
+    const DocumentRecord* documents_ = nullptr;
+    size_t document_count_ = 0;
+    const DocumentTerm* document_terms_ = nullptr;
+    size_t document_term_count_ = 0;
+
+    mutable std::mutex word_frequencies_mutex_;
+    mutable std::map<size_t, std::map<std::string, double, std::less<>>> word_frequencies_;
+};
+
+// Collects an index in snapshot layout and writes it out in one go.
+class IndexSnapshotWriter {
+public:
+    void AddStopWord(std::string_view word);
+
+    // Terms must be added in increasing word order. Returns the term index.
+    uint32_t AddTerm(std::string_view word, const PostingList& postings, double max_term_freq);
+
+    // Documents must be added in ordinal order; terms sorted by term index.
+    void AddDocument(int id, int rating, DocumentStatus status, bool is_live, const std::vector<IndexSnapshot::DocumentTerm>& terms);
+
+    void SetDictionaryId(uint64_t dictionary_id);
+
+    // Writes path + ".tmp" and renames it over path, so snapshots already mapped from path stay intact.
+    // Throws std::runtime_error if the file cannot be written.
+    void Write(const std::string& path) const;
+
+private:
+    uint64_t AddString(std::string_view text);
+
+    std::vector<IndexSnapshot::WordRecord> stop_words_;
+    std::string strings_;
+    std::vector<IndexSnapshot::TermRecord> terms_;
+    std::vector<PostingList::BlockHeader> blocks_;
+    std::vector<uint8_t> posting_data_;
+    std::vector<PostingList::Posting> tail_postings_;
+    std::vector<IndexSnapshot::DocumentRecord> documents_;
+    std::vector<IndexSnapshot::DocumentTerm> document_terms_;
+    uint64_t dictionary_id_ = 0;
+    std::string last_word_;
+};
@@ -1,6 +1,8 @@
+#include "benchmark_functions.h"
 #include "process_queries.h"
 #include "search_server.h"
 
+#include <charconv>
 #include <execution>
 #include <iostream>
 #include <string>
@@ -15,7 +17,33 @@ void PrintDocument(const Document& document) {
         << "rating = "s << document.rating << " }"s << endl;
 }
 
-int main() {
+// Accepts only a whole decimal number above zero that fits into an int.
+bool ParsePositiveInt(const string& text, int& value) {
+    const char* const end = text.data() + text.size();
+    const auto [ptr, error] = from_chars(text.data(), end, value);
+    return error == errc() && ptr == end && value > 0;
+}
+
+int main(int argc, char* argv[]) {
+    // --benchmark [document_count...] writes the benchmark suite results to stdout as JSON lines.
+    if (argc > 1 && argv[1] == "--benchmark"s) {
+        BenchmarkSuiteOptions options;
+        if (argc > 2) {
+            options.document_counts.clear();
+            for (int i = 2; i < argc; ++i) {
+                int document_count = 0;
+                if (!ParsePositiveInt(argv[i], document_count)) {
+                    cerr << "Invalid document count: "s << argv[i] << endl;
+                    cerr << "Usage: "s << argv[0] << " --benchmark [document_count...]"s << endl;
+                    return 1;
+                }
+                options.document_counts.push_back(document_count);
+            }
+        }
+        RunBenchmarkSuite(options, cout);
+        return 0;
+    }
+
     SearchServer search_server("and with"s);
 
     int id = 0;
@@ -0,0 +1,390 @@
+#include "posting_list.h"
+
+#include <algorithm>
+
+namespace {
+    uint32_t GetByteWidth(uint32_t max_value) {
+        if (max_value == 0) {
+            return 0;
+        }
+        return max_value <= 0xFF ? 1 : max_value <= 0xFFFF ? 2 : 4;
+    }
+
+    void Pack(const uint32_t* values, size_t value_count, uint32_t width, std::vector<uint8_t>& data) {
+        for (size_t i = 0; i < value_count; ++i) {
+            for (uint32_t byte = 0; byte < width; ++byte) {
+                data.push_back(static_cast<uint8_t>(values[i] >> (8 * byte)));
+            }
+        }
+    }
+
+    uint64_t ReadLittleEndian(const uint8_t* data, uint32_t width) {
+        uint64_t value = 0;
+        for (uint32_t byte = 0; byte < width; ++byte) {
+            value |= uint64_t{ data[byte] } << (8 * byte);
+        }
+        return value;
+    }
+
+    bool IsOrdinalLess(const PostingList::Posting& posting, uint32_t ordinal) {
+        return posting.ordinal < ordinal;
+    }
+}
+
+PostingList PostingList::MakeView(const Storage& storage) {
+    PostingList postings;
+    postings.is_view_ = true;
+    postings.view_ = storage;
+    postings.size_ = storage.posting_count;
+    return postings;
+}
+
+bool PostingList::IsValidStorage(const Storage& storage) {
+    size_t posting_count = 0;
+    uint64_t next_ordinal = 0;
+    for (size_t block = 0; block < storage.block_count; ++block) {
+        const BlockHeader& header = storage.blocks[block];
+        const auto is_valid_width = [](uint8_t width) {
+            return width == 0 || width == 1 || width == 2 || width == 4;
+        };
+        if (header.posting_count == 0 || header.posting_count > kBlockSize || !is_valid_width(header.gap_width)
+            || !is_valid_width(header.count_width) || header.first_ordinal < next_ordinal
+            || header.last_ordinal < header.first_ordinal
+            || header.data_offset > storage.data_size || GetBlockByteCount(header) > storage.data_size - header.data_offset) {
+            return false;
+        }
+        if (!HasExactGaps(header, storage.data)) {
+            return false;
+        }
+        posting_count += header.posting_count;
+        next_ordinal = uint64_t{ header.last_ordinal } + 1;
+    }
+    // Cursors copy the tail into block-sized buffers; Append never lets it reach a block.
+    if (storage.tail_size >= kBlockSize) {
+        return false;
+    }
+    for (size_t i = 0; i < storage.tail_size; ++i) {
+        if (storage.tail[i].ordinal < next_ordinal || storage.tail[i].count == 0) {
+            return false;
+        }
+        next_ordinal = uint64_t{ storage.tail[i].ordinal } + 1;
+    }
+    return posting_count + storage.tail_size == storage.posting_count;
+}
+
+// Decoding adds the gaps without checks, so they must lead from first_ordinal to
+// exactly last_ordinal: then every ordinal of the block lies between the two.
+bool PostingList::HasExactGaps(const BlockHeader& header, const uint8_t* data) {
+    const uint8_t* gaps = data + header.data_offset;
+    if (ReadLittleEndian(gaps, header.gap_width) != 0) {
+        return false;
+    }
+    const uint64_t span = header.last_ordinal - header.first_ordinal;
+    uint64_t distance = 0;
+    for (size_t i = 1; i < header.posting_count && distance <= span; ++i) {
+        distance += ReadLittleEndian(gaps + i * header.gap_width, header.gap_width) + 1;
+    }
+    return distance == span;
+}
+
+PostingList::Storage PostingList::GetStorage() const {
+    if (is_view_) {
+        return view_;
+    }
+    return { blocks_.data(), blocks_.size(), data_.data(), data_.size(), tail_.data(), tail_.size(), size_ };
+}
+
+void PostingList::MakeOwned() {
+    if (!is_view_) {
+        return;
+    }
+    blocks_.assign(view_.blocks, view_.blocks + view_.block_count);
+    data_.assign(view_.data, view_.data + view_.data_size);
+    tail_.assign(view_.tail, view_.tail + view_.tail_size);
+    is_view_ = false;
+    view_ = {};
+}
+
+void PostingList::Append(uint32_t ordinal, uint32_t count) {
+    MakeOwned();
+    tail_.push_back({ ordinal, count });
+    ++size_;
+    if (tail_.size() == kBlockSize) {
+        SealTail();
+    }
+}
+
+bool PostingList::Erase(uint32_t ordinal) {
+    MakeOwned();
+    const Storage storage = GetStorage();
+    if (IsInTail(storage, ordinal)) {
+        const auto it = std::lower_bound(tail_.begin(), tail_.end(), ordinal, IsOrdinalLess);
+        if (it == tail_.end() || it->ordinal != ordinal) {
+            return false;
+        }
+        tail_.erase(it);
+        --size_;
+        return true;
+    }
+    const size_t block = FindBlock(storage, ordinal);
+    if (block == blocks_.size() || blocks_[block].first_ordinal > ordinal) {
+        return false;
+    }
+    uint32_t ordinals[kBlockSize];
+    uint32_t counts[kBlockSize];
+    const size_t posting_count = DecodeBlock(storage, block, ordinals, counts);
+    const size_t position = std::lower_bound(ordinals, ordinals + posting_count, ordinal) - ordinals;
+    if (position == posting_count || ordinals[position] != ordinal) {
+        return false;
+    }
+
+    // Re-encode the block without the posting and splice it into the same place.
+    Posting postings[kBlockSize];
+    size_t kept = 0;
+    for (size_t i = 0; i < posting_count; ++i) {
+        if (i != position) {
+            postings[kept++] = { ordinals[i], counts[i] };
+        }
+    }
+    const size_t data_offset = blocks_[block].data_offset;
+    const size_t old_byte_count = GetBlockByteCount(blocks_[block]);
+    std::vector<uint8_t> bytes;
+    if (kept > 0) {
+        BlockHeader header = EncodeBlock(postings, kept, bytes);
+        header.data_offset = static_cast<uint32_t>(data_offset);
+        blocks_[block] = header;
+    }
+    else {
+        blocks_.erase(blocks_.begin() + block);
+    }
+    const auto first = data_.erase(data_.begin() + data_offset, data_.begin() + data_offset + old_byte_count);
+    data_.insert(first, bytes.begin(), bytes.end());
+    for (size_t next = kept > 0 ? block + 1 : block; next < blocks_.size(); ++next) {
+        blocks_[next].data_offset = static_cast<uint32_t>(blocks_[next].data_offset - old_byte_count + bytes.size());
+    }
+    --size_;
+    return true;
+}
+
+// Only the blocks between the first and the last of the ordinals are decoded. Their
+// surviving postings are packed again into full blocks, so repeated erases do not
+// leave a trail of tiny blocks, and spliced into the place of the old ones; later
+// blocks only have their data offsets shifted.
+size_t PostingList::Erase(const std::vector<uint32_t>& ordinals) {
+    if (ordinals.empty() || size_ == 0) {
+        return 0;
+    }
+    MakeOwned();
+    const size_t old_size = size_;
+    const Storage storage = GetStorage();
+    const size_t first_block = FindBlock(storage, ordinals.front());
+    const size_t end_block = std::upper_bound(blocks_.begin() + first_block, blocks_.end(), ordinals.back(),
+        [](uint32_t value, const BlockHeader& header) {
+            return value < header.first_ordinal;
+        }) - blocks_.begin();
+    if (first_block < end_block) {
+        std::vector<Posting> postings;
+        postings.reserve((end_block - first_block) * kBlockSize);
+        auto next = ordinals.begin();
+        const auto keep = [&](uint32_t ordinal, uint32_t count) {
+            next = std::lower_bound(next, ordinals.end(), ordinal);
+            if (next == ordinals.end() || *next != ordinal) {
+                postings.push_back({ ordinal, count });
+            }
+        };
+        size_t old_posting_count = 0;
+        for (size_t block = first_block; block < end_block; ++block) {
+            VisitBlock(blocks_[block], data_.data(), keep);
+            old_posting_count += blocks_[block].posting_count;
+        }
+        size_ -= old_posting_count - postings.size();
+
+        std::vector<BlockHeader> blocks;
+        std::vector<uint8_t> bytes;
+        for (size_t begin = 0; begin < postings.size(); begin += kBlockSize) {
+            blocks.push_back(EncodeBlock(postings.data() + begin, std::min(kBlockSize, postings.size() - begin), bytes));
+        }
+        const size_t data_begin = blocks_[first_block].data_offset;
+        const size_t data_end = blocks_[end_block - 1].data_offset + GetBlockByteCount(blocks_[end_block - 1]);
+        for (BlockHeader& header : blocks) {
+            header.data_offset += static_cast<uint32_t>(data_begin);
+        }
+        for (size_t block = end_block; block < blocks_.size(); ++block) {
+            blocks_[block].data_offset = static_cast<uint32_t>(blocks_[block].data_offset - data_end + data_begin + bytes.size());
+        }
+        const auto data_first = data_.erase(data_.begin() + data_begin, data_.begin() + data_end);
+        data_.insert(data_first, bytes.begin(), bytes.end());
+        const auto blocks_first = blocks_.erase(blocks_.begin() + first_block, blocks_.begin() + end_block);
+        blocks_.insert(blocks_first, blocks.begin(), blocks.end());
+    }
+
+    const auto tail_begin = std::lower_bound(tail_.begin(), tail_.end(), ordinals.front(), IsOrdinalLess);
+    const auto tail_end = std::remove_if(tail_begin, tail_.end(), [&ordinals](const Posting& posting) {
+        return std::binary_search(ordinals.begin(), ordinals.end(), posting.ordinal);
+        });
+    size_ -= tail_.end() - tail_end;
+    tail_.erase(tail_end, tail_.end());
+    return old_size - size_;
+}
+
+uint32_t PostingList::GetCount(uint32_t ordinal) const {
+    const Storage storage = GetStorage();
+    if (IsInTail(storage, ordinal)) {
+        const Posting* tail_end = storage.tail + storage.tail_size;
+        const Posting* it = std::lower_bound(storage.tail, tail_end, ordinal, IsOrdinalLess);
+        return it != tail_end && it->ordinal == ordinal ? it->count : 0;
+    }
+    const size_t block = FindBlock(storage, ordinal);
+    if (block == storage.block_count || storage.blocks[block].first_ordinal > ordinal) {
+        return 0;
+    }
+    uint32_t ordinals[kBlockSize];
+    uint32_t counts[kBlockSize];
+    const size_t posting_count = DecodeBlock(storage, block, ordinals, counts);
+    const size_t position = std::lower_bound(ordinals, ordinals + posting_count, ordinal) - ordinals;
+    return position != posting_count && ordinals[position] == ordinal ? counts[position] : 0;
+}
+
+size_t PostingList::CountPostings(uint32_t begin_ordinal, uint32_t end_ordinal) const {
+    if (begin_ordinal >= end_ordinal) {
+        return 0;
+    }
+    const Storage storage = GetStorage();
+    size_t posting_count = 0;
+    for (size_t block = FindBlock(storage, begin_ordinal); block < storage.block_count && storage.blocks[block].first_ordinal < end_ordinal; ++block) {
+        const BlockHeader& header = storage.blocks[block];
+        if (header.first_ordinal >= begin_ordinal && header.last_ordinal < end_ordinal) {
+            posting_count += header.posting_count;
+            continue;
+        }
+        uint32_t ordinals[kBlockSize];
+        uint32_t counts[kBlockSize];
+        const size_t block_size = DecodeBlock(storage, block, ordinals, counts);
+        posting_count += std::lower_bound(ordinals, ordinals + block_size, end_ordinal)
+            - std::lower_bound(ordinals, ordinals + block_size, begin_ordinal);
+    }
+    const Posting* tail_end = storage.tail + storage.tail_size;
+    posting_count += std::lower_bound(storage.tail, tail_end, end_ordinal, IsOrdinalLess)
+        - std::lower_bound(storage.tail, tail_end, begin_ordinal, IsOrdinalLess);
+    return posting_count;
+}
+
+size_t PostingList::GetSize() const {
+    return size_;
+}
+
+bool PostingList::IsEmpty() const {
+    return size_ == 0;
+}
+
+size_t PostingList::GetMemoryUsage() const {
+    return blocks_.capacity() * sizeof(BlockHeader) + data_.capacity() + tail_.capacity() * sizeof(Posting);
+}
+
+PostingList::Cursor PostingList::MakeCursor(uint32_t begin_ordinal, uint32_t end_ordinal) const {
+    Cursor cursor;
+    cursor.storage_ = GetStorage();
+    cursor.end_ordinal_ = end_ordinal;
+    cursor.LoadBlock(FindBlock(cursor.storage_, begin_ordinal));
+    cursor.SeekTo(begin_ordinal);
+    return cursor;
+}
+
+// Every posting stores its gap to the previous one minus one (the first one to
+// first_ordinal, so its gap is always zero) and its count minus one. A run of
+// consecutive documents mentioning the term once takes no bytes at all.
+PostingList::BlockHeader PostingList::EncodeBlock(const Posting* postings, size_t posting_count, std::vector<uint8_t>& data) {
+    BlockHeader header;
+    header.first_ordinal = postings[0].ordinal;
+    header.last_ordinal = postings[posting_count - 1].ordinal;
+    header.data_offset = static_cast<uint32_t>(data.size());
+    header.posting_count = static_cast<uint8_t>(posting_count);
+
+    uint32_t values[kBlockSize] = {};
+    uint32_t max_value = 0;
+    uint32_t previous_ordinal = header.first_ordinal;
+    for (size_t i = 0; i < posting_count; ++i) {
+        values[i] = postings[i].ordinal - previous_ordinal - (i > 0 ? 1 : 0);
+        previous_ordinal = postings[i].ordinal;
+        max_value = std::max(max_value, values[i]);
+    }
+    header.gap_width = static_cast<uint8_t>(GetByteWidth(max_value));
+    Pack(values, posting_count, header.gap_width, data);
+
+    max_value = 0;
+    for (size_t i = 0; i < posting_count; ++i) {
+        values[i] = postings[i].count - 1;
+        max_value = std::max(max_value, values[i]);
+    }
+    header.count_width = static_cast<uint8_t>(GetByteWidth(max_value));
+    Pack(values, posting_count, header.count_width, data);
+    return header;
+}
+
+size_t PostingList::GetBlockByteCount(const BlockHeader& header) {
+    return size_t{ header.posting_count } * (header.gap_width + header.count_width);
+}
+
+size_t PostingList::DecodeBlock(const Storage& storage, size_t block, uint32_t* ordinals, uint32_t* counts) {
+    size_t posting_count = 0;
+    auto store = [&](uint32_t ordinal, uint32_t count) {
+        ordinals[posting_count] = ordinal;
+        counts[posting_count++] = count;
+    };
+    VisitBlock(storage.blocks[block], storage.data, store);
+    return posting_count;
+}
+
+size_t PostingList::FindBlock(const Storage& storage, uint32_t ordinal) {
+    return std::lower_bound(storage.blocks, storage.blocks + storage.block_count, ordinal, [](const BlockHeader& header, uint32_t value) {
+        return header.last_ordinal < value;
+        }) - storage.blocks;
+}
+
+bool PostingList::IsInTail(const Storage& storage, uint32_t ordinal) {
+    return storage.tail_size > 0 && storage.tail[0].ordinal <= ordinal;
+}
+
+void PostingList::SealTail() {
+    blocks_.push_back(EncodeBlock(tail_.data(), tail_.size(), data_));
+    // Release the buffer: most terms never fill another block.
+    std::vector<Posting>().swap(tail_);
+}
+
+bool PostingList::Cursor::SeekTo(uint32_t ordinal) {
+    if (IsEnd()) {
+        return false;
+    }
+    if (ordinals_[size_ - 1] < ordinal) {
+        const BlockHeader* blocks = storage_.blocks;
+        size_t block = block_ + 1;
+        if (block < storage_.block_count) {
+            block = std::lower_bound(blocks + block, blocks + storage_.block_count, ordinal, [](const BlockHeader& header, uint32_t value) {
+                return header.last_ordinal < value;
+                }) - blocks;
+        }
+        LoadBlock(block);
+    }
+    position_ = std::lower_bound(ordinals_ + position_, ordinals_ + size_, ordinal) - ordinals_;
+    return position_ != size_ && ordinals_[position_] == ordinal;
+}
+
+void PostingList::Cursor::LoadBlock(size_t block) {
+    block_ = block;
+    position_ = 0;
+    size_ = 0;
+    if (block == storage_.block_count) {
+        for (size_t i = 0; i < storage_.tail_size && storage_.tail[i].ordinal < end_ordinal_; ++i) {
+            ordinals_[size_] = storage_.tail[i].ordinal;
+            counts_[size_++] = storage_.tail[i].count;
+        }
+        return;
+    }
+    if (block > storage_.block_count || storage_.blocks[block].first_ordinal >= end_ordinal_) {
+        return;
+    }
+    size_ = DecodeBlock(storage_, block, ordinals_, counts_);
+    if (storage_.blocks[block].last_ordinal >= end_ordinal_) {
+        size_ = std::lower_bound(ordinals_, ordinals_ + size_, end_ordinal_) - ordinals_;
+    }
+}
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Postings of one term: the ordinals of the documents that contain it, in
+// increasing order, each with the number of occurrences of the term.
+// Postings are packed in blocks of up to kBlockSize. A block header keeps the
+// first and last ordinal, so whole blocks are skipped without decoding; the
+// block body stores the gaps between ordinals and the occurrence counts, each
+// at the narrowest of 0, 1, 2 or 4 bytes that fits the whole block. Byte widths
+// cost a little more space than bit packing but decode with plain loads and
+// adds. The newest postings wait in a plain tail until a full block is
+// collected, so appends never re-encode.
+class PostingList {
+public:
+    static constexpr size_t kBlockSize = 128;
+
+    struct Posting {
+        uint32_t ordinal = 0;
+        uint32_t count = 0;
+    };
+
+    // Stored as is in index snapshots, so the layout is part of the file format.
+    struct BlockHeader {
+        uint32_t first_ordinal = 0;
+        uint32_t last_ordinal = 0;
+        // Offset of the block body in the list's data.
+        uint32_t data_offset = 0;
+        uint8_t posting_count = 0;
+        uint8_t gap_width = 0;
+        uint8_t count_width = 0;
+        uint8_t reserved = 0;
+    };
+
+    // Raw arrays behind a list, either its own buffers or memory it only views.
+    struct Storage {
+        const BlockHeader* blocks = nullptr;
+        size_t block_count = 0;
+        const uint8_t* data = nullptr;
+        size_t data_size = 0;
+        const Posting* tail = nullptr;
+        size_t tail_size = 0;
+        size_t posting_count = 0;
+    };
+
+    class Cursor;
+
+    // A read-only list over storage that someone else keeps alive, e.g. a mapped
+    // snapshot file. Nothing is copied; the first Append or Erase copies it all.
+    static PostingList MakeView(const Storage& storage);
+
+    // Checks block bounds, widths and ordinal order, and that the gaps of every block add up
+    // to its last ordinal, e.g. before viewing storage read from a file. Counts are not read.
+    static bool IsValidStorage(const Storage& storage);
+
+    Storage GetStorage() const;
+
+    // Copies viewed storage into the list's own buffers; does nothing for a list that owns them.
+    void MakeOwned();
+
+    // Ordinals must be appended in increasing order, count must be positive.
+    void Append(uint32_t ordinal, uint32_t count);
+
+    // Returns false if the document has no posting here.
+    bool Erase(uint32_t ordinal);
+
+    // Erases the postings of all the given documents (sorted ordinals, absent ones
+    // are skipped). Only the blocks between the first and the last ordinal are
+    // decoded and packed again, so erasing within one segment costs in the postings
+    // of that segment. Returns how many were erased.
+    size_t Erase(const std::vector<uint32_t>& ordinals);
+
+    // Occurrences of the term in the document, 0 if it has none.
+    uint32_t GetCount(uint32_t ordinal) const;
+
+    // Number of postings with ordinals in [begin_ordinal, end_ordinal).
+    size_t CountPostings(uint32_t begin_ordinal, uint32_t end_ordinal) const;
+
+    size_t GetSize() const;
+
+    bool IsEmpty() const;
+
+    // Heap bytes held by the list; a view holds none.
+    size_t GetMemoryUsage() const;
+
+    // Cursor over the postings with ordinals in [begin_ordinal, end_ordinal).
+    Cursor MakeCursor(uint32_t begin_ordinal, uint32_t end_ordinal) const;
+
+    // Calls callback(ordinal, count) for the postings in [begin_ordinal, end_ordinal),
+    // decoding a block at a time. Cheaper than a cursor when nothing is skipped.
+    template <typename Callback>
+    void ForEach(uint32_t begin_ordinal, uint32_t end_ordinal, Callback callback) const;
+
+    // ForEach that calls should_stop() before every block (and before the tail) and
+    // returns false as soon as it says so; true once all postings are visited.
+    template <typename StopCondition, typename Callback>
+    bool ForEachUntil(uint32_t begin_ordinal, uint32_t end_ordinal, StopCondition should_stop, Callback callback) const;
+
+private:
+    static BlockHeader EncodeBlock(const Posting* postings, size_t posting_count, std::vector<uint8_t>& data);
+
+    static size_t GetBlockByteCount(const BlockHeader& header);
+
+    static bool HasExactGaps(const BlockHeader& header, const uint8_t* data);
+
+    // Little endian regardless of the host; compilers turn this into a single load.
+    template <uint32_t kWidth>
+    static uint32_t ReadValue(const uint8_t* data, size_t index);
+
+    // Calls callback(ordinal, count) for every posting of the block. Each pair of
+    // widths gets its own loop with the widths as constants.
+    template <typename Callback>
+    static void VisitBlock(const BlockHeader& header, const uint8_t* data, Callback& callback);
+
+    template <uint32_t kGapWidth, typename Callback>
+    static void VisitBlockOfGapWidth(const BlockHeader& header, const uint8_t* data, Callback& callback);
+
+    template <uint32_t kGapWidth, uint32_t kCountWidth, typename Callback>
+    static void VisitBlockOfWidths(const BlockHeader& header, const uint8_t* data, Callback& callback);
+
+    // Fills ordinals and counts with the postings of the block; returns how many there are.
+    static size_t DecodeBlock(const Storage& storage, size_t block, uint32_t* ordinals, uint32_t* counts);
+
+    // Index of the first block whose last ordinal is not less than the given one.
+    static size_t FindBlock(const Storage& storage, uint32_t ordinal);
+
+    static bool IsInTail(const Storage& storage, uint32_t ordinal);
+
+    void SealTail();
+
+    std::vector<BlockHeader> blocks_;
+    // Block bodies back to back: all gaps of a block, then all its counts.
+    std::vector<uint8_t> data_;
+    std::vector<Posting> tail_;
+    size_t size_ = 0;
+    // Set for a view; the buffers above stay empty until MakeOwned.
+    bool is_view_ = false;
+    Storage view_;
+};
+
+// Walks a posting list one decoded block at a time.
+class PostingList::Cursor {
+public:
+    bool IsEnd() const {
+        return position_ == size_;
+    }
+
+    uint32_t GetOrdinal() const {
+        return ordinals_[position_];
+    }
+
+    uint32_t GetCount() const {
+        return counts_[position_];
+    }
+
+    void Next() {
+        if (++position_ == size_) {
+            LoadBlock(block_ + 1);
+        }
+    }
+
+    // Moves to the first posting with ordinal >= the given one and reports whether
+    // the document itself was found. Blocks that end before it are skipped by header.
+    bool SeekTo(uint32_t ordinal);
+
+private:
+    friend class PostingList;
+
+    // Decodes the block (block_count stands for the tail), cut at end_ordinal_.
+    void LoadBlock(size_t block);
+
+    Storage storage_;
+    uint32_t end_ordinal_ = 0;
+    size_t block_ = 0;
+    size_t position_ = 0;
+    size_t size_ = 0;
+    uint32_t ordinals_[kBlockSize];
+    uint32_t counts_[kBlockSize];
+};
+
+template <uint32_t kWidth>
+uint32_t PostingList::ReadValue(const uint8_t* data, size_t index) {
+    uint32_t value = 0;
+    for (uint32_t byte = 0; byte < kWidth; ++byte) {
+        value |= uint32_t{ data[index * kWidth + byte] } << (8 * byte);
+    }
+    return value;
+}
+
+template <typename Callback>
+void PostingList::VisitBlock(const BlockHeader& header, const uint8_t* data, Callback& callback) {
+    switch (header.gap_width) {
+    case 0:
+        return VisitBlockOfGapWidth<0>(header, data, callback);
+    case 1:
+        return VisitBlockOfGapWidth<1>(header, data, callback);
+    case 2:
+        return VisitBlockOfGapWidth<2>(header, data, callback);
+    default:
+        return VisitBlockOfGapWidth<4>(header, data, callback);
+    }
+}
+
+template <uint32_t kGapWidth, typename Callback>
+void PostingList::VisitBlockOfGapWidth(const BlockHeader& header, const uint8_t* data, Callback& callback) {
+    switch (header.count_width) {
+    case 0:
+        return VisitBlockOfWidths<kGapWidth, 0>(header, data, callback);
+    case 1:
+        return VisitBlockOfWidths<kGapWidth, 1>(header, data, callback);
+    case 2:
+        return VisitBlockOfWidths<kGapWidth, 2>(header, data, callback);
+    default:
+        return VisitBlockOfWidths<kGapWidth, 4>(header, data, callback);
+    }
+}
+
+template <uint32_t kGapWidth, uint32_t kCountWidth, typename Callback>
+void PostingList::VisitBlockOfWidths(const BlockHeader& header, const uint8_t* data, Callback& callback) {
+    const size_t posting_count = header.posting_count;
+    const uint8_t* gaps = data + header.data_offset;
+    const uint8_t* counts = gaps + posting_count * kGapWidth;
+    // Unsigned arithmetic wraps, so first_ordinal - 1 is fine for ordinal 0.
+    uint32_t ordinal = header.first_ordinal - 1;
+    for (size_t i = 0; i < posting_count; ++i) {
+        ordinal += ReadValue<kGapWidth>(gaps, i) + 1;
+        callback(ordinal, ReadValue<kCountWidth>(counts, i) + 1);
+    }
+}
+
+// Blocks that lie inside the range are decoded straight into the callback,
+// only the blocks at its edges go through a buffer.
+template <typename Callback>
+void PostingList::ForEach(uint32_t begin_ordinal, uint32_t end_ordinal, Callback callback) const {
+    ForEachUntil(begin_ordinal, end_ordinal, [] { return false; }, callback);
+}
+
+template <typename StopCondition, typename Callback>
+bool PostingList::ForEachUntil(uint32_t begin_ordinal, uint32_t end_ordinal, StopCondition should_stop, Callback callback) const {
+    const Storage storage = GetStorage();
+    size_t block = FindBlock(storage, begin_ordinal);
+    for (; block < storage.block_count && storage.blocks[block].first_ordinal < end_ordinal; ++block) {
+        if (should_stop()) {
+            return false;
+        }
+        const BlockHeader& header = storage.blocks[block];
+        if (header.first_ordinal < begin_ordinal || header.last_ordinal >= end_ordinal) {
+            uint32_t ordinals[kBlockSize];
+            uint32_t counts[kBlockSize];
+            const size_t posting_count = DecodeBlock(storage, block, ordinals, counts);
+            for (size_t i = 0; i < posting_count; ++i) {
+                if (ordinals[i] >= begin_ordinal && ordinals[i] < end_ordinal) {
+                    callback(ordinals[i], counts[i]);
+                }
+            }
+            continue;
+        }
+        VisitBlock(header, storage.data, callback);
+    }
+    if (block == storage.block_count && storage.tail_size > 0) {
+        if (should_stop()) {
+            return false;
+        }
+        for (const Posting* posting = storage.tail; posting != storage.tail + storage.tail_size; ++posting) {
+            if (posting->ordinal >= end_ordinal) {
+                break;
+            }
+            if (posting->ordinal >= begin_ordinal) {
+                callback(posting->ordinal, posting->count);
+            }
+        }
+    }
+    return true;
+}
@@ -1,27 +1,73 @@
 #include "process_queries.h"
 
 #include <algorithm>
-#include <execution>
 
 using namespace std;
 
-vector<vector<Document>> ProcessQueries(const SearchServer& search_server, const vector<string>& queries) {
-    vector<vector<Document>> documents_lists(queries.size());
-    transform(
-        execution::par,
-        queries.begin(), queries.end(),
-        documents_lists.begin(),
-        [&search_server](const string& query) {
-            return search_server.FindTopDocuments(query);
+namespace {
+    template <typename FindDocuments>
+    vector<vector<Document>> RunQueries(QueryExecutor& executor, size_t query_count, FindDocuments find_documents) {
+        vector<vector<Document>> documents_lists(query_count);
+        executor.ForEach(query_count, [&documents_lists, &find_documents](size_t index) {
+            documents_lists[index] = find_documents(index);
+            });
+        return documents_lists;
+    }
+
+    // A query finds at most MAX_RESULT_DOCUMENT_COUNT documents, so the output is
+    // allocated once with that many slots per query. Every task writes its top
+    // documents straight into its slot, and the slots are closed up in place at the end.
+    template <typename WriteDocuments>
+    vector<Document> RunQueriesJoined(QueryExecutor& executor, size_t query_count, WriteDocuments write_documents) {
+        vector<Document> documents(query_count * MAX_RESULT_DOCUMENT_COUNT);
+        vector<size_t> document_counts(query_count);
+        executor.ForEach(query_count, [&](size_t index) {
+            document_counts[index] = write_documents(index, documents.data() + index * MAX_RESULT_DOCUMENT_COUNT);
+            });
+        auto output = documents.begin();
+        for (size_t index = 0; index < query_count; ++index) {
+            const auto slot = documents.begin() + index * MAX_RESULT_DOCUMENT_COUNT;
+            output = move(slot, slot + document_counts[index], output);
         }
-    );
-    return documents_lists;
+        documents.erase(output, documents.end());
+        return documents;
+    }
+}
+
+vector<vector<Document>> ProcessQueries(const SearchServer& search_server, const vector<string>& queries) {
+    return ProcessQueries(QueryExecutor::GetDefault(), search_server, queries);
+}
+
+vector<vector<Document>> ProcessQueries(QueryExecutor& executor, const SearchServer& search_server, const vector<string>& queries) {
+    return RunQueries(executor, queries.size(), [&search_server, &queries](size_t index) {
+        return search_server.FindTopDocuments(queries[index]);
+        });
 }
 
 vector<Document> ProcessQueriesJoined(const SearchServer& search_server, const vector<string>& queries) {
-    vector<Document> documents;
-    for (const auto& local_documents : ProcessQueries(search_server, queries)) {
-        documents.insert(documents.end(), local_documents.begin(), local_documents.end());
-    }
-    return documents;
+    return ProcessQueriesJoined(QueryExecutor::GetDefault(), search_server, queries);
+}
+
+vector<Document> ProcessQueriesJoined(QueryExecutor& executor, const SearchServer& search_server, const vector<string>& queries) {
+    return RunQueriesJoined(executor, queries.size(), [&search_server, &queries](size_t index, Document* output) {
+        return search_server.WriteTopDocuments(queries[index], output);
+        });
+}
+
+vector<vector<Document>> ProcessQueries(const SearchServer& search_server, const vector<CompiledQuery>& queries) {
+    return RunQueries(QueryExecutor::GetDefault(), queries.size(), [&search_server, &queries](size_t index) {
+        return search_server.FindTopDocuments(queries[index]);
+        });
+}
+
+vector<vector<Document>> ProcessQueries(const ConcurrentSearchServer& search_server, const vector<string>& queries) {
+    return RunQueries(QueryExecutor::GetDefault(), queries.size(), [&search_server, &queries](size_t index) {
+        return search_server.Read()->FindTopDocuments(queries[index]);
+        });
+}
+
+vector<Document> ProcessQueriesJoined(const ConcurrentSearchServer& search_server, const vector<string>& queries) {
+    return RunQueriesJoined(QueryExecutor::GetDefault(), queries.size(), [&search_server, &queries](size_t index, Document* output) {
+        return search_server.Read()->WriteTopDocuments(queries[index], output);
+        });
 }
\ No newline at end of file
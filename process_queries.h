@@ -1,10 +1,29 @@
 #pragma once
 
+#include "concurrent_search_server.h"
 #include "document.h"
+#include "query_executor.h"
 #include "search_server.h"
 #include <string>
 #include <vector>
 
+// Queries run on QueryExecutor::GetDefault() unless an executor is given; the
+// executor's thread count bounds the parallelism.
 std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<std::string>& queries);
 
-std::vector<Document> ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
\ No newline at end of file
+std::vector<std::vector<Document>> ProcessQueries(QueryExecutor& executor, const SearchServer& search_server,
+    const std::vector<std::string>& queries);
+
+std::vector<Document> ProcessQueriesJoined(const SearchServer& search_server, const std::vector<std::string>& queries);
+
+// Every query writes its documents straight into its slot of the output.
+std::vector<Document> ProcessQueriesJoined(QueryExecutor& executor, const SearchServer& search_server,
+    const std::vector<std::string>& queries);
+
+// For hot queries compiled once with SearchServer::CompileQuery.
+std::vector<std::vector<Document>> ProcessQueries(const SearchServer& search_server, const std::vector<CompiledQuery>& queries);
+
+// Each query reads whichever version of the index is current when it starts.
+std::vector<std::vector<Document>> ProcessQueries(const ConcurrentSearchServer& search_server, const std::vector<std::string>& queries);
+
+std::vector<Document> ProcessQueriesJoined(const ConcurrentSearchServer& search_server, const std::vector<std::string>& queries);
\ No newline at end of file
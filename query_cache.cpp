@@ -0,0 +1,113 @@
+#include "query_cache.h"
+
+#include <functional>
+#include <utility>
+
+QueryCache::QueryCache(size_t max_memory_bytes)
+    : max_memory_bytes_(max_memory_bytes)
+    , shards_(max_memory_bytes > 0 ? std::make_unique<Shard[]>(kShardCount) : nullptr) {
+}
+
+QueryCache::QueryCache(const QueryCache& other)
+    : QueryCache(other.max_memory_bytes_) {
+}
+
+QueryCache& QueryCache::operator=(const QueryCache& other) {
+    max_memory_bytes_ = other.max_memory_bytes_;
+    shards_ = max_memory_bytes_ > 0 ? std::make_unique<Shard[]>(kShardCount) : nullptr;
+    return *this;
+}
+
+bool QueryCache::IsEnabled() const {
+    return shards_ != nullptr;
+}
+
+size_t QueryCache::GetMaxMemoryBytes() const {
+    return max_memory_bytes_;
+}
+
+bool QueryCache::Find(std::string_view key, uint64_t generation, std::vector<Document>& documents) {
+    if (!IsEnabled()) {
+        return false;
+    }
+    Shard& shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    const auto index_it = shard.entry_index.find(key);
+    if (index_it == shard.entry_index.end()) {
+        ++shard.statistics.miss_count;
+        return false;
+    }
+    const auto entry_it = index_it->second;
+    if (entry_it->generation != generation) {
+        EraseEntry(shard, entry_it);
+        ++shard.statistics.invalidation_count;
+        ++shard.statistics.miss_count;
+        return false;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, entry_it);
+    documents = entry_it->documents;
+    ++shard.statistics.hit_count;
+    return true;
+}
+
+// Each shard gets an equal part of the cap, and entries that alone take more are not kept.
+void QueryCache::Insert(std::string key, uint64_t generation, const std::vector<Document>& documents) {
+    if (!IsEnabled()) {
+        return;
+    }
+    Entry entry{ std::move(key), generation, documents, 0 };
+    entry.memory_bytes = GetEntryMemoryUsage(entry);
+    const size_t max_shard_bytes = max_memory_bytes_ / kShardCount;
+    if (entry.memory_bytes > max_shard_bytes) {
+        return;
+    }
+    Shard& shard = GetShard(entry.key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // Another thread may have computed the same query meanwhile.
+    const auto index_it = shard.entry_index.find(entry.key);
+    if (index_it != shard.entry_index.end()) {
+        EraseEntry(shard, index_it->second);
+    }
+    while (shard.memory_bytes + entry.memory_bytes > max_shard_bytes) {
+        EraseEntry(shard, std::prev(shard.entries.end()));
+        ++shard.statistics.eviction_count;
+    }
+    shard.memory_bytes += entry.memory_bytes;
+    shard.entries.push_front(std::move(entry));
+    shard.entry_index.emplace(shard.entries.front().key, shard.entries.begin());
+}
+
+QueryCacheStatistics QueryCache::GetStatistics() const {
+    QueryCacheStatistics statistics;
+    if (!IsEnabled()) {
+        return statistics;
+    }
+    for (size_t index = 0; index < kShardCount; ++index) {
+        const Shard& shard = shards_[index];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        statistics.hit_count += shard.statistics.hit_count;
+        statistics.miss_count += shard.statistics.miss_count;
+        statistics.eviction_count += shard.statistics.eviction_count;
+        statistics.invalidation_count += shard.statistics.invalidation_count;
+        statistics.entry_count += shard.entries.size();
+        statistics.memory_bytes += shard.memory_bytes;
+    }
+    return statistics;
+}
+
+// The list node, the hash table node with its bucket, and the heap parts of the key and the results.
+size_t QueryCache::GetEntryMemoryUsage(const Entry& entry) {
+    const size_t list_node_bytes = sizeof(Entry) + 2 * sizeof(void*);
+    const size_t index_node_bytes = sizeof(std::string_view) + 3 * sizeof(void*);
+    return list_node_bytes + index_node_bytes + entry.key.capacity() + entry.documents.capacity() * sizeof(Document);
+}
+
+QueryCache::Shard& QueryCache::GetShard(std::string_view key) const {
+    return shards_[std::hash<std::string_view>{}(key) % kShardCount];
+}
+
+void QueryCache::EraseEntry(Shard& shard, std::list<Entry>::iterator entry_it) {
+    shard.memory_bytes -= entry_it->memory_bytes;
+    shard.entry_index.erase(entry_it->key);
+    shard.entries.erase(entry_it);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "document.h"
+
+struct QueryCacheStatistics {
+    size_t hit_count = 0;
+    size_t miss_count = 0;
+    // Entries dropped to stay under the memory cap.
+    size_t eviction_count = 0;
+    // Entries dropped because the index changed after they were stored.
+    size_t invalidation_count = 0;
+    size_t entry_count = 0;
+    size_t memory_bytes = 0;
+};
+
+// LRU cache of search results, split into shards by key hash so that threads
+// querying at once rarely wait for the same lock. Every entry remembers the
+// index generation it was computed for; a lookup under a newer generation
+// drops it instead of returning it.
+// Copies start empty with the same memory cap: a copy of a server is another index.
+class QueryCache {
+public:
+    // A cap of 0 disables the cache.
+    explicit QueryCache(size_t max_memory_bytes = 0);
+
+    QueryCache(const QueryCache& other);
+    QueryCache& operator=(const QueryCache& other);
+
+    bool IsEnabled() const;
+
+    size_t GetMaxMemoryBytes() const;
+
+    // Copies the documents cached under the key for this generation; false if there are none.
+    bool Find(std::string_view key, uint64_t generation, std::vector<Document>& documents);
+
+    void Insert(std::string key, uint64_t generation, const std::vector<Document>& documents);
+
+    QueryCacheStatistics GetStatistics() const;
+
+private:
+    static constexpr size_t kShardCount = 16;
+
+    struct Entry {
+        std::string key;
+        uint64_t generation = 0;
+        std::vector<Document> documents;
+        size_t memory_bytes = 0;
+    };
+
+    // Entries are kept most recently used first.
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> entries;
+        // Keys are views of the keys in entries.
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> entry_index;
+        size_t memory_bytes = 0;
+        QueryCacheStatistics statistics;
+    };
+
+    static size_t GetEntryMemoryUsage(const Entry& entry);
+
+    Shard& GetShard(std::string_view key) const;
+
+    // Must be called with the shard locked.
+    static void EraseEntry(Shard& shard, std::list<Entry>::iterator entry_it);
+
+    size_t max_memory_bytes_ = 0;
+    // Allocated only while the cache is enabled.
+    std::unique_ptr<Shard[]> shards_;
+};
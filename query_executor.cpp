@@ -0,0 +1,170 @@
+#include "query_executor.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+    // Set on the pool threads and on a thread while it runs a batch.
+    thread_local bool is_running_batch = false;
+}
+
+QueryExecutor::QueryExecutor(size_t thread_count)
+    : thread_count_(thread_count > 0 ? thread_count : std::max(1u, std::thread::hardware_concurrency())) {
+    parts_ = std::make_unique<Part[]>(thread_count_);
+    threads_.reserve(thread_count_ - 1);
+    for (size_t worker_index = 1; worker_index < thread_count_; ++worker_index) {
+        threads_.emplace_back([this, worker_index] {
+            RunWorker(worker_index);
+            });
+    }
+}
+
+QueryExecutor::~QueryExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        is_stopping_ = true;
+    }
+    batch_started_.notify_all();
+    for (std::thread& thread : threads_) {
+        thread.join();
+    }
+}
+
+size_t QueryExecutor::GetThreadCount() const {
+    return thread_count_;
+}
+
+void QueryExecutor::ForEach(size_t count, const std::function<void(size_t)>& task) {
+    if (thread_count_ == 1 || count < 2 || is_running_batch) {
+        std::exception_ptr error;
+        for (size_t index = 0; index < count; ++index) {
+            try {
+                task(index);
+            }
+            catch (...) {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> batch_lock(batch_mutex_);
+    for (size_t worker_index = 0; worker_index < thread_count_; ++worker_index) {
+        Part& part = parts_[worker_index];
+        std::lock_guard<std::mutex> lock(part.mutex);
+        part.begin = count * worker_index / thread_count_;
+        part.end = count * (worker_index + 1) / thread_count_;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        ++batch_generation_;
+        is_batch_open_ = true;
+    }
+    batch_started_.notify_all();
+
+    is_running_batch = true;
+    RunPart(0);
+    is_running_batch = false;
+
+    // The parts are empty, but workers may still be running the last tasks they took.
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        batch_finished_.wait(lock, [this] {
+            return busy_worker_count_ == 0;
+            });
+        is_batch_open_ = false;
+        task_ = nullptr;
+        error = std::exchange(error_, nullptr);
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+QueryExecutor& QueryExecutor::GetDefault() {
+    static QueryExecutor executor;
+    return executor;
+}
+
+void QueryExecutor::RunWorker(size_t worker_index) {
+    is_running_batch = true;
+    uint64_t last_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            batch_started_.wait(lock, [this, last_generation] {
+                return is_stopping_ || (is_batch_open_ && batch_generation_ != last_generation);
+                });
+            if (is_stopping_) {
+                return;
+            }
+            last_generation = batch_generation_;
+            ++busy_worker_count_;
+        }
+        RunPart(worker_index);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --busy_worker_count_;
+        }
+        batch_finished_.notify_one();
+    }
+}
+
+void QueryExecutor::RunPart(size_t worker_index) {
+    size_t index = 0;
+    while (TakeIndex(worker_index, index)) {
+        try {
+            (*task_)(index);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) {
+                error_ = std::current_exception();
+            }
+        }
+    }
+}
+
+bool QueryExecutor::TakeIndex(size_t worker_index, size_t& index) {
+    Part& part = parts_[worker_index];
+    do {
+        std::lock_guard<std::mutex> lock(part.mutex);
+        if (part.begin < part.end) {
+            index = part.begin++;
+            return true;
+        }
+    } while (StealHalf(worker_index));
+    return false;
+}
+
+// Stolen indexes are in no part until the thief stores them, but the thief is
+// busy meanwhile, so the batch cannot end without them.
+bool QueryExecutor::StealHalf(size_t worker_index) {
+    for (size_t offset = 1; offset < thread_count_; ++offset) {
+        Part& victim = parts_[(worker_index + offset) % thread_count_];
+        size_t begin = 0;
+        size_t end = 0;
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.begin == victim.end) {
+                continue;
+            }
+            end = victim.end;
+            begin = end - (end - victim.begin + 1) / 2;
+            victim.end = begin;
+        }
+        Part& part = parts_[worker_index];
+        std::lock_guard<std::mutex> lock(part.mutex);
+        part.begin = begin;
+        part.end = end;
+        return true;
+    }
+    return false;
+}
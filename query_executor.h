@@ -0,0 +1,81 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent thread pool for batches of independent tasks, such as the queries
+// of ProcessQueries. A batch is an index range split evenly between the
+// workers; a worker takes indexes from the front of its own part one at a time
+// and, once it runs dry, steals the back half of another worker's part. So a
+// heavy query keeps only its own worker busy while the others take over the
+// rest of that worker's part.
+// The threads live as long as the executor, so whatever they keep in
+// thread_local storage (relevance accumulators, parse buffers) is reused from
+// query to query and from batch to batch.
+class QueryExecutor {
+public:
+    // The calling thread of ForEach works too, so thread_count - 1 threads are
+    // started. 0 means std::thread::hardware_concurrency().
+    explicit QueryExecutor(size_t thread_count = 0);
+
+    QueryExecutor(const QueryExecutor&) = delete;
+    QueryExecutor& operator=(const QueryExecutor&) = delete;
+
+    ~QueryExecutor();
+
+    size_t GetThreadCount() const;
+
+    // Calls task(index) for every index in [0, count) and returns once all calls
+    // are done. If calls throw, the rest still run and the first exception is
+    // rethrown. Batches from different threads run one after another; a task
+    // that calls ForEach runs its batch on its own thread.
+    void ForEach(size_t count, const std::function<void(size_t)>& task);
+
+    // Shared executor with a thread per core, started on first use.
+    static QueryExecutor& GetDefault();
+
+private:
+    // A worker's part of the current batch.
+    struct alignas(64) Part {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    void RunWorker(size_t worker_index);
+
+    // Runs tasks of the current batch until no part has any left.
+    void RunPart(size_t worker_index);
+
+    bool TakeIndex(size_t worker_index, size_t& index);
+
+    // Moves the back half of another part into the worker's own part; false if all are empty.
+    bool StealHalf(size_t worker_index);
+
+    std::unique_ptr<Part[]> parts_;
+    size_t thread_count_ = 0;
+    std::vector<std::thread> threads_;
+
+    // Serializes batches.
+    std::mutex batch_mutex_;
+
+    // Guards the fields below and wakes the workers and the calling thread.
+    std::mutex mutex_;
+    std::condition_variable batch_started_;
+    std::condition_variable batch_finished_;
+    uint64_t batch_generation_ = 0;
+    // Workers join a batch only while it is open.
+    bool is_batch_open_ = false;
+    bool is_stopping_ = false;
+    // Workers that joined the current batch and have not left it yet.
+    size_t busy_worker_count_ = 0;
+    std::exception_ptr error_;
+    const std::function<void(size_t)>* task_ = nullptr;
+};
@@ -0,0 +1,61 @@
+#include "relevance_accumulator.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+    // Generation 0 is never current, so it marks a slot as untouched.
+    const uint32_t kUntouched = 0;
+}
+
+// generation_ marks scored slots of the current query, generation_ + 1 excluded ones.
+void RelevanceAccumulator::Reset(size_t ordinal_count) {
+    if (relevance_.size() < ordinal_count) {
+        relevance_.resize(ordinal_count);
+        generations_.resize(ordinal_count, kUntouched);
+    }
+    touched_.clear();
+    if (generation_ >= std::numeric_limits<uint32_t>::max() - 2) {
+        std::fill(generations_.begin(), generations_.end(), kUntouched);
+        generation_ = kUntouched;
+    }
+    generation_ += 2;
+}
+
+double RelevanceAccumulator::Add(uint32_t ordinal, double relevance) {
+    const uint32_t generation = generations_[ordinal];
+    if (generation == generation_) {
+        return relevance_[ordinal] += relevance;
+    }
+    if (generation == generation_ + 1) {
+        return 0.0;
+    }
+    generations_[ordinal] = generation_;
+    touched_.push_back(ordinal);
+    return relevance_[ordinal] = relevance;
+}
+
+void RelevanceAccumulator::Exclude(uint32_t ordinal) {
+    generations_[ordinal] = generation_ + 1;
+}
+
+bool RelevanceAccumulator::IsActive(uint32_t ordinal) const {
+    return generations_[ordinal] == generation_;
+}
+
+bool RelevanceAccumulator::IsExcluded(uint32_t ordinal) const {
+    return generations_[ordinal] == generation_ + 1;
+}
+
+double RelevanceAccumulator::GetRelevance(uint32_t ordinal) const {
+    return relevance_[ordinal];
+}
+
+const std::vector<uint32_t>& RelevanceAccumulator::GetTouched() const {
+    return touched_;
+}
+
+RelevanceAccumulator& RelevanceAccumulator::ForCurrentThread() {
+    thread_local RelevanceAccumulator accumulator;
+    return accumulator;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Flat relevance scores indexed by document ordinal, reused from query to query.
+// Instead of clearing the whole array, every slot carries the generation of the
+// query that last wrote it; slots from older generations read as untouched.
+// Each query owns two stamps: one for scored documents, one for excluded ones.
+// The touched list lets the final pass visit only the documents a query hit.
+class RelevanceAccumulator {
+public:
+    // Starts a new query over ordinals [0, ordinal_count).
+    void Reset(size_t ordinal_count);
+
+    // Returns the accumulated relevance of the document. Excluded documents stay excluded.
+    double Add(uint32_t ordinal, double relevance);
+
+    // Drops a document from the current query, e.g. because of a minus-word,
+    // whether it was scored already or not.
+    void Exclude(uint32_t ordinal);
+
+    bool IsActive(uint32_t ordinal) const;
+
+    bool IsExcluded(uint32_t ordinal) const;
+
+    double GetRelevance(uint32_t ordinal) const;
+
+    // Ordinals in the order they were first scored; ones excluded later are still listed.
+    const std::vector<uint32_t>& GetTouched() const;
+
+    // Scratch accumulator of the calling thread. Not reentrant: a predicate must
+    // not start another search on the same thread.
+    static RelevanceAccumulator& ForCurrentThread();
+
+private:
+    std::vector<double> relevance_;
+    std::vector<uint32_t> generations_;
+    std::vector<uint32_t> touched_;
+    uint32_t generation_ = 0;
+};
@@ -1,31 +1,168 @@
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <execution>
 #include <iostream>
 #include <stdexcept>
 #include <string>
-#include <set>
-#include <map>
+#include <unordered_map>
+#include <vector>
 
 #include "remove_duplicates.h"
 #include "search_server.h"
 
+namespace {
+	// One-permutation MinHash: every word lands in one of the bins, and a bin keeps the
+	// smallest hash among its words. 16 bands of 4 bins catch pairs with similarity 0.5
+	// about 2 times in 3 and pairs with similarity 0.8 almost always.
+	constexpr size_t kMinHashBinCount = 64;
+	constexpr size_t kBandSize = 4;
+	constexpr uint32_t kEmptyBin = UINT32_MAX;
+
+	// splitmix64 finalizer.
+	uint64_t MixBits(uint64_t value) {
+		value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+		return value ^ (value >> 31);
+	}
+
+	// Sum of two independent hashes of every term id: a sum does not depend on the
+	// order the words come in, so the term ids need no sorting.
+	struct WordSetSignature {
+		uint64_t low = 0;
+		uint64_t high = 0;
+
+		bool operator==(const WordSetSignature& other) const {
+			return low == other.low && high == other.high;
+		}
+	};
+
+	struct WordSetSignatureHash {
+		size_t operator()(const WordSetSignature& signature) const {
+			return static_cast<size_t>(signature.low);
+		}
+	};
+
+	std::vector<int> GetDocumentIds(SearchServer& search_server) {
+		return std::vector<int>(search_server.begin(), search_server.end());
+	}
+
+	bool HaveSameWords(const SearchServer& search_server, int lhs_id, int rhs_id) {
+		const auto& lhs = search_server.GetWordFrequencies(lhs_id);
+		const auto& rhs = search_server.GetWordFrequencies(rhs_id);
+		return lhs.size() == rhs.size() && std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](const auto& lhs_item, const auto& rhs_item) {
+			return lhs_item.first == rhs_item.first;
+			});
+	}
+
+	// Estimated Jaccard similarity: matching bins over bins that are not empty in both.
+	double EstimateSimilarity(const uint32_t* lhs, const uint32_t* rhs) {
+		size_t match_count = 0;
+		size_t union_count = 0;
+		for (size_t bin = 0; bin < kMinHashBinCount; ++bin) {
+			if (lhs[bin] == kEmptyBin && rhs[bin] == kEmptyBin) {
+				continue;
+			}
+			++union_count;
+			match_count += lhs[bin] == rhs[bin] ? 1 : 0;
+		}
+		return union_count == 0 ? 1.0 : static_cast<double>(match_count) / union_count;
+	}
+
+	void RemoveFound(SearchServer& search_server, const std::vector<int>& ids_to_delete) {
+		for (const auto id : ids_to_delete) {
+			std::cout << "Found duplicate document id " << id << std::endl;
+		}
+		search_server.RemoveDocuments(ids_to_delete);
+	}
+}
+
 void RemoveDuplicates(SearchServer& search_server) {
-	std::map<std::string_view, double> map_with_words_and_frequencies;
-	std::set<std::vector<std::string_view>> set_with_words;
+	const std::vector<int> document_ids = GetDocumentIds(search_server);
+	std::vector<WordSetSignature> signatures(document_ids.size());
+	search_server.ForEachDocumentTerm(std::execution::par, [&signatures](uint32_t document_index, uint32_t term_id) {
+		WordSetSignature& signature = signatures[document_index];
+		signature.low += MixBits(term_id);
+		signature.high += MixBits(term_id ^ 0x9e3779b97f4a7c15ULL);
+		});
+
+	// Documents go in the order they were added, so the first of a group is kept.
+	std::unordered_map<WordSetSignature, std::vector<int>, WordSetSignatureHash> kept_ids;
+	kept_ids.reserve(document_ids.size());
 	std::vector<int> ids_to_delete;
-	for (const auto doc : search_server) {
-		std::vector<std::string_view> vector_with_words;
-		for (const auto& [key, val] : search_server.GetWordFrequencies(doc)) {
-		    vector_with_words.push_back(key);
-		}
-		if (set_with_words.find(vector_with_words) == set_with_words.end()) {
-			set_with_words.insert(vector_with_words);
+	for (size_t index = 0; index < document_ids.size(); ++index) {
+		std::vector<int>& group = kept_ids[signatures[index]];
+		const bool is_duplicate = std::any_of(group.begin(), group.end(), [&](int kept_id) {
+			return HaveSameWords(search_server, kept_id, document_ids[index]);
+			});
+		if (is_duplicate) {
+			ids_to_delete.push_back(document_ids[index]);
 		}
 		else {
-			ids_to_delete.push_back(doc);
+			group.push_back(document_ids[index]);
 		}
 	}
-	for (const auto id : ids_to_delete) {
-		std::cout << "Found duplicate document id " << id << std::endl;
-		search_server.RemoveDocument(id);
+	RemoveFound(search_server, ids_to_delete);
+}
+
+void RemoveNearDuplicates(SearchServer& search_server, double min_similarity) {
+	if (!(min_similarity > 0.0 && min_similarity <= 1.0)) {
+		throw std::invalid_argument("Similarity threshold must be in (0, 1]");
+	}
+	const std::vector<int> document_ids = GetDocumentIds(search_server);
+	std::vector<uint32_t> sketches(document_ids.size() * kMinHashBinCount, kEmptyBin);
+	search_server.ForEachDocumentTerm(std::execution::par, [&sketches](uint32_t document_index, uint32_t term_id) {
+		const uint64_t hash = MixBits(term_id);
+		uint32_t& bin = sketches[document_index * kMinHashBinCount + hash % kMinHashBinCount];
+		bin = std::min(bin, static_cast<uint32_t>(hash >> 32));
+		});
+
+	// Buckets of the kept documents by the hash of one band of their sketch. A band
+	// with no words at all says nothing, so it is not bucketed.
+	std::unordered_map<uint64_t, std::vector<uint32_t>> band_buckets;
+	band_buckets.reserve(document_ids.size() * (kMinHashBinCount / kBandSize));
+	std::vector<uint64_t> band_hashes;
+	std::vector<size_t> checked_by(document_ids.size(), SIZE_MAX);
+	std::vector<int> ids_to_delete;
+	for (size_t index = 0; index < document_ids.size(); ++index) {
+		const uint32_t* const sketch = &sketches[index * kMinHashBinCount];
+		band_hashes.clear();
+		for (size_t band_begin = 0; band_begin < kMinHashBinCount; band_begin += kBandSize) {
+			uint64_t band_hash = MixBits(band_begin);
+			bool is_empty = true;
+			for (size_t bin = band_begin; bin < band_begin + kBandSize; ++bin) {
+				band_hash = MixBits(band_hash ^ sketch[bin]);
+				is_empty = is_empty && sketch[bin] == kEmptyBin;
+			}
+			if (!is_empty) {
+				band_hashes.push_back(band_hash);
+			}
+		}
+
+		bool is_duplicate = false;
+		for (size_t band = 0; band < band_hashes.size() && !is_duplicate; ++band) {
+			const auto bucket_it = band_buckets.find(band_hashes[band]);
+			if (bucket_it == band_buckets.end()) {
+				continue;
+			}
+			for (const uint32_t kept_index : bucket_it->second) {
+				if (checked_by[kept_index] == index) {
+					continue;
+				}
+				checked_by[kept_index] = index;
+				if (EstimateSimilarity(sketch, &sketches[kept_index * kMinHashBinCount]) >= min_similarity) {
+					is_duplicate = true;
+					break;
+				}
+			}
+		}
+		if (is_duplicate) {
+			ids_to_delete.push_back(document_ids[index]);
+			continue;
+		}
+		for (const uint64_t band_hash : band_hashes) {
+			band_buckets[band_hash].push_back(static_cast<uint32_t>(index));
+		}
 	}
+	RemoveFound(search_server, ids_to_delete);
 }
\ No newline at end of file
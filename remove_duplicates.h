@@ -1,4 +1,13 @@
 #pragma once
 #include "search_server.h"
 
-void RemoveDuplicates(SearchServer& search_server);
\ No newline at end of file
+// Removes every document with the same set of words as a document added before it.
+// Each document gets a 128-bit signature of its word set, computed in parallel from
+// the index; documents are grouped by signature, a match is confirmed by comparing
+// the words, and all duplicates go in one RemoveDocuments call.
+void RemoveDuplicates(SearchServer& search_server);
+
+// Also removes documents whose word set is only similar to that of a kept document
+// added before them: their Jaccard similarity, estimated with MinHash sketches and
+// looked up through LSH bands, is at least min_similarity (in (0, 1]).
+void RemoveNearDuplicates(SearchServer& search_server, double min_similarity);
\ No newline at end of file
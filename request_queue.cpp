@@ -1,12 +1,28 @@
 #include "request_queue.h"
 
-RequestQueue::RequestQueue(const SearchServer& search_server) :server(search_server) {
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <utility>
+
+RequestQueue::RequestQueue(const SearchServer& search_server, Clock::duration window, size_t record_capacity)
+    : server(search_server)
+    , start_time_(Clock::now())
+    , window_(std::max(window, Clock::duration(kTimeBucketCount)))
+    , bucket_duration_(window_ / kTimeBucketCount)
+    , time_buckets_(std::make_unique<TimeBucket[]>(kTimeBucketCount)) {
+    record_capacity_ = 1;
+    while (record_capacity_ < record_capacity) {
+        record_capacity_ *= 2;
+    }
+    record_slots_ = std::make_unique<RecordSlot[]>(record_capacity_);
 }
 
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentStatus status) {
-    return AddFindRequest(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
-        });
+    const Clock::time_point start_time = Clock::now();
+    std::vector<Document> result = server.FindTopDocuments(raw_query, status);
+    AddRequest(raw_query, result.size(), start_time);
+    return result;
 }
 
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query) {
@@ -14,5 +30,173 @@ std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query)
 }
 
 int RequestQueue::GetNoResultRequests() const {
-    return count_no_result_;
-}
\ No newline at end of file
+    return static_cast<int>(GetStatistics().no_result_count);
+}
+
+RequestStatistics RequestQueue::GetStatistics() const {
+    const Clock::time_point now = Clock::now();
+    const int64_t period = GetPeriod(now);
+    RequestStatistics statistics;
+    std::array<uint64_t, kLatencyBinCount> latency_counts{};
+    for (size_t index = 0; index < kTimeBucketCount; ++index) {
+        // The bucket counts the latest period of the window that maps to it.
+        const auto bucket_index = static_cast<int64_t>(index);
+        if (bucket_index > period) {
+            continue;
+        }
+        const int64_t bucket_period = period - (period - bucket_index) % static_cast<int64_t>(kTimeBucketCount);
+        const auto lap = static_cast<uint32_t>(bucket_period / static_cast<int64_t>(kTimeBucketCount));
+        const TimeBucket& bucket = time_buckets_[index];
+        statistics.request_count += ReadCounter(bucket.request_count, lap);
+        statistics.no_result_count += ReadCounter(bucket.no_result_count, lap);
+        for (size_t bin = 0; bin < kLatencyBinCount; ++bin) {
+            latency_counts[bin] += ReadCounter(bucket.latency_counts[bin], lap);
+        }
+    }
+    if (statistics.request_count == 0) {
+        return statistics;
+    }
+
+    statistics.no_result_rate = static_cast<double>(statistics.no_result_count) / statistics.request_count;
+    const Clock::duration covered = std::min(window_, now - start_time_);
+    statistics.queries_per_second = statistics.request_count / std::max(std::chrono::duration<double>(covered).count(), 1e-9);
+
+    // Bins are counted by the latency of each request, so the sum may differ from
+    // request_count while requests are being added.
+    uint64_t latency_count = 0;
+    for (const uint64_t count : latency_counts) {
+        latency_count += count;
+    }
+    const std::pair<double, std::chrono::nanoseconds*> percentiles[] = {
+        { 0.5, &statistics.latency_p50 }, { 0.9, &statistics.latency_p90 }, { 0.99, &statistics.latency_p99 } };
+    for (const auto& [fraction, latency] : percentiles) {
+        const auto rank = static_cast<uint64_t>(std::ceil(fraction * latency_count));
+        uint64_t seen_count = 0;
+        for (size_t bin = 0; bin < kLatencyBinCount; ++bin) {
+            seen_count += latency_counts[bin];
+            if (seen_count >= rank && seen_count > 0) {
+                *latency = GetLatencyBinLimit(bin);
+                break;
+            }
+        }
+    }
+    return statistics;
+}
+
+std::vector<RequestQueue::RequestRecord> RequestQueue::GetRecentRequests() const {
+    const Clock::time_point window_start = Clock::now() - window_;
+    const uint64_t end_ticket = next_ticket_.load(std::memory_order_acquire);
+    const uint64_t begin_ticket = end_ticket > record_capacity_ ? end_ticket - record_capacity_ : 0;
+    std::vector<RequestRecord> records;
+    records.reserve(end_ticket - begin_ticket);
+    for (uint64_t ticket = begin_ticket; ticket < end_ticket; ++ticket) {
+        const RecordSlot& slot = record_slots_[ticket & (record_capacity_ - 1)];
+        const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != 2 * ticket + 2) {
+            continue;
+        }
+        RequestRecord record;
+        record.time = start_time_ + std::chrono::nanoseconds(slot.time.load(std::memory_order_relaxed));
+        record.query_hash = slot.query_hash.load(std::memory_order_relaxed);
+        record.result_count = static_cast<size_t>(slot.result_count.load(std::memory_order_relaxed));
+        record.latency = std::chrono::nanoseconds(slot.latency.load(std::memory_order_relaxed));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence || record.time < window_start) {
+            continue;
+        }
+        records.push_back(record);
+    }
+    return records;
+}
+
+void RequestQueue::AddRequest(std::string_view raw_query, size_t result_count, Clock::time_point start_time) {
+    const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_time);
+    AddToTimeBucket(GetPeriod(start_time), result_count, latency);
+    AddRecord({ start_time, std::hash<std::string_view>{}(raw_query), result_count, latency });
+}
+
+void RequestQueue::AddToTimeBucket(int64_t period, size_t result_count, std::chrono::nanoseconds latency) {
+    TimeBucket& bucket = time_buckets_[static_cast<size_t>(period) % kTimeBucketCount];
+    const auto lap = static_cast<uint32_t>(period / static_cast<int64_t>(kTimeBucketCount));
+    AddToCounter(bucket.request_count, lap);
+    if (result_count == 0) {
+        AddToCounter(bucket.no_result_count, lap);
+    }
+    AddToCounter(bucket.latency_counts[GetLatencyBin(latency)], lap);
+}
+
+// A counter of an earlier lap restarts at one; if a later lap has taken it while
+// this request ran, the request is out of the window and is not counted.
+void RequestQueue::AddToCounter(std::atomic<uint64_t>& counter, uint32_t lap) {
+    uint64_t value = counter.load(std::memory_order_relaxed);
+    uint64_t updated = 0;
+    do {
+        const auto counter_lap = static_cast<uint32_t>(value >> 32);
+        if (counter_lap == lap) {
+            if (static_cast<uint32_t>(value) == UINT32_MAX) {
+                return;
+            }
+            updated = value + 1;
+        } else if (static_cast<int32_t>(lap - counter_lap) < 0) {
+            return;
+        } else {
+            updated = (static_cast<uint64_t>(lap) << 32) | 1;
+        }
+    } while (!counter.compare_exchange_weak(value, updated, std::memory_order_relaxed));
+}
+
+uint64_t RequestQueue::ReadCounter(const std::atomic<uint64_t>& counter, uint32_t lap) {
+    const uint64_t value = counter.load(std::memory_order_relaxed);
+    return static_cast<uint32_t>(value >> 32) == lap ? static_cast<uint32_t>(value) : 0;
+}
+
+// A writer only takes a slot whose last write is older than its own ticket; if a
+// later lap has taken it, or an earlier writer is still filling it, the record is dropped.
+void RequestQueue::AddRecord(const RequestRecord& record) {
+    const uint64_t ticket = next_ticket_.fetch_add(1, std::memory_order_relaxed);
+    RecordSlot& slot = record_slots_[ticket & (record_capacity_ - 1)];
+    const uint64_t writing_sequence = 2 * ticket + 1;
+    uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    do {
+        if (sequence >= writing_sequence || sequence % 2 == 1) {
+            return;
+        }
+    } while (!slot.sequence.compare_exchange_weak(sequence, writing_sequence, std::memory_order_relaxed));
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.time.store(std::chrono::duration_cast<std::chrono::nanoseconds>(record.time - start_time_).count(), std::memory_order_relaxed);
+    slot.query_hash.store(record.query_hash, std::memory_order_relaxed);
+    slot.result_count.store(record.result_count, std::memory_order_relaxed);
+    slot.latency.store(record.latency.count(), std::memory_order_relaxed);
+    slot.sequence.store(writing_sequence + 1, std::memory_order_release);
+}
+
+int64_t RequestQueue::GetPeriod(Clock::time_point time) const {
+    return std::max<int64_t>((time - start_time_) / bucket_duration_, 0);
+}
+
+// Latencies below 4 ns get a bin each; above, the two bits after the leading one
+// pick one of four bins per power of two.
+size_t RequestQueue::GetLatencyBin(std::chrono::nanoseconds latency) {
+    const auto value = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0));
+    if (value < 4) {
+        return static_cast<size_t>(value);
+    }
+    size_t exponent = 2;
+    while (exponent < 63 && (value >> (exponent + 1)) != 0) {
+        ++exponent;
+    }
+    const size_t bin = 4 * (exponent - 1) + static_cast<size_t>((value >> (exponent - 2)) & 3);
+    return std::min(bin, kLatencyBinCount - 1);
+}
+
+std::chrono::nanoseconds RequestQueue::GetLatencyBinLimit(size_t bin) {
+    if (bin < 4) {
+        return std::chrono::nanoseconds(bin);
+    }
+    if (bin == kLatencyBinCount - 1) {
+        return std::chrono::nanoseconds::max();
+    }
+    const size_t exponent = bin / 4 + 1;
+    const uint64_t mantissa = 4 + bin % 4;
+    return std::chrono::nanoseconds(static_cast<int64_t>(((mantissa + 1) << (exponent - 2)) - 1));
+}
@@ -1,54 +1,139 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
 #include <vector>
-#include <deque>
 
 #include "search_server.h"
 
+// Totals over the requests of the window.
+struct RequestStatistics {
+    size_t request_count = 0;
+    size_t no_result_count = 0;
+    double no_result_rate = 0.0;
+    // Requests per second over the window, or over the lifetime of the queue if it is shorter.
+    double queries_per_second = 0.0;
+    // Percentiles of the search latency, rounded up to the latency histogram, which
+    // splits every power of two into four bins.
+    std::chrono::nanoseconds latency_p50{ 0 };
+    std::chrono::nanoseconds latency_p90{ 0 };
+    std::chrono::nanoseconds latency_p99{ 0 };
+};
 
+// Runs searches and keeps statistics of the ones that started within the last
+// window of time. Any number of threads may search and read the statistics at
+// once; nothing takes a lock.
+// The window is split into kTimeBucketCount periods, each with its own counters
+// and latency histogram, so the statistics cost the same however many requests
+// there were. Every counter carries the period it counts, and the first request of
+// a later period restarts it with the same compare-and-swap that adds to it, so
+// writers never wait for one another. The last
+// requests are also kept in full in a ring of records. A record of a thread that
+// stalls between taking its slot and filling it longer than a whole ring of
+// requests takes is dropped, and so are the counters of a request that stalls
+// longer than the window.
 class RequestQueue {
 public:
-    RequestQueue(const SearchServer& search_server);
+    using Clock = std::chrono::steady_clock;
+
+    struct RequestRecord {
+        Clock::time_point time;
+        // std::hash of the raw query: records do not keep the text.
+        uint64_t query_hash = 0;
+        size_t result_count = 0;
+        std::chrono::nanoseconds latency{ 0 };
+    };
+
+    static constexpr size_t kDefaultRecordCapacity = 4096;
+
+    // The record capacity is rounded up to a power of two.
+    explicit RequestQueue(const SearchServer& search_server, Clock::duration window = std::chrono::hours(24),
+        size_t record_capacity = kDefaultRecordCapacity);
+
+    RequestQueue(const RequestQueue&) = delete;
+    RequestQueue& operator=(const RequestQueue&) = delete;
 
     template <typename DocumentPredicate>
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate);
 
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentStatus status);
-    
+
     std::vector<Document> AddFindRequest(const std::string& raw_query);
 
+    // Requests of the window that found nothing.
     int GetNoResultRequests() const;
+
+    RequestStatistics GetStatistics() const;
+
+    // Records of the window still in the ring, oldest first.
+    std::vector<RequestRecord> GetRecentRequests() const;
+
 private:
-    struct QueryResult {
-        size_t documents_size;
-        std::string query;
+    static constexpr size_t kTimeBucketCount = 64;
+    // Four bins per power of two up to 2^40 ns (18 minutes); longer searches go to the last bin.
+    static constexpr size_t kLatencyBinCount = 160;
+
+    // Counters of the requests that started in one period. Each counter holds the lap
+    // of its period, period / kTimeBucketCount, in the high half and the count in the
+    // low half. Laps wrap after 2^32 windows, so a counter left untouched that long
+    // is read as current.
+    struct alignas(64) TimeBucket {
+        std::atomic<uint64_t> request_count{ 0 };
+        std::atomic<uint64_t> no_result_count{ 0 };
+        std::array<std::atomic<uint64_t>, kLatencyBinCount> latency_counts{};
     };
-private:
-    static const int kMinInDay = 1440;
-private:
-    std::deque<QueryResult> requests_;
-    int count_no_result_ = 0;
+
+    // Seqlock: sequence is 2 * ticket + 1 while the writer of that ticket fills the
+    // fields and 2 * ticket + 2 once they are done. The fields are atomic so that a
+    // reader racing with a writer is not undefined behavior; it only sees a changed
+    // sequence and skips the slot.
+    struct RecordSlot {
+        std::atomic<uint64_t> sequence{ 0 };
+        std::atomic<int64_t> time{ 0 };
+        std::atomic<uint64_t> query_hash{ 0 };
+        std::atomic<uint64_t> result_count{ 0 };
+        std::atomic<int64_t> latency{ 0 };
+    };
+
+    void AddRequest(std::string_view raw_query, size_t result_count, Clock::time_point start_time);
+
+    void AddToTimeBucket(int64_t period, size_t result_count, std::chrono::nanoseconds latency);
+
+    static void AddToCounter(std::atomic<uint64_t>& counter, uint32_t lap);
+
+    // The count of the lap, or zero if the counter holds another one.
+    static uint64_t ReadCounter(const std::atomic<uint64_t>& counter, uint32_t lap);
+
+    void AddRecord(const RequestRecord& record);
+
+    int64_t GetPeriod(Clock::time_point time) const;
+
+    static size_t GetLatencyBin(std::chrono::nanoseconds latency);
+
+    // The largest latency that falls into the bin.
+    static std::chrono::nanoseconds GetLatencyBinLimit(size_t bin);
+
     const SearchServer& server;
+    const Clock::time_point start_time_;
+    const Clock::duration window_;
+    const Clock::duration bucket_duration_;
+    std::unique_ptr<TimeBucket[]> time_buckets_;
+    std::unique_ptr<RecordSlot[]> record_slots_;
+    size_t record_capacity_ = 0;
+    std::atomic<uint64_t> next_ticket_{ 0 };
 };
 
 
 template <typename DocumentPredicate>
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate)
 {
-    //full rework
-    if (!requests_.empty())  {
-        while (requests_.size() >= kMinInDay) {
-            if (requests_.front().documents_size == 0) {
-                --count_no_result_;
-            }
-            requests_.pop_front();
-        }
-    }
-    std::vector<Document> result;
-    result = server.FindTopDocuments(raw_query, document_predicate);
-    if (result.empty()) {
-        ++count_no_result_;
-    }
-    requests_.push_back({ result.size(),raw_query });
+    const Clock::time_point start_time = Clock::now();
+    std::vector<Document> result = server.FindTopDocuments(raw_query, document_predicate);
+    AddRequest(raw_query, result.size(), start_time);
     return result;
 }
\ No newline at end of file
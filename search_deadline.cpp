@@ -0,0 +1,36 @@
+#include "search_deadline.h"
+
+#include <utility>
+
+CancellationToken::CancellationToken()
+    : is_cancelled_(std::make_shared<std::atomic<bool>>(false)) {
+}
+
+void CancellationToken::Cancel() {
+    is_cancelled_->store(true, std::memory_order_relaxed);
+}
+
+bool CancellationToken::IsCancelled() const {
+    return is_cancelled_->load(std::memory_order_relaxed);
+}
+
+SearchDeadline::SearchDeadline(Clock::time_point time)
+    : time_(time) {
+}
+
+SearchDeadline::SearchDeadline(CancellationToken token)
+    : token_(std::move(token)) {
+}
+
+SearchDeadline::SearchDeadline(Clock::time_point time, CancellationToken token)
+    : time_(time)
+    , token_(std::move(token)) {
+}
+
+SearchDeadline SearchDeadline::After(Clock::duration duration) {
+    return SearchDeadline(Clock::now() + duration);
+}
+
+bool SearchDeadline::IsReached() const {
+    return (token_ && token_->IsCancelled()) || (time_ != Clock::time_point::max() && Clock::now() >= time_);
+}
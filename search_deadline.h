@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "document.h"
+
+// Cancels a search from another thread. Copies share the flag, so the caller
+// keeps one copy and hands another to the search.
+class CancellationToken {
+public:
+    CancellationToken();
+
+    void Cancel();
+
+    bool IsCancelled() const;
+
+private:
+    std::shared_ptr<std::atomic<bool>> is_cancelled_;
+};
+
+// When a search has to give up: at a point in time, when a token is cancelled,
+// whichever comes first. A default deadline is never reached.
+class SearchDeadline {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    SearchDeadline() = default;
+
+    explicit SearchDeadline(Clock::time_point time);
+
+    explicit SearchDeadline(CancellationToken token);
+
+    SearchDeadline(Clock::time_point time, CancellationToken token);
+
+    // The time from now.
+    static SearchDeadline After(Clock::duration duration);
+
+    // Checked by the scoring loops between posting blocks.
+    bool IsReached() const;
+
+private:
+    Clock::time_point time_ = Clock::time_point::max();
+    std::optional<CancellationToken> token_;
+};
+
+struct SearchResult {
+    std::vector<Document> documents;
+    // False if the deadline stopped the search: the documents are the best of those
+    // scored so far, ranked by the relevance they had collected then.
+    bool is_complete = true;
+};
@@ -0,0 +1,249 @@
+#include "search_metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace {
+    const char* const kStageNames[kMetricStageCount] = {
+        "parse_query", "posting_traversal", "minus_words", "top_k_selection", "add_document", "remove_document" };
+    const char* const kCounterNames[kMetricCounterCount] = {
+        "searches", "stopped_searches", "added_documents", "removed_documents", "segment_merges" };
+
+#ifndef SEARCH_SERVER_NO_METRICS
+    constexpr size_t kSubBinCount = 16;
+    constexpr size_t kMaxExponent = 40;
+    constexpr size_t kLatencyBinCount = kSubBinCount * (kMaxExponent - 2);
+
+    // Below 16 ns a bin per nanosecond; above, the four bits after the leading one
+    // pick one of 16 bins per power of two.
+    size_t GetLatencyBin(std::chrono::nanoseconds latency) {
+        const auto value = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0));
+        if (value < kSubBinCount) {
+            return static_cast<size_t>(value);
+        }
+        size_t exponent = 4;
+        while (exponent < 63 && (value >> (exponent + 1)) != 0) {
+            ++exponent;
+        }
+        const size_t bin = kSubBinCount * (exponent - 3) + static_cast<size_t>((value >> (exponent - 4)) & (kSubBinCount - 1));
+        return std::min(bin, kLatencyBinCount - 1);
+    }
+
+    // The largest latency that falls into the bin.
+    std::chrono::nanoseconds GetLatencyBinLimit(size_t bin) {
+        if (bin < kSubBinCount) {
+            return std::chrono::nanoseconds(bin);
+        }
+        if (bin == kLatencyBinCount - 1) {
+            return std::chrono::nanoseconds::max();
+        }
+        const size_t exponent = bin / kSubBinCount + 3;
+        const uint64_t mantissa = kSubBinCount + bin % kSubBinCount;
+        return std::chrono::nanoseconds(static_cast<int64_t>(((mantissa + 1) << (exponent - 4)) - 1));
+    }
+
+    // Plain totals, for merging, retired threads and the reset baseline.
+    struct MetricTotals {
+        std::array<std::array<uint64_t, kLatencyBinCount>, kMetricStageCount> latency_counts{};
+        std::array<uint64_t, kMetricStageCount> latency_totals{};
+        std::array<uint64_t, kMetricCounterCount> counters{};
+    };
+
+    // Written by its own thread only, so an update is a relaxed load and store
+    // rather than a locked read-modify-write; atomics let readers merge meanwhile.
+    struct ThreadMetrics {
+        std::array<std::array<std::atomic<uint64_t>, kLatencyBinCount>, kMetricStageCount> latency_counts{};
+        std::array<std::atomic<uint64_t>, kMetricStageCount> latency_totals{};
+        std::array<std::atomic<uint64_t>, kMetricCounterCount> counters{};
+
+        void AddTo(MetricTotals& totals) const {
+            for (size_t stage = 0; stage < kMetricStageCount; ++stage) {
+                for (size_t bin = 0; bin < kLatencyBinCount; ++bin) {
+                    totals.latency_counts[stage][bin] += latency_counts[stage][bin].load(std::memory_order_relaxed);
+                }
+                totals.latency_totals[stage] += latency_totals[stage].load(std::memory_order_relaxed);
+            }
+            for (size_t counter = 0; counter < kMetricCounterCount; ++counter) {
+                totals.counters[counter] += counters[counter].load(std::memory_order_relaxed);
+            }
+        }
+    };
+
+    void Increase(std::atomic<uint64_t>& value, uint64_t delta) {
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    // Threads of std::async come and go, so an exiting thread folds its metrics into
+    // retired and leaves; the registry holds only live threads.
+    struct MetricsRegistry {
+        std::mutex mutex;
+        std::vector<const ThreadMetrics*> threads;
+        MetricTotals retired;
+        MetricTotals baseline;
+
+        MetricTotals Merge() {
+            MetricTotals totals = retired;
+            for (const ThreadMetrics* thread_metrics : threads) {
+                thread_metrics->AddTo(totals);
+            }
+            return totals;
+        }
+    };
+
+    // Never destroyed: threads may exit after static destructors have run.
+    MetricsRegistry& GetRegistry() {
+        static MetricsRegistry* const registry = new MetricsRegistry;
+        return *registry;
+    }
+
+    class ThreadMetricsHolder {
+    public:
+        ThreadMetricsHolder()
+            : metrics_(std::make_unique<ThreadMetrics>()) {
+            MetricsRegistry& registry = GetRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.threads.push_back(metrics_.get());
+        }
+
+        ~ThreadMetricsHolder() {
+            MetricsRegistry& registry = GetRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            metrics_->AddTo(registry.retired);
+            registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), metrics_.get()));
+        }
+
+        ThreadMetrics& Get() {
+            return *metrics_;
+        }
+
+    private:
+        std::unique_ptr<ThreadMetrics> metrics_;
+    };
+
+    ThreadMetrics& GetThreadMetrics() {
+        thread_local ThreadMetricsHolder holder;
+        return holder.Get();
+    }
+
+    StageLatency MakeStageLatency(const std::array<uint64_t, kLatencyBinCount>& latency_counts, uint64_t latency_total) {
+        StageLatency latency;
+        latency.total = std::chrono::nanoseconds(static_cast<int64_t>(latency_total));
+        for (const uint64_t count : latency_counts) {
+            latency.count += count;
+        }
+        if (latency.count == 0) {
+            return latency;
+        }
+        const std::pair<double, std::chrono::nanoseconds*> percentiles[] = {
+            { 0.5, &latency.p50 }, { 0.9, &latency.p90 }, { 0.99, &latency.p99 }, { 1.0, &latency.max } };
+        for (const auto& [fraction, value] : percentiles) {
+            const auto rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(fraction * latency.count)), 1);
+            uint64_t seen_count = 0;
+            for (size_t bin = 0; bin < kLatencyBinCount; ++bin) {
+                seen_count += latency_counts[bin];
+                if (seen_count >= rank) {
+                    *value = GetLatencyBinLimit(bin);
+                    break;
+                }
+            }
+        }
+        return latency;
+    }
+#endif
+}
+
+const StageLatency& MetricsSnapshot::GetStage(MetricStage stage) const {
+    return stages[static_cast<size_t>(stage)];
+}
+
+uint64_t MetricsSnapshot::GetCounter(MetricCounter counter) const {
+    return counters[static_cast<size_t>(counter)];
+}
+
+std::string MetricsSnapshot::ToText() const {
+    std::ostringstream output;
+    for (size_t stage = 0; stage < kMetricStageCount; ++stage) {
+        const StageLatency& latency = stages[stage];
+        output << kStageNames[stage] << ": count " << latency.count << ", total " << latency.total.count()
+            << " ns, p50 " << latency.p50.count() << " ns, p90 " << latency.p90.count() << " ns, p99 " << latency.p99.count()
+            << " ns, max " << latency.max.count() << " ns\n";
+    }
+    for (size_t counter = 0; counter < kMetricCounterCount; ++counter) {
+        output << kCounterNames[counter] << ": " << counters[counter] << '\n';
+    }
+    return output.str();
+}
+
+std::string MetricsSnapshot::ToJson() const {
+    std::ostringstream output;
+    output << "{\"stages\": {";
+    for (size_t stage = 0; stage < kMetricStageCount; ++stage) {
+        const StageLatency& latency = stages[stage];
+        output << (stage > 0 ? ", " : "") << '"' << kStageNames[stage] << "\": {\"count\": " << latency.count
+            << ", \"total_ns\": " << latency.total.count() << ", \"p50_ns\": " << latency.p50.count()
+            << ", \"p90_ns\": " << latency.p90.count() << ", \"p99_ns\": " << latency.p99.count()
+            << ", \"max_ns\": " << latency.max.count() << '}';
+    }
+    output << "}, \"counters\": {";
+    for (size_t counter = 0; counter < kMetricCounterCount; ++counter) {
+        output << (counter > 0 ? ", " : "") << '"' << kCounterNames[counter] << "\": " << counters[counter];
+    }
+    output << "}}";
+    return output.str();
+}
+
+MetricsSnapshot GetMetricsSnapshot() {
+    MetricsSnapshot snapshot;
+#ifndef SEARCH_SERVER_NO_METRICS
+    MetricsRegistry& registry = GetRegistry();
+    MetricTotals totals;
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        totals = registry.Merge();
+        for (size_t stage = 0; stage < kMetricStageCount; ++stage) {
+            for (size_t bin = 0; bin < kLatencyBinCount; ++bin) {
+                totals.latency_counts[stage][bin] -= registry.baseline.latency_counts[stage][bin];
+            }
+            totals.latency_totals[stage] -= registry.baseline.latency_totals[stage];
+        }
+        for (size_t counter = 0; counter < kMetricCounterCount; ++counter) {
+            totals.counters[counter] -= registry.baseline.counters[counter];
+        }
+    }
+    for (size_t stage = 0; stage < kMetricStageCount; ++stage) {
+        snapshot.stages[stage] = MakeStageLatency(totals.latency_counts[stage], totals.latency_totals[stage]);
+    }
+    snapshot.counters = totals.counters;
+#endif
+    return snapshot;
+}
+
+// Threads keep counting from where they are; later snapshots subtract what was
+// counted up to now.
+void ResetMetrics() {
+#ifndef SEARCH_SERVER_NO_METRICS
+    MetricsRegistry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.baseline = registry.Merge();
+#endif
+}
+
+void RecordStageLatency(MetricStage stage, std::chrono::nanoseconds latency) {
+#ifndef SEARCH_SERVER_NO_METRICS
+    ThreadMetrics& thread_metrics = GetThreadMetrics();
+    const auto stage_index = static_cast<size_t>(stage);
+    Increase(thread_metrics.latency_counts[stage_index][GetLatencyBin(latency)], 1);
+    Increase(thread_metrics.latency_totals[stage_index], static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0)));
+#endif
+}
+
+void AddToMetricCounter(MetricCounter counter, uint64_t value) {
+#ifndef SEARCH_SERVER_NO_METRICS
+    Increase(GetThreadMetrics().counters[static_cast<size_t>(counter)], value);
+#endif
+}
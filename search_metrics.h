@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Stage timers and counters of the search paths. Every thread records into its
+// own histograms and counters, so recording takes no lock and shares no cache
+// line; a snapshot merges them on read. Histograms are HDR-style: exact below
+// 16 ns, then 16 bins per power of two (6% apart) up to 2^40 ns.
+// Compile with SEARCH_SERVER_NO_METRICS to take the timers and counters out of
+// the search paths; snapshots are then empty.
+
+enum class MetricStage {
+    PARSE_QUERY,
+    // Scoring the plus-words, or MaxScore up to the candidate ranking.
+    POSTING_TRAVERSAL,
+    MINUS_WORDS,
+    TOP_K_SELECTION,
+    ADD_DOCUMENT,
+    REMOVE_DOCUMENT,
+};
+
+enum class MetricCounter {
+    // Queries scored against the index, not answered from the query cache.
+    SEARCHES,
+    // Searches a deadline stopped.
+    STOPPED_SEARCHES,
+    ADDED_DOCUMENTS,
+    REMOVED_DOCUMENTS,
+    SEGMENT_MERGES,
+};
+
+constexpr size_t kMetricStageCount = 6;
+constexpr size_t kMetricCounterCount = 5;
+
+// Latencies of one stage since the last ResetMetrics. Percentiles and the maximum
+// are rounded up to their histogram bin.
+struct StageLatency {
+    uint64_t count = 0;
+    std::chrono::nanoseconds total{ 0 };
+    std::chrono::nanoseconds p50{ 0 };
+    std::chrono::nanoseconds p90{ 0 };
+    std::chrono::nanoseconds p99{ 0 };
+    std::chrono::nanoseconds max{ 0 };
+};
+
+struct MetricsSnapshot {
+    std::array<StageLatency, kMetricStageCount> stages;
+    std::array<uint64_t, kMetricCounterCount> counters{};
+
+    const StageLatency& GetStage(MetricStage stage) const;
+
+    uint64_t GetCounter(MetricCounter counter) const;
+
+    // One line per stage, then one per counter.
+    std::string ToText() const;
+
+    // {"stages": {"parse_query": {"count": ..., "total_ns": ..., ...}, ...}, "counters": {...}}
+    std::string ToJson() const;
+};
+
+// Merges the metrics of all threads, including the ones that have exited.
+MetricsSnapshot GetMetricsSnapshot();
+
+// Later snapshots count from now on.
+void ResetMetrics();
+
+void RecordStageLatency(MetricStage stage, std::chrono::nanoseconds latency);
+
+void AddToMetricCounter(MetricCounter counter, uint64_t value = 1);
+
+// Records the time from its construction to its destruction.
+class StageTimer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit StageTimer(MetricStage stage)
+        : stage_(stage) {
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    ~StageTimer() {
+        RecordStageLatency(stage_, Clock::now() - start_time_);
+    }
+
+private:
+    const MetricStage stage_;
+    const Clock::time_point start_time_ = Clock::now();
+};
+
+#define METRICS_CONCAT_INTERNAL(X, Y) X##Y
+#define METRICS_CONCAT(X, Y) METRICS_CONCAT_INTERNAL(X, Y)
+
+#ifdef SEARCH_SERVER_NO_METRICS
+#define METRICS_STAGE_TIMER(stage) ((void)0)
+#define METRICS_COUNT(counter, value) ((void)0)
+#else
+#define METRICS_STAGE_TIMER(stage) StageTimer METRICS_CONCAT(stageTimer, __LINE__)(stage)
+#define METRICS_COUNT(counter, value) AddToMetricCounter(counter, value)
+#endif
@@ -0,0 +1,12 @@
+#include "search_page.h"
+
+PageCursor::PageCursor(const Document& last_document, uint64_t query_hash, uint64_t index_generation)
+    : last_document_(last_document)
+    , query_hash_(query_hash)
+    , index_generation_(index_generation)
+    , is_start_(false) {
+}
+
+bool PageCursor::IsStart() const {
+    return is_start_;
+}
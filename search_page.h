@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "document.h"
+
+// Where a page of SearchServer::FindTopDocumentsPage ended. Opaque: it holds the
+// last document of the page, the query and status it belongs to and the index
+// generation it was made at, and only the server reads them. A default cursor
+// starts at the first page.
+class PageCursor {
+public:
+    PageCursor() = default;
+
+    bool IsStart() const;
+
+private:
+    friend class SearchServer;
+
+    PageCursor(const Document& last_document, uint64_t query_hash, uint64_t index_generation);
+
+    Document last_document_;
+    uint64_t query_hash_ = 0;
+    uint64_t index_generation_ = 0;
+    bool is_start_ = true;
+};
+
+struct SearchPage {
+    std::vector<Document> documents;
+    // Cursor of the next page; the same as the request's if the page is empty.
+    PageCursor next_cursor;
+    // False if no documents rank after this page.
+    bool has_more = false;
+};
@@ -3,8 +3,26 @@
 #include <stdexcept>
 #include <string>
 #include <execution>
+#include <exception>
+#include <random>
+#include <unordered_map>
 #include "search_server.h"
 
+namespace {
+    // Red-black tree node: color and three links in front of the value.
+    template <typename Map>
+    size_t GetMapMemoryUsage(const Map& map) {
+        return map.size() * (sizeof(typename Map::value_type) + 4 * sizeof(void*));
+    }
+
+    size_t GetStringMemoryUsage(const std::string& text) {
+        // Short strings are stored inside the object itself.
+        const char* object = reinterpret_cast<const char*>(&text);
+        const std::less<const char*> less;
+        const bool is_inline = !less(text.data(), object) && less(text.data(), object + sizeof(text));
+        return is_inline ? 0 : text.capacity() + 1;
+    }
+}
 
 SearchServer::SearchServer(const std::string& stop_words_text)
     : SearchServer(SplitIntoWords(stop_words_text))
@@ -19,122 +37,663 @@ bool SearchServer::IsValidWord(const std::string_view& word) {
 
 void SearchServer::AddDocument(int document_id, const std::string_view document, DocumentStatus status,
     const std::vector<int>& ratings) {
-    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+    METRICS_STAGE_TIMER(MetricStage::ADD_DOCUMENT);
+    if ((document_id < 0) || (document_ordinals_.count(document_id) > 0)) {
         throw std::invalid_argument("Invalid document id");
     }
+    ParsedDocument parsed = ParseDocument(document);
+    if (snapshot_) {
+        ThawSnapshot();
+    }
 
-    const auto words = SplitIntoWordsNoStop(document);
-
-    const double inv_word_count = 1.0 / words.size();
-    for (const std::string_view& word : words) {
-        std::string temp{ word };
-        word_to_document_freqs_[temp][document_id] += inv_word_count;
-        document_to_word_freqs_[document_id][temp] += inv_word_count;
+    const uint32_t ordinal = static_cast<uint32_t>(document_data_.size());
+    auto count_it = parsed.counts.begin();
+    for (const auto& [word, freq] : parsed.word_freqs) {
+        const uint32_t count = *count_it++;
+        TermData& term = FindOrAddTerm(word);
+        term.postings.Append(ordinal, count);
+        term.max_term_freq = std::max<double>(term.max_term_freq, count * parsed.inv_word_count);
     }
-    documents_.emplace(document_id, DocumentData{ ComputeAverageRating(ratings), status });
+    document_to_word_freqs_[document_id] = std::move(parsed.word_freqs);
+    document_ordinals_.emplace(document_id, ordinal);
+    document_data_.push_back({ document_id, ComputeAverageRating(ratings), status, parsed.inv_word_count });
     document_ids_.push_back(document_id);
+    ExtendSegments();
+    SetStatusBit(ordinal, status, true);
+    ++index_generation_;
+    METRICS_COUNT(MetricCounter::ADDED_DOCUMENTS, 1);
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query, DocumentStatus status) const {
-    return FindTopDocuments(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
+void SearchServer::AddDocuments(const std::vector<DocumentInput>& documents) {
+    AddDocuments(std::execution::seq, documents);
+}
+
+void SearchServer::AddDocuments(const std::execution::sequenced_policy& policy, const std::vector<DocumentInput>& documents) {
+    AddDocumentBatch(policy, documents, 1);
+}
+
+void SearchServer::AddDocuments(const std::execution::parallel_policy& policy, const std::vector<DocumentInput>& documents) {
+    const size_t max_chunk_count = std::max(1u, std::thread::hardware_concurrency()) * 2;
+    const size_t chunk_count = std::clamp<size_t>(documents.size() / kMinDocumentsPerChunk, 1, max_chunk_count);
+    AddDocumentBatch(policy, documents, chunk_count);
+}
+
+// Parsing builds the forward index maps, the bulk of the work, one document per task.
+// Each chunk then collects the postings of its documents per term, so the sequential
+// merge does one dictionary lookup per term and chunk instead of one per word of every
+// document. Chunks are contiguous in ordinal order, so merging them in order only appends.
+template <class ExecutionPolicy>
+void SearchServer::AddDocumentBatch(const ExecutionPolicy& policy, const std::vector<DocumentInput>& documents, size_t chunk_count) {
+    std::set<int> batch_ids;
+    for (const DocumentInput& document : documents) {
+        if (document.id < 0 || document_ordinals_.count(document.id) > 0 || !batch_ids.insert(document.id).second) {
+            throw std::invalid_argument("Invalid document id");
+        }
+    }
+
+    // Exceptions must not leave a parallel algorithm, so they are kept and the first
+    // one in batch order is rethrown, as a loop of AddDocument calls would throw it.
+    std::vector<ParsedDocument> parsed(documents.size());
+    std::vector<std::exception_ptr> errors(documents.size());
+    std::vector<size_t> indexes(documents.size());
+    std::iota(indexes.begin(), indexes.end(), 0);
+    std::for_each(policy, indexes.begin(), indexes.end(), [&](size_t index) {
+        try {
+            parsed[index] = ParseDocument(documents[index].text);
+        }
+        catch (...) {
+            errors[index] = std::current_exception();
+        }
         });
+    for (const std::exception_ptr& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+    if (snapshot_) {
+        ThawSnapshot();
+    }
+
+    // Words are views of the keys of the parsed word_freqs maps.
+    struct ChunkTerm {
+        std::string_view word;
+        std::vector<PostingList::Posting> postings;
+    };
+    const auto first_ordinal = static_cast<uint32_t>(document_data_.size());
+    std::vector<std::vector<ChunkTerm>> chunk_terms(chunk_count);
+    std::vector<size_t> chunks(chunk_count);
+    std::iota(chunks.begin(), chunks.end(), 0);
+    std::for_each(policy, chunks.begin(), chunks.end(), [&](size_t chunk) {
+        std::unordered_map<std::string_view, size_t> term_indexes;
+        std::vector<ChunkTerm>& terms = chunk_terms[chunk];
+        const size_t end = documents.size() * (chunk + 1) / chunk_count;
+        for (size_t index = documents.size() * chunk / chunk_count; index < end; ++index) {
+            auto count_it = parsed[index].counts.begin();
+            for (const auto& [word, freq] : parsed[index].word_freqs) {
+                const auto [term_it, is_new] = term_indexes.emplace(word, terms.size());
+                if (is_new) {
+                    terms.push_back({ word, {} });
+                }
+                terms[term_it->second].postings.push_back({ static_cast<uint32_t>(first_ordinal + index), *count_it++ });
+            }
+        }
+        });
+
+    for (const std::vector<ChunkTerm>& terms : chunk_terms) {
+        for (const ChunkTerm& chunk_term : terms) {
+            TermData& term = FindOrAddTerm(chunk_term.word);
+            for (const PostingList::Posting& posting : chunk_term.postings) {
+                term.postings.Append(posting.ordinal, posting.count);
+                term.max_term_freq = std::max<double>(term.max_term_freq,
+                    posting.count * parsed[posting.ordinal - first_ordinal].inv_word_count);
+            }
+        }
+    }
+    document_data_.reserve(document_data_.size() + documents.size());
+    document_ids_.reserve(document_ids_.size() + documents.size());
+    for (size_t index = 0; index < documents.size(); ++index) {
+        const DocumentInput& document = documents[index];
+        document_to_word_freqs_[document.id] = std::move(parsed[index].word_freqs);
+        document_ordinals_.emplace(document.id, static_cast<uint32_t>(first_ordinal + index));
+        document_data_.push_back({ document.id, ComputeAverageRating(document.ratings), document.status, parsed[index].inv_word_count });
+        document_ids_.push_back(document.id);
+    }
+    ExtendSegments();
+    for (size_t index = 0; index < documents.size(); ++index) {
+        SetStatusBit(static_cast<uint32_t>(first_ordinal + index), documents[index].status, true);
+    }
+    ++index_generation_;
+    METRICS_COUNT(MetricCounter::ADDED_DOCUMENTS, documents.size());
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query, DocumentStatus status,
+    size_t max_result_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, status, max_result_count);
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query) const {
     return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
 }
 
+size_t SearchServer::WriteTopDocuments(std::string_view raw_query, Document* output) const {
+    const Query query = ParseQuery(raw_query);
+    if (retrieval_mode_ != RetrievalMode::EXHAUSTIVE || query_cache_.IsEnabled()) {
+        const std::vector<Document> documents = FindTopDocumentsByStatus(std::execution::seq, query, DocumentStatus::ACTUAL,
+            MAX_RESULT_DOCUMENT_COUNT);
+        return std::copy(documents.begin(), documents.end(), output) - output;
+    }
+    METRICS_COUNT(MetricCounter::SEARCHES, 1);
+    const uint64_t* status_bits = status_documents_[static_cast<size_t>(DocumentStatus::ACTUAL)].data();
+    const auto status_filter = [status_bits](uint32_t ordinal) {
+        return (status_bits[ordinal / 64] >> (ordinal % 64)) & 1;
+    };
+    RelevanceAccumulator& accumulator = RelevanceAccumulator::ForCurrentThread();
+    FindAllDocuments(query, status_filter, accumulator, 0, static_cast<uint32_t>(document_data_.size()), StopCondition());
+    return SelectTopDocuments(accumulator, MAX_RESULT_DOCUMENT_COUNT, output);
+}
+
+CompiledQuery SearchServer::CompileQuery(std::string_view raw_query) const {
+    const Query query = ParseQuery(raw_query, true);
+    CompiledQuery compiled_query;
+    compiled_query.dictionary_id_ = dictionary_id_;
+    compiled_query.dictionary_size_ = terms_.size();
+    for (const QueryTerms* query_terms : { &query.plus_terms, &query.minus_terms }) {
+        for (const QueryTerms::Term& query_term : *query_terms) {
+            const auto offset = static_cast<uint32_t>(compiled_query.text_.size());
+            const auto size = static_cast<uint32_t>(query_term.word.size());
+            compiled_query.words_.push_back({ offset, size, query_term.id, query_terms == &query.minus_terms });
+            compiled_query.text_.append(query_term.word);
+        }
+    }
+    return compiled_query;
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const CompiledQuery& query, DocumentStatus status, size_t max_result_count) const {
+    return FindTopDocuments(std::execution::seq, query, status, max_result_count);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const CompiledQuery& query) const {
+    return FindTopDocuments(query, DocumentStatus::ACTUAL);
+}
+
+std::future<SearchResult> SearchServer::FindTopDocumentsAsync(std::string raw_query, DocumentStatus status, SearchDeadline deadline,
+    size_t max_result_count) const {
+    return std::async(std::launch::async, [this, raw_query = std::move(raw_query), status, deadline = std::move(deadline), max_result_count] {
+        const StopCondition stop_condition(&deadline);
+        SearchResult result;
+        result.documents = FindTopDocumentsByStatus(std::execution::seq, ParseQuery(raw_query), status, max_result_count, stop_condition);
+        result.is_complete = !stop_condition.IsStopped();
+        if (!result.is_complete) {
+            METRICS_COUNT(MetricCounter::STOPPED_SEARCHES, 1);
+        }
+        return result;
+        });
+}
+
+std::future<SearchResult> SearchServer::FindTopDocumentsAsync(std::string raw_query, SearchDeadline deadline) const {
+    return FindTopDocumentsAsync(std::move(raw_query), DocumentStatus::ACTUAL, std::move(deadline));
+}
+
+SearchPage SearchServer::FindTopDocumentsPage(std::string_view raw_query, DocumentStatus status, const PageCursor& cursor,
+    size_t page_size) const {
+    const Query query = ParseQuery(raw_query);
+    const uint64_t query_hash = HashPageQuery(query, status);
+    if (!cursor.IsStart() && (cursor.query_hash_ != query_hash || cursor.index_generation_ != index_generation_)) {
+        throw std::invalid_argument("Page cursor is of another query or of an older index");
+    }
+    const auto status_index = static_cast<size_t>(status);
+    if (status_index >= kDocumentStatusCount) {
+        return FindPage(query, [this, status](uint32_t ordinal) {
+            return !IsDeleted(ordinal) && document_data_[ordinal].status == status;
+            }, cursor, page_size, query_hash);
+    }
+    const uint64_t* status_bits = status_documents_[status_index].data();
+    return FindPage(query, [status_bits](uint32_t ordinal) {
+        return (status_bits[ordinal / 64] >> (ordinal % 64)) & 1;
+        }, cursor, page_size, query_hash);
+}
+
+SearchPage SearchServer::FindTopDocumentsPage(std::string_view raw_query, const PageCursor& cursor, size_t page_size) const {
+    return FindTopDocumentsPage(raw_query, DocumentStatus::ACTUAL, cursor, page_size);
+}
+
+// FNV-1a over the term ids. Unknown words are not in the query, and they match
+// nothing anyway.
+uint64_t SearchServer::HashPageQuery(const Query& query, DocumentStatus status) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const auto add = [&hash](uint64_t value) {
+        hash = (hash ^ value) * 0x100000001b3ULL;
+    };
+    add(static_cast<uint64_t>(status));
+    for (const QueryTerms::Term& query_term : query.plus_terms) {
+        add(query_term.id);
+    }
+    add(UINT64_MAX);
+    for (const QueryTerms::Term& query_term : query.minus_terms) {
+        add(query_term.id);
+    }
+    return hash;
+}
+
+bool SearchServer::IsMoreRelevant(const Document& lhs, const Document& rhs) {
+    if (std::abs(lhs.relevance - rhs.relevance) < kLittleNumber) {
+        return lhs.rating > rhs.rating;
+    }
+    return lhs.relevance > rhs.relevance;
+}
+
+// Bounded heap of the max_result_count best documents seen so far, worst on top:
+// O(N log K) over the touched ordinals, and only the result vector is allocated.
+std::vector<Document> SearchServer::SelectTopDocuments(const RelevanceAccumulator& accumulator, size_t max_result_count) const {
+    std::vector<Document> top_documents(std::min(max_result_count, accumulator.GetTouched().size()));
+    top_documents.resize(SelectTopDocuments(accumulator, top_documents.size(), top_documents.data()));
+    return top_documents;
+}
+
+size_t SearchServer::SelectTopDocuments(const RelevanceAccumulator& accumulator, size_t max_result_count, Document* output) const {
+    METRICS_STAGE_TIMER(MetricStage::TOP_K_SELECTION);
+    if (max_result_count == 0) {
+        return 0;
+    }
+    size_t size = 0;
+    for (const uint32_t ordinal : accumulator.GetTouched()) {
+        if (!accumulator.IsActive(ordinal)) {
+            continue;
+        }
+        const DocumentData& document_data = document_data_[ordinal];
+        PushTopDocument(output, size, { document_data.id, accumulator.GetRelevance(ordinal), document_data.rating }, max_result_count);
+    }
+    std::sort_heap(output, output + size, IsMoreRelevant);
+    return size;
+}
+
+bool SearchServer::RanksBefore(const Document& lhs, const Document& rhs) {
+    if (lhs.relevance != rhs.relevance) {
+        return lhs.relevance > rhs.relevance;
+    }
+    if (lhs.rating != rhs.rating) {
+        return lhs.rating > rhs.rating;
+    }
+    return lhs.id < rhs.id;
+}
+
+// The bounded heap of SelectTopDocuments over the documents ranking after the
+// cursor, with one slot more than the page to tell whether any are left.
+SearchPage SearchServer::SelectPage(const RelevanceAccumulator& accumulator, const PageCursor& cursor, size_t page_size,
+    uint64_t query_hash) const {
+    METRICS_STAGE_TIMER(MetricStage::TOP_K_SELECTION);
+    SearchPage page;
+    page.next_cursor = cursor;
+    const size_t heap_size = page_size + 1;
+    std::vector<Document>& documents = page.documents;
+    documents.reserve(std::min(heap_size, accumulator.GetTouched().size()));
+    for (const uint32_t ordinal : accumulator.GetTouched()) {
+        if (!accumulator.IsActive(ordinal)) {
+            continue;
+        }
+        const DocumentData& document_data = document_data_[ordinal];
+        const Document document(document_data.id, accumulator.GetRelevance(ordinal), document_data.rating);
+        if (!cursor.IsStart() && !RanksBefore(cursor.last_document_, document)) {
+            continue;
+        }
+        if (documents.size() < heap_size) {
+            documents.push_back(document);
+            std::push_heap(documents.begin(), documents.end(), RanksBefore);
+        }
+        else if (RanksBefore(document, documents.front())) {
+            std::pop_heap(documents.begin(), documents.end(), RanksBefore);
+            documents.back() = document;
+            std::push_heap(documents.begin(), documents.end(), RanksBefore);
+        }
+    }
+    std::sort_heap(documents.begin(), documents.end(), RanksBefore);
+    if (documents.size() > page_size) {
+        documents.pop_back();
+        page.has_more = true;
+    }
+    if (!documents.empty()) {
+        page.next_cursor = PageCursor(documents.back(), query_hash, index_generation_);
+    }
+    return page;
+}
+
+void SearchServer::PushTopDocument(std::vector<Document>& top_documents, const Document& document, size_t max_result_count) {
+    size_t size = top_documents.size();
+    if (size < max_result_count) {
+        top_documents.emplace_back();
+    }
+    PushTopDocument(top_documents.data(), size, document, max_result_count);
+}
+
+void SearchServer::PushTopDocument(Document* top_documents, size_t& size, const Document& document, size_t max_result_count) {
+    if (size < max_result_count) {
+        top_documents[size++] = document;
+        std::push_heap(top_documents, top_documents + size, IsMoreRelevant);
+    }
+    else if (IsMoreRelevant(document, top_documents[0])) {
+        std::pop_heap(top_documents, top_documents + size, IsMoreRelevant);
+        top_documents[size - 1] = document;
+        std::push_heap(top_documents, top_documents + size, IsMoreRelevant);
+    }
+}
+
+std::vector<SearchServer::TermCursor> SearchServer::MakeTermCursors(const QueryTerms& query_terms,
+    uint32_t begin_ordinal, uint32_t end_ordinal) const {
+    std::vector<TermCursor> cursors;
+    size_t query_index = 0;
+    for (const QueryTerms::Term& query_term : query_terms) {
+        const TermData& term = terms_[query_term.id];
+        if (GetDocumentFreq(term) == 0) {
+            continue;
+        }
+        TermCursor cursor;
+        cursor.postings = &term.postings;
+        cursor.position = term.postings.MakeCursor(begin_ordinal, end_ordinal);
+        cursor.posting_count = term.postings.CountPostings(begin_ordinal, end_ordinal);
+        cursor.inverse_document_freq = ComputeWordInverseDocumentFreq(term);
+        cursor.max_relevance = term.max_term_freq * cursor.inverse_document_freq;
+        cursor.query_index = query_index++;
+        cursors.push_back(cursor);
+    }
+    return cursors;
+}
+
+void SearchServer::SetQueryCacheSize(size_t max_memory_bytes) {
+    query_cache_ = QueryCache(max_memory_bytes);
+}
+
+QueryCacheStatistics SearchServer::GetQueryCacheStatistics() const {
+    return query_cache_.GetStatistics();
+}
+
+// Words cannot hold control characters, so those separate the parts of the key.
+// Sets keep the words sorted and unique, and stop words never get into them.
+std::string SearchServer::MakeQueryCacheKey(const Query& query, DocumentStatus status, size_t max_result_count) const {
+    std::string key;
+    for (const QueryTerms::Term& query_term : query.plus_terms) {
+        key.append(query_term.word).push_back('\x01');
+    }
+    key.push_back('\x02');
+    for (const QueryTerms::Term& query_term : query.minus_terms) {
+        key.append(query_term.word).push_back('\x01');
+    }
+    key.push_back('\x02');
+    key += std::to_string(static_cast<int>(status));
+    key.push_back('\x02');
+    key += std::to_string(max_result_count);
+    key.push_back('\x02');
+    key += std::to_string(static_cast<int>(retrieval_mode_));
+    return key;
+}
+
+void SearchServer::SetRetrievalMode(RetrievalMode mode) {
+    retrieval_mode_ = mode;
+}
+
+RetrievalMode SearchServer::GetRetrievalMode() const {
+    return retrieval_mode_;
+}
+
+IndexMemoryUsage SearchServer::GetMemoryUsage() const {
+    IndexMemoryUsage usage;
+    for (const TermData& term : terms_) {
+        usage.posting_count += term.postings.GetSize();
+        usage.posting_bytes += term.postings.GetMemoryUsage();
+    }
+    usage.uncompressed_posting_bytes = usage.posting_count * sizeof(std::pair<uint32_t, double>);
+
+    usage.dictionary_bytes = GetMapMemoryUsage(term_ids_) + terms_.capacity() * sizeof(TermData);
+    for (const auto& [word, term_id] : term_ids_) {
+        usage.dictionary_bytes += GetStringMemoryUsage(word);
+    }
+
+    usage.document_bytes = GetMapMemoryUsage(document_ordinals_) + document_data_.capacity() * sizeof(DocumentData)
+        + document_ids_.capacity() * sizeof(int) + tombstones_.capacity() * sizeof(uint64_t) + segments_.capacity() * sizeof(Segment);
+    for (const std::vector<uint64_t>& status_documents : status_documents_) {
+        usage.document_bytes += status_documents.capacity() * sizeof(uint64_t);
+    }
+    for (const Segment& segment : segments_) {
+        usage.document_bytes += segment.dirty_terms.capacity() * sizeof(uint32_t);
+    }
+
+    usage.word_frequency_bytes = GetMapMemoryUsage(document_to_word_freqs_);
+    for (const auto& [document_id, word_freqs] : document_to_word_freqs_) {
+        usage.word_frequency_bytes += GetMapMemoryUsage(word_freqs);
+        for (const auto& [word, freq] : word_freqs) {
+            usage.word_frequency_bytes += GetStringMemoryUsage(word);
+        }
+    }
+    usage.mapped_bytes = snapshot_ ? snapshot_->GetFileSize() : 0;
+    return usage;
+}
+
+size_t IndexMemoryUsage::GetTotal() const {
+    return posting_bytes + dictionary_bytes + document_bytes + word_frequency_bytes;
+}
+
+// Terms go out in word order, which is the order of term_ids_ and of a loaded snapshot alike.
+// Postings of tombstoned documents are left out, as if every segment had just been merged.
+void SearchServer::SaveSnapshot(const std::string& path) const {
+    IndexSnapshotWriter writer;
+    for (const std::string& stop_word : stop_words_) {
+        writer.AddStopWord(stop_word);
+    }
+    const auto ordinal_count = static_cast<uint32_t>(document_data_.size());
+    std::vector<uint32_t> deleted_ordinals;
+    for (uint32_t ordinal = 0; ordinal < ordinal_count; ++ordinal) {
+        if (IsDeleted(ordinal)) {
+            deleted_ordinals.push_back(ordinal);
+        }
+    }
+    std::vector<std::vector<IndexSnapshot::DocumentTerm>> document_terms(ordinal_count);
+    const auto add_term = [&](std::string_view word, const TermData& term) {
+        PostingList live_postings;
+        if (term.deleted_posting_count > 0) {
+            live_postings = term.postings;
+            live_postings.Erase(deleted_ordinals);
+        }
+        const PostingList& postings = term.deleted_posting_count > 0 ? live_postings : term.postings;
+        const uint32_t term_index = writer.AddTerm(word, postings, term.max_term_freq);
+        postings.ForEach(0, ordinal_count, [&](uint32_t ordinal, uint32_t count) {
+            document_terms[ordinal].push_back({ term_index, count });
+            });
+    };
+    bool is_word_order = true;
+    if (snapshot_) {
+        for (size_t term = 0; term < terms_.size(); ++term) {
+            add_term(snapshot_->GetWord(term), terms_[term]);
+        }
+    }
+    else {
+        uint32_t term_index = 0;
+        for (const auto& [word, term_id] : term_ids_) {
+            is_word_order = is_word_order && term_id == term_index++;
+            add_term(word, terms_[term_id]);
+        }
+    }
+    // Queries compiled here stay valid for the loaded server only if no term is renumbered.
+    writer.SetDictionaryId(is_word_order ? dictionary_id_ : MakeDictionaryId());
+    for (uint32_t ordinal = 0; ordinal < ordinal_count; ++ordinal) {
+        const DocumentData& document_data = document_data_[ordinal];
+        const auto document_it = document_ordinals_.find(document_data.id);
+        const bool is_live = document_it != document_ordinals_.end() && document_it->second == ordinal;
+        writer.AddDocument(document_data.id, document_data.rating, document_data.status, is_live, document_terms[ordinal]);
+    }
+    writer.Write(path);
+}
+
+SearchServer SearchServer::LoadSnapshot(const std::string& path, SnapshotVerification verification) {
+    auto snapshot = std::make_shared<const IndexSnapshot>(path, verification);
+    SearchServer search_server(snapshot->GetStopWords());
+    search_server.terms_.resize(snapshot->GetTermCount());
+    for (size_t term = 0; term < snapshot->GetTermCount(); ++term) {
+        TermData& term_data = search_server.terms_[term];
+        term_data.postings = PostingList::MakeView(snapshot->GetPostings(term));
+        term_data.max_term_freq = snapshot->GetTerm(term).max_term_freq;
+    }
+    search_server.document_data_.reserve(snapshot->GetDocumentCount());
+    for (uint32_t ordinal = 0; ordinal < snapshot->GetDocumentCount(); ++ordinal) {
+        const IndexSnapshot::DocumentRecord& record = snapshot->GetDocument(ordinal);
+        const auto inv_word_count = static_cast<float>(1.0 / record.word_count);
+        search_server.document_data_.push_back({ record.id, record.rating, static_cast<DocumentStatus>(record.status), inv_word_count });
+        if (record.is_live != 0) {
+            if (record.id < 0 || !search_server.document_ordinals_.emplace(record.id, ordinal).second) {
+                throw std::invalid_argument("Invalid index snapshot: bad document id");
+            }
+            search_server.document_ids_.push_back(record.id);
+        }
+    }
+    search_server.ExtendSegments();
+    for (uint32_t ordinal = 0; ordinal < snapshot->GetDocumentCount(); ++ordinal) {
+        if (snapshot->GetDocument(ordinal).is_live == 0) {
+            search_server.tombstones_[ordinal / 64] |= uint64_t{ 1 } << (ordinal % 64);
+        }
+        else {
+            search_server.SetStatusBit(ordinal, search_server.document_data_[ordinal].status, true);
+        }
+    }
+    search_server.dictionary_id_ = snapshot->GetDictionaryId();
+    search_server.snapshot_ = std::move(snapshot);
+    return search_server;
+}
+
+// The word frequencies go first: they are where a damaged file is found, and the
+// index must still be served from the snapshot then.
+void SearchServer::ThawSnapshot() {
+    std::map<int, std::map<std::string, double, std::less<>>> document_to_word_freqs;
+    for (const auto& [document_id, ordinal] : document_ordinals_) {
+        document_to_word_freqs.emplace_hint(document_to_word_freqs.end(), document_id, snapshot_->MakeWordFrequencies(ordinal));
+    }
+    for (size_t term = 0; term < terms_.size(); ++term) {
+        term_ids_.emplace_hint(term_ids_.end(), snapshot_->GetWord(term), static_cast<uint32_t>(term));
+        terms_[term].postings.MakeOwned();
+    }
+    document_to_word_freqs_ = std::move(document_to_word_freqs);
+    snapshot_.reset();
+}
+
 int SearchServer::GetDocumentCount() const {
-    return documents_.size();
+    return document_ordinals_.size();
 }
 
 int SearchServer::GetDocumentId(int index) const {
-    return document_ids_.at(index);
+    if (!are_document_ids_stale_) {
+        return document_ids_.at(index);
+    }
+    for (uint32_t ordinal = 0; ordinal < document_data_.size() && index >= 0; ++ordinal) {
+        if (!IsDeleted(ordinal) && index-- == 0) {
+            return document_data_[ordinal].id;
+        }
+    }
+    throw std::out_of_range("Invalid document index");
 }
 
 const std::vector<int>::iterator SearchServer::begin() {
+    DropRemovedDocumentIds();
     return document_ids_.begin();
 }
 
 const std::vector<int>::iterator SearchServer::end() {
+    DropRemovedDocumentIds();
     return document_ids_.end();
 }
 
+// Rebuilt from the tombstones rather than searched by id: a removed id may have been added again.
+void SearchServer::DropRemovedDocumentIds() {
+    if (!are_document_ids_stale_) {
+        return;
+    }
+    document_ids_.clear();
+    for (uint32_t ordinal = 0; ordinal < document_data_.size(); ++ordinal) {
+        if (!IsDeleted(ordinal)) {
+            document_ids_.push_back(document_data_[ordinal].id);
+        }
+    }
+    are_document_ids_stale_ = false;
+}
+
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::string_view raw_query, int document_id) const {
     return MatchDocument(std::execution::seq, raw_query, document_id);
 }
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::sequenced_policy&, std::string_view raw_query, int document_id) const {
-    Query query;
-    query = ParseQuery(raw_query);
+    const uint32_t ordinal = document_ordinals_.at(document_id);
+    const Query query = ParseQuery(raw_query);
     std::vector<std::string_view> matched_words;
-    for (const std::string_view word : query.plus_words) {
-        std::string temp{word};
-        if (word_to_document_freqs_.count(temp) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(temp).count(document_id)) {
-            matched_words.push_back(word);
+    for (const QueryTerms::Term& query_term : query.minus_terms) {
+        if (terms_[query_term.id].postings.GetCount(ordinal) > 0) {
+            return { matched_words, document_data_[ordinal].status };
         }
     }
-    for (const std::string_view word : query.minus_words) {
-        std::string temp{word};
-        if (word_to_document_freqs_.count(temp) == 0) {
-            continue;
-        }
-        if (word_to_document_freqs_.at(temp).count(document_id)) {
-            matched_words.clear();
-            break;
+    for (const QueryTerms::Term& query_term : query.plus_terms) {
+        if (terms_[query_term.id].postings.GetCount(ordinal) > 0) {
+            matched_words.push_back(query_term.word);
         }
     }
-    return { matched_words, documents_.at(document_id).status };
+    return { matched_words, document_data_[ordinal].status };
 }
 
+// Every word gets its own slot, so the threads never write to the same place;
+// words are never empty, so an empty slot marks a word the document lacks.
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::execution::parallel_policy&, std::string_view raw_query, int document_id) const {
-
-    std::string from_raw_query{ raw_query.begin(), raw_query.end() };
-    SearchServer::Query temp_words_ = ParseQuery(from_raw_query);
+    const uint32_t ordinal = document_ordinals_.at(document_id);
+    const Query query = ParseQuery(raw_query);
+    const auto is_in_document = [this, ordinal](const QueryTerms::Term& query_term) {
+        return terms_[query_term.id].postings.GetCount(ordinal) > 0;
+    };
     std::vector<std::string_view> matched_words;
-    std::for_each(std::execution::par , temp_words_.plus_words.begin(), temp_words_.plus_words.end(), [this, document_id, &matched_words](const std::string_view& word) {
-        std::string temp{word};
-        if (word_to_document_freqs_.count(temp) == 0) {
-            return;
-        }
-        if (word_to_document_freqs_.at(temp).count(document_id)) {
-            matched_words.push_back(word);
-        }
-        });
-    std::for_each(std::execution::par, temp_words_.minus_words.begin(), temp_words_.minus_words.end(), [this, document_id, &matched_words](const std::string_view& word) {
-        std::string temp{ word };
-        if (word_to_document_freqs_.count(temp) == 0) {
-            return;
-        }
-        if (word_to_document_freqs_.at(temp).count(document_id)) {
-            matched_words.clear();
-            return;
-        }
+    if (std::any_of(std::execution::par, query.minus_terms.begin(), query.minus_terms.end(), is_in_document)) {
+        return { matched_words, document_data_[ordinal].status };
+    }
+    matched_words.resize(query.plus_terms.size());
+    std::transform(std::execution::par, query.plus_terms.begin(), query.plus_terms.end(), matched_words.begin(),
+        [&is_in_document](const QueryTerms::Term& query_term) {
+            return is_in_document(query_term) ? query_term.word : std::string_view();
         });
-    return { matched_words, documents_.at(document_id).status };
+    matched_words.erase(std::remove(matched_words.begin(), matched_words.end(), std::string_view()), matched_words.end());
+    return { matched_words, document_data_[ordinal].status };
 }
 
 
 bool SearchServer::IsStopWord(const std::string_view& word) const {
-    std::string temp{word};
-    return stop_words_.count(temp) > 0;
+    return stop_words_.count(word) > 0;
 }
 
-const std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(const std::string_view& text) const {
-    std::vector<std::string_view> words;
-    for (const std::string_view& word : SplitIntoWords(text)) {
-        if (!IsValidWord(word)) {
-            throw std::invalid_argument("Word is invalid");
-        }
-        if (!IsStopWord(word)) {
-            words.push_back(word);
+// Validation comes with the split, so words are not scanned a second time.
+void SearchServer::SplitIntoWordsNoStop(std::string_view text, std::vector<std::string_view>& words) const {
+    if (!SplitIntoWords(text, words)) {
+        throw std::invalid_argument("Word is invalid");
+    }
+    if (!stop_words_.empty()) {
+        words.erase(std::remove_if(words.begin(), words.end(), [this](std::string_view word) {
+            return IsStopWord(word);
+            }), words.end());
+    }
+}
+
+SearchServer::ParsedDocument SearchServer::ParseDocument(std::string_view text) const {
+    // Per thread, as AddDocuments parses in parallel; keeps its capacity between documents.
+    thread_local std::vector<std::string_view> words;
+    SplitIntoWordsNoStop(text, words);
+    ParsedDocument document;
+    // Count occurrences first, so every term gets a single posting with its final count.
+    for (const std::string_view& word : words) {
+        auto freq_it = document.word_freqs.find(word);
+        if (freq_it == document.word_freqs.end()) {
+            freq_it = document.word_freqs.emplace(std::string{ word }, 0.0).first;
         }
+        freq_it->second += 1.0;
+    }
+    const double inv_word_count = 1.0 / words.size();
+    // Postings keep counts and score with this float; word_freqs keep the exact frequency.
+    document.inv_word_count = static_cast<float>(inv_word_count);
+    document.counts.reserve(document.word_freqs.size());
+    for (auto& [word, freq] : document.word_freqs) {
+        const auto count = static_cast<uint32_t>(freq);
+        document.counts.push_back(count);
+        freq = count * inv_word_count;
     }
-    return words;
+    return document;
 }
 
 int SearchServer::ComputeAverageRating(const std::vector<int>& ratings) {
@@ -157,39 +716,114 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view text) cons
         is_minus = true;
         text = text.substr(1);
     }
-    if (text.empty() || text[0] == '-' || !IsValidWord(text)) {
+    // ParseQuery has already rejected control characters.
+    if (text.empty() || text[0] == '-') {
         throw std::invalid_argument("Word is invalid");
     }
     return QueryWord{ text, is_minus, IsStopWord(text) };
 }
 
-SearchServer::Query SearchServer::ParseQuery(const std::string_view& text) const {
+SearchServer::Query SearchServer::ParseQuery(std::string_view text, bool keep_unknown_words) const {
+    METRICS_STAGE_TIMER(MetricStage::PARSE_QUERY);
+    thread_local std::vector<std::string_view> words;
+    if (!SplitIntoWords(text, words)) {
+        throw std::invalid_argument("Word is invalid");
+    }
     Query result;
-    for (const std::string_view& word : SplitIntoWords(text)) {
-        QueryWord query_word = ParseQueryWord(word);       
-        if (!query_word.is_stop) {
-            if (query_word.is_minus) {
-                result.minus_words.insert(query_word.data);
-            }
-            else {
-                result.plus_words.insert(query_word.data);
-            }
+    for (const std::string_view& word : words) {
+        const QueryWord query_word = ParseQueryWord(word);
+        if (query_word.is_stop) {
+            continue;
+        }
+        const uint32_t term_id = FindTermId(query_word.data);
+        if (term_id == CompiledQuery::kUnknownTerm && !keep_unknown_words) {
+            continue;
         }
+        (query_word.is_minus ? result.minus_terms : result.plus_terms).Insert(query_word.data, term_id);
     }
     return result;
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(const std::string_view& word) const {
-    std::string temp{ word };
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(temp).size());
+SearchServer::Query SearchServer::ResolveQuery(const CompiledQuery& compiled_query) const {
+    if (compiled_query.dictionary_id_ != dictionary_id_ || compiled_query.dictionary_size_ > terms_.size()) {
+        throw std::invalid_argument("Query is compiled for another index");
+    }
+    const bool is_dictionary_grown = compiled_query.dictionary_size_ < terms_.size();
+    const std::string_view text = compiled_query.text_;
+    Query query;
+    for (const CompiledQuery::Word& word : compiled_query.words_) {
+        const std::string_view word_text = text.substr(word.offset, word.size);
+        uint32_t term_id = word.term_id;
+        if (term_id == CompiledQuery::kUnknownTerm && is_dictionary_grown) {
+            term_id = FindTermId(word_text);
+        }
+        if (term_id != CompiledQuery::kUnknownTerm) {
+            (word.is_minus ? query.minus_terms : query.plus_terms).Insert(word_text, term_id);
+        }
+    }
+    return query;
+}
+
+uint32_t SearchServer::FindTermId(std::string_view word) const {
+    if (snapshot_) {
+        const size_t term = snapshot_->FindTerm(word);
+        return term < terms_.size() ? static_cast<uint32_t>(term) : CompiledQuery::kUnknownTerm;
+    }
+    const auto term_it = term_ids_.find(word);
+    return term_it == term_ids_.end() ? CompiledQuery::kUnknownTerm : term_it->second;
+}
+
+uint64_t SearchServer::MakeDictionaryId() {
+    static std::atomic<uint64_t> next_id = (uint64_t{ std::random_device()() } << 32) | std::random_device()();
+    return next_id.fetch_add(1, std::memory_order_relaxed);
 }
 
-const std::map<std::string, double>& SearchServer::GetWordFrequencies(int document_id) const {
-    static const std::map<std::string, double> temporary;
-    if (document_to_word_freqs_.count(document_id) == 0) {
+SearchServer::TermData& SearchServer::FindOrAddTerm(std::string_view word) {
+    auto term_it = term_ids_.find(word);
+    if (term_it == term_ids_.end()) {
+        term_it = term_ids_.emplace(word, static_cast<uint32_t>(terms_.size())).first;
+        terms_.emplace_back();
+    }
+    return terms_[term_it->second];
+}
+
+size_t SearchServer::GetDocumentFreq(const TermData& term) {
+    return term.postings.GetSize() - term.deleted_posting_count;
+}
+
+double SearchServer::ComputeWordInverseDocumentFreq(const TermData& term) const {
+    InverseDocumentFreqCache& cache = term.inverse_document_freq;
+    if (cache.generation.load(std::memory_order_acquire) == index_generation_) {
+        return cache.value.load(std::memory_order_relaxed);
+    }
+    const double inverse_document_freq = log(GetDocumentCount() * 1.0 / GetDocumentFreq(term));
+    cache.value.store(inverse_document_freq, std::memory_order_relaxed);
+    cache.generation.store(index_generation_, std::memory_order_release);
+    return inverse_document_freq;
+}
+
+SearchServer::InverseDocumentFreqCache::InverseDocumentFreqCache(const InverseDocumentFreqCache& other)
+    : generation(other.generation.load(std::memory_order_relaxed))
+    , value(other.value.load(std::memory_order_relaxed)) {
+}
+
+SearchServer::InverseDocumentFreqCache& SearchServer::InverseDocumentFreqCache::operator=(const InverseDocumentFreqCache& other) {
+    generation.store(other.generation.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+}
+
+const std::map<std::string, double, std::less<>>& SearchServer::GetWordFrequencies(int document_id) const {
+    static const std::map<std::string, double, std::less<>> temporary;
+    if (snapshot_) {
+        const auto ordinal_it = document_ordinals_.find(document_id);
+        return ordinal_it == document_ordinals_.end() ? temporary : snapshot_->GetWordFrequencies(ordinal_it->second);
+    }
+    const auto document_it = document_to_word_freqs_.find(document_id);
+    if (document_it == document_to_word_freqs_.end()) {
         return temporary;
     }
-    return document_to_word_freqs_.at(document_id);
+    return document_it->second;
 }
 
 void SearchServer::RemoveDocument(int document_id) {
@@ -197,35 +831,133 @@ void SearchServer::RemoveDocument(int document_id) {
 }
 
 void SearchServer::RemoveDocument(const std::execution::sequenced_policy&, int document_id) {
-    documents_.erase(document_id);
-    document_ids_.erase(remove(document_ids_.begin(), document_ids_.end(), document_id), document_ids_.end());
-    for (const auto& map_word : word_to_document_freqs_) {
-        if (word_to_document_freqs_.at(map_word.first).count(document_id)) {
-            word_to_document_freqs_.at(map_word.first).erase(document_id);
-        }
+    METRICS_STAGE_TIMER(MetricStage::REMOVE_DOCUMENT);
+    const auto document_it = document_ordinals_.find(document_id);
+    if (document_it == document_ordinals_.end()) {
+        return;
+    }
+    if (snapshot_) {
+        ThawSnapshot();
     }
+    MergeSegmentIfNeeded(TombstoneDocument(document_it, GetDocumentTermIds(document_id)));
 }
 
 void SearchServer::RemoveDocument(const std::execution::parallel_policy&, int document_id) {
-    if (document_to_word_freqs_.count(document_id) == 0) {
+    METRICS_STAGE_TIMER(MetricStage::REMOVE_DOCUMENT);
+    const auto document_it = document_ordinals_.find(document_id);
+    if (document_it == document_ordinals_.end()) {
         return;
     }
-    documents_.erase(document_id);
-    document_ids_.erase(remove(document_ids_.begin(), document_ids_.end(), document_id), document_ids_.end());
+    if (snapshot_) {
+        ThawSnapshot();
+    }
     const auto& word_freqs = document_to_word_freqs_.at(document_id);
-    std::vector<std::string> words(word_freqs.size());
+    std::vector<uint32_t> term_ids(word_freqs.size());
     std::transform(
         std::execution::par,
         word_freqs.begin(), word_freqs.end(),
-        words.begin(),
-        [](const auto& item) { 
-            return item.first; }
-    );
-    for_each(
-        std::execution::par,
-        words.begin(), words.end(),
-        [this, document_id](std::string word) {
-            word_to_document_freqs_.at(word).erase(document_id);
+        term_ids.begin(),
+        [this](const auto& item) {
+            return term_ids_.at(item.first);
         });
-    document_to_word_freqs_.erase(document_id);
-}
\ No newline at end of file
+    MergeSegmentIfNeeded(TombstoneDocument(document_it, term_ids));
+}
+
+void SearchServer::RemoveDocuments(const std::vector<int>& document_ids) {
+    if (snapshot_ && std::any_of(document_ids.begin(), document_ids.end(), [this](int document_id) {
+        return document_ordinals_.count(document_id) > 0;
+        })) {
+        ThawSnapshot();
+    }
+    std::vector<size_t> segment_indexes;
+    for (const int document_id : document_ids) {
+        const auto document_it = document_ordinals_.find(document_id);
+        if (document_it != document_ordinals_.end()) {
+            segment_indexes.push_back(TombstoneDocument(document_it, GetDocumentTermIds(document_id)));
+        }
+    }
+    std::sort(segment_indexes.begin(), segment_indexes.end());
+    segment_indexes.erase(std::unique(segment_indexes.begin(), segment_indexes.end()), segment_indexes.end());
+    for (const size_t segment_index : segment_indexes) {
+        MergeSegmentIfNeeded(segment_index);
+    }
+}
+
+std::vector<uint32_t> SearchServer::GetDocumentTermIds(int document_id) const {
+    const auto& word_freqs = document_to_word_freqs_.at(document_id);
+    std::vector<uint32_t> term_ids;
+    term_ids.reserve(word_freqs.size());
+    for (const auto& [word, freq] : word_freqs) {
+        term_ids.push_back(term_ids_.at(word));
+    }
+    return term_ids;
+}
+
+size_t SearchServer::TombstoneDocument(std::map<int, uint32_t>::iterator document_it, const std::vector<uint32_t>& term_ids) {
+    const uint32_t ordinal = document_it->second;
+    const size_t segment_index = ordinal / kSegmentSize;
+    Segment& segment = segments_[segment_index];
+    for (const uint32_t term_id : term_ids) {
+        ++terms_[term_id].deleted_posting_count;
+    }
+    segment.dirty_terms.insert(segment.dirty_terms.end(), term_ids.begin(), term_ids.end());
+    ++segment.pending_delete_count;
+    tombstones_[ordinal / 64] |= uint64_t{ 1 } << (ordinal % 64);
+    SetStatusBit(ordinal, document_data_[ordinal].status, false);
+    document_to_word_freqs_.erase(document_it->first);
+    document_ordinals_.erase(document_it);
+    are_document_ids_stale_ = true;
+    ++index_generation_;
+    METRICS_COUNT(MetricCounter::REMOVED_DOCUMENTS, 1);
+    return segment_index;
+}
+
+void SearchServer::MergeSegmentIfNeeded(size_t segment_index) {
+    const size_t segment_begin = segment_index * kSegmentSize;
+    const size_t segment_size = std::min<size_t>(kSegmentSize, document_data_.size() - segment_begin);
+    if (segments_[segment_index].pending_delete_count * kMergeTombstoneRatio >= segment_size) {
+        MergeSegment(segment_index);
+    }
+}
+
+// Merges run inline, in the delete that crosses the threshold; they only touch the
+// terms of the documents deleted since the last merge of the segment.
+void SearchServer::MergeSegment(size_t segment_index) {
+    METRICS_COUNT(MetricCounter::SEGMENT_MERGES, 1);
+    Segment& segment = segments_[segment_index];
+    const auto segment_begin = static_cast<uint32_t>(segment_index * kSegmentSize);
+    const auto segment_end = static_cast<uint32_t>(std::min<size_t>(segment_begin + kSegmentSize, document_data_.size()));
+    std::vector<uint32_t> deleted_ordinals;
+    for (uint32_t ordinal = segment_begin; ordinal < segment_end; ++ordinal) {
+        if (IsDeleted(ordinal)) {
+            deleted_ordinals.push_back(ordinal);
+        }
+    }
+    std::sort(segment.dirty_terms.begin(), segment.dirty_terms.end());
+    segment.dirty_terms.erase(std::unique(segment.dirty_terms.begin(), segment.dirty_terms.end()), segment.dirty_terms.end());
+    for (const uint32_t term_id : segment.dirty_terms) {
+        TermData& term = terms_[term_id];
+        term.deleted_posting_count -= term.postings.Erase(deleted_ordinals);
+    }
+    segment.pending_delete_count = 0;
+    std::vector<uint32_t>().swap(segment.dirty_terms);
+}
+
+void SearchServer::ExtendSegments() {
+    tombstones_.resize((document_data_.size() + 63) / 64, 0);
+    for (std::vector<uint64_t>& status_documents : status_documents_) {
+        status_documents.resize(tombstones_.size(), 0);
+    }
+    segments_.resize((document_data_.size() + kSegmentSize - 1) / kSegmentSize);
+}
+
+// Documents with a status outside DocumentStatus are in no bitset; predicates still find them.
+void SearchServer::SetStatusBit(uint32_t ordinal, DocumentStatus status, bool is_live) {
+    const auto status_index = static_cast<size_t>(status);
+    if (status_index >= kDocumentStatusCount) {
+        return;
+    }
+    uint64_t& word = status_documents_[status_index][ordinal / 64];
+    const uint64_t bit = uint64_t{ 1 } << (ordinal % 64);
+    word = is_live ? word | bit : word & ~bit;
+}
@@ -1,19 +1,63 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
 #include <set>
 #include <string>
 #include <map>
+#include <memory>
 #include <execution>
+#include <future>
+#include <numeric>
+#include <thread>
+#include <type_traits>
 
+#include "compiled_query.h"
 #include "document.h"
+#include "index_snapshot.h"
+#include "posting_list.h"
+#include "query_cache.h"
 #include "read_input_functions.h"
+#include "relevance_accumulator.h"
+#include "search_deadline.h"
+#include "search_metrics.h"
+#include "search_page.h"
 #include "string_processing.h"
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 
+// How FindTopDocuments walks the postings of the plus-words.
+enum class RetrievalMode {
+    // Score every posting of every plus-word (term at a time).
+    EXHAUSTIVE,
+    // MaxScore pruning: once the words left to score cannot lift an unseen document
+    // into the top-K, only probe them for the surviving candidates. Same results up
+    // to tie order.
+    MAX_SCORE,
+};
+
+// Heap bytes held by the index, estimated from container sizes and capacities.
+struct IndexMemoryUsage {
+    size_t posting_count = 0;
+    size_t posting_bytes = 0;
+    // What the same postings would take as flat {ordinal, term_freq} pairs.
+    size_t uncompressed_posting_bytes = 0;
+    // Term dictionary and per-term data.
+    size_t dictionary_bytes = 0;
+    // Per-document metadata and id lookups.
+    size_t document_bytes = 0;
+    // Forward index behind GetWordFrequencies.
+    size_t word_frequency_bytes = 0;
+    // Snapshot file the index is served from. Mapped rather than allocated, so not in the total.
+    size_t mapped_bytes = 0;
+
+    size_t GetTotal() const;
+};
+
 class SearchServer {
 public:
     template <typename StringContainer>
@@ -23,47 +67,221 @@ public:
 
     void AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
 
+    // Indexes a batch in one go. Documents are tokenized and counted independently,
+    // their postings are gathered per chunk of the batch, and every term of a chunk
+    // is looked up in the index once. Documents get ordinals in batch order.
+    // All or nothing: if an id is negative or taken (in the index or earlier in the
+    // batch) or a word is invalid, std::invalid_argument is thrown and nothing is added.
+    void AddDocuments(const std::vector<DocumentInput>& documents);
+    void AddDocuments(const std::execution::sequenced_policy&, const std::vector<DocumentInput>& documents);
+    void AddDocuments(const std::execution::parallel_policy&, const std::vector<DocumentInput>& documents);
+
+    // max_result_count is the K of the top-K: only that many best documents are
+    // selected, the rest of the matches are never sorted.
     template <typename DocumentPredicate, class ExecutionPolicy>
-    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view& raw_query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view& raw_query, DocumentPredicate document_predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
     template <class ExecutionPolicy>
     std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy,const std::string_view raw_query,
-        DocumentStatus status) const;
+        DocumentStatus status, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
     template <class ExecutionPolicy>
     std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query) const;
 
     template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(const std::string_view& raw_query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindTopDocuments(const std::string_view& raw_query, DocumentPredicate document_predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
-    std::vector<Document> FindTopDocuments(const std::string_view& raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(const std::string_view& raw_query, DocumentStatus status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
 
     std::vector<Document> FindTopDocuments(const std::string_view& raw_query) const;
 
+    // Writes what FindTopDocuments(raw_query) returns to output, which must have room for
+    // MAX_RESULT_DOCUMENT_COUNT documents, and returns how many it wrote. Without a query
+    // cache the exhaustive engine selects the documents right into output, so a batch can
+    // fill one preallocated buffer without a vector per query.
+    size_t WriteTopDocuments(std::string_view raw_query, Document* output) const;
+
+    // Parses and validates the query and resolves its words once, for the
+    // FindTopDocuments overloads below. Throws std::invalid_argument as they would.
+    CompiledQuery CompileQuery(std::string_view raw_query) const;
+
+    template <typename DocumentPredicate, class ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const CompiledQuery& query, DocumentPredicate document_predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    template <class ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const CompiledQuery& query,
+        DocumentStatus status, size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    template <class ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const CompiledQuery& query) const;
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const CompiledQuery& query, DocumentPredicate document_predicate,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocuments(const CompiledQuery& query, DocumentStatus status,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::vector<Document> FindTopDocuments(const CompiledQuery& query) const;
+
+    // Searches on a thread of its own and returns at once. The scoring loops check
+    // the deadline between posting blocks; once it is reached, the search stops and
+    // the result holds the best documents scored so far. The server must outlive
+    // the search and must not be modified while it runs. Errors, such as an
+    // invalid query, are thrown by the future's get().
+    template <typename DocumentPredicate>
+    std::future<SearchResult> FindTopDocumentsAsync(std::string raw_query, DocumentPredicate document_predicate, SearchDeadline deadline,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::future<SearchResult> FindTopDocumentsAsync(std::string raw_query, DocumentStatus status, SearchDeadline deadline,
+        size_t max_result_count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    std::future<SearchResult> FindTopDocumentsAsync(std::string raw_query, SearchDeadline deadline) const;
+
+    // One page of what FindTopDocuments by status finds, however deep: pass a default
+    // cursor for the first page and the next_cursor of a page for the one after it.
+    // Every page scores the query anew, always exhaustively, but only the page_size
+    // documents ranking right after the cursor are selected; the other matches are
+    // never collected or sorted. Pages rank strictly by relevance and rating, both
+    // descending, then by id, so documents whose relevances differ by less than the
+    // tolerance of FindTopDocuments may come in another order than there.
+    // Throws std::invalid_argument for a cursor of another query or status, or one
+    // made before the index last changed.
+    SearchPage FindTopDocumentsPage(std::string_view raw_query, DocumentStatus status, const PageCursor& cursor,
+        size_t page_size = MAX_RESULT_DOCUMENT_COUNT) const;
+
+    SearchPage FindTopDocumentsPage(std::string_view raw_query, const PageCursor& cursor,
+        size_t page_size = MAX_RESULT_DOCUMENT_COUNT) const;
+
     std::tuple<std::vector<std::string_view>, DocumentStatus>MatchDocument(std::string_view raw_query, int document_id) const;
 
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::sequenced_policy&, std::string_view raw_query, int document_id) const;
 
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::execution::parallel_policy&, std::string_view raw_query, int document_id) const;
 
+    // Tombstones the document: the cost depends on its own words, not on the size of
+    // the index. Its postings are dropped later, when its segment is merged.
     void RemoveDocument(int document_id);
     void RemoveDocument(const std::execution::sequenced_policy&, int document_id);
     void RemoveDocument(const std::execution::parallel_policy&, int document_id);
 
-    const std::map<std::string, double>& GetWordFrequencies(int document_id) const;
+    // Removes the documents in one go: a snapshot is thawed once, and a segment is
+    // merged at most once, after all the tombstones are set. Unknown ids are skipped.
+    void RemoveDocuments(const std::vector<int>& document_ids);
+
+    // Calls visitor(document_index, term_id) for every word of every document, where
+    // document_index is the position of the document between begin() and end() and
+    // term ids number the words of the index, densely and for good. Under the
+    // parallel policy, ranges of documents go to different threads; the calls for
+    // one document all come from one thread, in no particular term order.
+    template <class ExecutionPolicy, typename Visitor>
+    void ForEachDocumentTerm(const ExecutionPolicy& policy, Visitor visitor) const;
+
+    const std::map<std::string, double, std::less<>>& GetWordFrequencies(int document_id) const;
+
+    // Caches the results of FindTopDocuments by status, keyed by the parsed query
+    // (plus and minus words sorted and de-duplicated, stop words dropped), the
+    // status, the result count and the retrieval mode. Every AddDocument and
+    // RemoveDocument invalidates what is cached. Calls with a predicate bypass the
+    // cache. 0 bytes (the default) disables it; any call drops what it holds.
+    void SetQueryCacheSize(size_t max_memory_bytes);
+
+    QueryCacheStatistics GetQueryCacheStatistics() const;
+
+    void SetRetrievalMode(RetrievalMode mode);
+
+    RetrievalMode GetRetrievalMode() const;
+
+    IndexMemoryUsage GetMemoryUsage() const;
+
+    // Writes the index to an immutable snapshot file. Throws std::runtime_error
+    // if the file cannot be written.
+    void SaveSnapshot(const std::string& path) const;
+
+    // Maps a snapshot file and serves queries straight from it: the dictionary and
+    // the postings are not parsed or copied, only small per-document metadata is.
+    // The first AddDocument or RemoveDocument copies the whole index into memory.
+    // Throws std::invalid_argument if the file is damaged or of another version. By
+    // default only the structure is checked, so loading does not read the postings;
+    // SnapshotVerification::CHECKSUM reads the whole file to catch any damage.
+    static SearchServer LoadSnapshot(const std::string& path, SnapshotVerification verification = SnapshotVerification::STRUCTURE);
 
 public:
     int GetDocumentCount() const;
 
+    // O(N) while removed ids are still in the id list; begin() or end() drops them.
     int GetDocumentId(int index) const;
 
     const std::vector<int>::iterator begin();
 
     const std::vector<int>::iterator end();
 private:
+    // Indexed by document ordinal. Ordinals are dense even when document ids are
+    // sparse, so per-document arrays (metadata, relevance scores) stay compact.
     struct DocumentData {
+        int id = 0;
         int rating = 0;
         DocumentStatus status = DocumentStatus::ACTUAL;
+        // Postings keep occurrence counts; for scoring, term frequency is
+        // count * inv_word_count. Quantized to float, which keeps this struct at 16 bytes.
+        float inv_word_count = 0.0f;
+    };
+
+    // IDF of a term, valid while generation equals the index generation.
+    // Queries refresh it lazily and may race to do so, but they all store the same value.
+    struct InverseDocumentFreqCache {
+        InverseDocumentFreqCache() = default;
+        InverseDocumentFreqCache(const InverseDocumentFreqCache& other);
+        InverseDocumentFreqCache& operator=(const InverseDocumentFreqCache& other);
+
+        std::atomic<uint64_t> generation{ 0 };
+        std::atomic<double> value{ 0.0 };
+    };
+
+    // Ordinals are handed out in AddDocument order, so indexing only appends to postings.
+    struct TermData {
+        PostingList postings;
+        mutable InverseDocumentFreqCache inverse_document_freq;
+        // Upper bound for MaxScore. Not lowered on removal: an overestimate only prunes less.
+        double max_term_freq = 0.0;
+        // Postings of tombstoned documents that no merge has dropped yet.
+        size_t deleted_posting_count = 0;
+    };
+
+    // Segments are fixed ranges of kSegmentSize ordinals. Ordinals only grow, so once
+    // a range is handed out nothing is appended to it again: every segment but the
+    // last is immutable apart from deletes, and the last one is the mutable segment.
+    // A delete sets the document's tombstone bit and notes its terms in its segment;
+    // merging the segment erases the tombstoned postings of just those terms.
+    struct Segment {
+        // Tombstones set since the last merge.
+        size_t pending_delete_count = 0;
+        // Terms of those documents, with repeats.
+        std::vector<uint32_t> dirty_terms;
+    };
+
+    // Position of one query word in its posting list, limited to an ordinal range.
+    struct TermCursor {
+        const PostingList* postings = nullptr;
+        PostingList::Cursor position;
+        // Postings in the range when the cursor was made.
+        size_t posting_count = 0;
+        double inverse_document_freq = 0.0;
+        double max_relevance = 0.0;
+        size_t query_index = 0;
+    };
+
+    // A document split into words and counted, not in the index yet.
+    struct ParsedDocument {
+        // Term frequencies, as GetWordFrequencies returns them.
+        std::map<std::string, double, std::less<>> word_freqs;
+        // Occurrences of every word, in word_freqs order.
+        std::vector<uint32_t> counts;
+        float inv_word_count = 0.0f;
     };
 
     struct QueryWord {
@@ -72,36 +290,206 @@ private:
         bool is_stop = false;
     };
 
+    // Words of the query text in the dictionary; the others cannot change the results.
     struct Query {
-        std::set<std::string_view> plus_words;
-        std::set<std::string_view> minus_words;
+        QueryTerms plus_terms;
+        QueryTerms minus_terms;
+    };
+
+    // The deadline of one search, shared by the threads that score it: once one of
+    // them finds it reached, all of them stop. A default one never stops.
+    class StopCondition {
+    public:
+        StopCondition() = default;
+
+        explicit StopCondition(const SearchDeadline* deadline)
+            : deadline_(deadline) {
+        }
+
+        bool ShouldStop() const {
+            if (deadline_ == nullptr) {
+                return false;
+            }
+            if (is_stopped_.load(std::memory_order_relaxed)) {
+                return true;
+            }
+            if (deadline_->IsReached()) {
+                is_stopped_.store(true, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        bool IsStopped() const {
+            return is_stopped_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        const SearchDeadline* deadline_ = nullptr;
+        mutable std::atomic<bool> is_stopped_{ false };
     };
 private:
     bool IsStopWord(const std::string_view& word) const;
 
     static bool IsValidWord(const std::string_view& word);
 
-    const std::vector<std::string_view> SplitIntoWordsNoStop(const std::string_view& text) const;
+    // Throws std::invalid_argument if a word holds a control character.
+    void SplitIntoWordsNoStop(std::string_view text, std::vector<std::string_view>& words) const;
 
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
-    Query ParseQuery(const std::string_view& text) const;
+    ParsedDocument ParseDocument(std::string_view text) const;
+
+    // Runs per-document and per-chunk work under the policy; the merge into the index is sequential.
+    template <class ExecutionPolicy>
+    void AddDocumentBatch(const ExecutionPolicy& policy, const std::vector<DocumentInput>& documents, size_t chunk_count);
+
+    // Words the dictionary does not have are dropped, unless they are kept with the
+    // id CompiledQuery::kUnknownTerm for CompileQuery.
+    Query ParseQuery(std::string_view text, bool keep_unknown_words = false) const;
+
+    // Throws std::invalid_argument for a query compiled by a server with a smaller dictionary
+    // or with other term numbers.
+    Query ResolveQuery(const CompiledQuery& compiled_query) const;
+
+    template <typename DocumentPredicate, class ExecutionPolicy>
+    std::vector<Document> FindTopDocumentsByPredicate(const ExecutionPolicy& policy, const Query& query, DocumentPredicate document_predicate,
+        size_t max_result_count, const StopCondition& stop_condition = StopCondition()) const;
+
+    // Results of a stopped search are not cached.
+    template <class ExecutionPolicy>
+    std::vector<Document> FindTopDocumentsByStatus(const ExecutionPolicy& policy, const Query& query, DocumentStatus status,
+        size_t max_result_count, const StopCondition& stop_condition = StopCondition()) const;
+
+    std::string MakeQueryCacheKey(const Query& query, DocumentStatus status, size_t max_result_count) const;
+
+    template <typename DocumentFilter>
+    SearchPage FindPage(const Query& query, DocumentFilter document_filter, const PageCursor& cursor, size_t page_size,
+        uint64_t query_hash) const;
+
+    // Identifies the query and status a page cursor belongs to.
+    static uint64_t HashPageQuery(const Query& query, DocumentStatus status);
 
     QueryWord ParseQueryWord(std::string_view text) const;
 
-    double ComputeWordInverseDocumentFreq(const std::string_view& word) const;
+    // CompiledQuery::kUnknownTerm if there is no such term.
+    uint32_t FindTermId(std::string_view word) const;
 
-    template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const;
+    // Unique within the process and random across processes.
+    static uint64_t MakeDictionaryId();
+
+    TermData& FindOrAddTerm(std::string_view word);
+
+    // Live documents containing the term: postings minus the ones awaiting a merge.
+    static size_t GetDocumentFreq(const TermData& term);
+
+    // Read for every posting a query scores, so defined here to be inlined.
+    bool IsDeleted(uint32_t ordinal) const {
+        return (tombstones_[ordinal / 64] >> (ordinal % 64)) & 1;
+    }
+
+    // Sizes the tombstones, status bitsets and segments to the ordinals handed out so far.
+    void ExtendSegments();
+
+    void SetStatusBit(uint32_t ordinal, DocumentStatus status, bool is_live);
+
+    // Looks up the term ids of the document's words.
+    std::vector<uint32_t> GetDocumentTermIds(int document_id) const;
+
+    // Returns the segment of the document, for MergeSegmentIfNeeded.
+    size_t TombstoneDocument(std::map<int, uint32_t>::iterator document_it, const std::vector<uint32_t>& term_ids);
+
+    void MergeSegmentIfNeeded(size_t segment_index);
+
+    void MergeSegment(size_t segment_index);
+
+    void DropRemovedDocumentIds();
+
+    // Copies what is still served from the snapshot into the containers below and drops it.
+    void ThawSnapshot();
+
+    double ComputeWordInverseDocumentFreq(const TermData& term) const;
+
+    template <typename DocumentFilter>
+    std::vector<Document> EvaluateQuery(const std::execution::sequenced_policy&, const Query& query, DocumentFilter document_filter,
+        size_t max_result_count, const StopCondition& stop_condition) const;
+
+    template <typename DocumentFilter>
+    std::vector<Document> EvaluateQuery(const std::execution::parallel_policy&, const Query& query, DocumentFilter document_filter,
+        size_t max_result_count, const StopCondition& stop_condition) const;
+
+    // Scores only the documents with ordinals in [begin_ordinal, end_ordinal),
+    // so disjoint ordinal ranges can be scored on different threads.
+    template <typename DocumentFilter>
+    void FindAllDocuments(const Query& query, DocumentFilter document_filter, RelevanceAccumulator& accumulator,
+        uint32_t begin_ordinal, uint32_t end_ordinal, const StopCondition& stop_condition) const;
+
+    template <typename DocumentFilter>
+    std::vector<Document> FindTopDocumentsMaxScore(const Query& query, DocumentFilter document_filter, size_t max_result_count,
+        uint32_t begin_ordinal, uint32_t end_ordinal, const StopCondition& stop_condition) const;
+
+    std::vector<TermCursor> MakeTermCursors(const QueryTerms& query_terms, uint32_t begin_ordinal, uint32_t end_ordinal) const;
+
+    static void PushTopDocument(std::vector<Document>& top_documents, const Document& document, size_t max_result_count);
+
+    // Same, for a heap of size documents in a buffer with room for max_result_count.
+    static void PushTopDocument(Document* top_documents, size_t& size, const Document& document, size_t max_result_count);
+
+    static bool IsMoreRelevant(const Document& lhs, const Document& rhs);
+
+    std::vector<Document> SelectTopDocuments(const RelevanceAccumulator& accumulator, size_t max_result_count) const;
+
+    // Same, into output with room for max_result_count documents; returns how many it wrote.
+    size_t SelectTopDocuments(const RelevanceAccumulator& accumulator, size_t max_result_count, Document* output) const;
+
+    // Strict order of the pages: no two documents tie.
+    static bool RanksBefore(const Document& lhs, const Document& rhs);
+
+    SearchPage SelectPage(const RelevanceAccumulator& accumulator, const PageCursor& cursor, size_t page_size, uint64_t query_hash) const;
 private:
     static constexpr double kLittleNumber = 1e-6;
+    // Below this many plus-word postings per shard a query is not worth splitting.
+    static constexpr size_t kMinPostingsPerShard = 1 << 14;
+    // Smaller AddDocuments chunks would repeat the same term lookups in the merge.
+    static constexpr size_t kMinDocumentsPerChunk = 1 << 10;
+    static constexpr uint32_t kSegmentSize = 1 << 12;
+    // Values of DocumentStatus.
+    static constexpr size_t kDocumentStatusCount = 4;
+    // A segment is merged once 1 / kMergeTombstoneRatio of its documents are unmerged tombstones.
+    static constexpr size_t kMergeTombstoneRatio = 4;
+    // MaxScore probes a posting array for its candidates instead of scanning it
+    // only when the array is this many times longer than the candidate list.
+    static constexpr size_t kPostingsPerProbe = 8;
 
 private:
-    const std::set<std::string> stop_words_;
-    std::map<std::string, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, std::map<std::string, double>> document_to_word_freqs_;
-    std::map<int, DocumentData> documents_;
+    // Transparent comparators let every lookup take a string_view as is,
+    // so query paths never build a temporary std::string.
+    const std::set<std::string, std::less<>> stop_words_;
+    std::map<std::string, uint32_t, std::less<>> term_ids_;
+    std::vector<TermData> terms_;
+    // Identifies the term numbering. Copies share it, since term ids are only ever appended;
+    // a snapshot keeps it only if the terms are already numbered in word order.
+    uint64_t dictionary_id_ = MakeDictionaryId();
+    std::map<int, std::map<std::string, double, std::less<>>> document_to_word_freqs_;
+    std::map<int, uint32_t> document_ordinals_;
+    std::vector<DocumentData> document_data_;
+    // One bit per ordinal. Bits stay set after a merge: ordinals are never reused.
+    std::vector<uint64_t> tombstones_;
+    // Per status, one bit per ordinal, set while the document is live.
+    std::vector<uint64_t> status_documents_[kDocumentStatusCount];
+    std::vector<Segment> segments_;
+    // Live ids in ordinal order, plus removed ones while are_document_ids_stale_ is set.
     std::vector<int> document_ids_;
+    bool are_document_ids_stale_ = false;
+    // Set while the index is served from a snapshot. Terms are then looked up there
+    // and terms_ is indexed the same way; term_ids_ and document_to_word_freqs_ stay
+    // empty. Copies of the server share the mapping.
+    std::shared_ptr<const IndexSnapshot> snapshot_;
+    RetrievalMode retrieval_mode_ = RetrievalMode::EXHAUSTIVE;
+    mutable QueryCache query_cache_;
+    // Bumped by every AddDocument and RemoveDocument; the term IDF caches compare against it.
+    // Starts above zero so that a fresh cache entry is always stale.
+    uint64_t index_generation_ = 1;
 };
 
 template <typename StringContainer>
@@ -114,31 +502,16 @@ SearchServer::SearchServer(const StringContainer& stop_words)
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query, DocumentPredicate document_predicate) const {
-    Query query;
-    query = ParseQuery(raw_query);
-    auto matched_documents = FindAllDocuments(query, document_predicate);
-    sort(matched_documents.begin(), matched_documents.end(), [this](const Document& lhs, const Document& rhs) {
-        if (std::abs(lhs.relevance - rhs.relevance) < kLittleNumber) {
-            return lhs.rating > rhs.rating;
-        }
-        else {
-            return lhs.relevance > rhs.relevance;
-        }
-        });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
-    }
-    return matched_documents;
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view& raw_query, DocumentPredicate document_predicate,
+    size_t max_result_count) const {
+    return FindTopDocuments(std::execution::seq, raw_query, document_predicate, max_result_count);
 }
 
 template<class ExecutionPolicy>
-std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentStatus status) const
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentStatus status,
+    size_t max_result_count) const
 {
-    return FindTopDocuments(policy, raw_query, [status](int document_id, DocumentStatus document_status, int rating)
-        {
-            return document_status == status;
-        });
+    return FindTopDocumentsByStatus(policy, ParseQuery(raw_query), status, max_result_count);
 }
 
 template<class ExecutionPolicy>
@@ -147,54 +520,396 @@ std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, c
 }
 
 template <typename DocumentPredicate, class ExecutionPolicy>
-std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view& raw_query, DocumentPredicate document_predicate) const {
-    const Query query = ParseQuery(raw_query);
-    auto matched_documents = FindAllDocuments(query, document_predicate);
-    sort(policy, matched_documents.begin(), matched_documents.end(), [this](const Document& lhs, const Document& rhs) {
-            if (std::abs(lhs.relevance - rhs.relevance) < kLittleNumber) {
-                return lhs.rating > rhs.rating;
-            }
-            else {
-                return lhs.relevance > rhs.relevance;
-            }
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view& raw_query, DocumentPredicate document_predicate,
+    size_t max_result_count) const {
+    return FindTopDocumentsByPredicate(policy, ParseQuery(raw_query), document_predicate, max_result_count);
+}
+
+template <typename DocumentPredicate, class ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const CompiledQuery& query, DocumentPredicate document_predicate,
+    size_t max_result_count) const {
+    return FindTopDocumentsByPredicate(policy, ResolveQuery(query), document_predicate, max_result_count);
+}
+
+template <class ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const CompiledQuery& query, DocumentStatus status,
+    size_t max_result_count) const {
+    return FindTopDocumentsByStatus(policy, ResolveQuery(query), status, max_result_count);
+}
+
+template <class ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const CompiledQuery& query) const {
+    return FindTopDocuments(policy, query, DocumentStatus::ACTUAL);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const CompiledQuery& query, DocumentPredicate document_predicate,
+    size_t max_result_count) const {
+    return FindTopDocuments(std::execution::seq, query, document_predicate, max_result_count);
+}
+
+template <class ExecutionPolicy, typename Visitor>
+void SearchServer::ForEachDocumentTerm(const ExecutionPolicy& policy, Visitor visitor) const {
+    std::vector<uint32_t> document_indexes(document_data_.size());
+    uint32_t document_count = 0;
+    for (uint32_t ordinal = 0; ordinal < document_data_.size(); ++ordinal) {
+        document_indexes[ordinal] = document_count;
+        document_count += IsDeleted(ordinal) ? 0 : 1;
+    }
+    size_t shard_count = 1;
+    if constexpr (std::is_same_v<std::decay_t<ExecutionPolicy>, std::execution::parallel_policy>) {
+        const size_t max_shard_count = std::max(1u, std::thread::hardware_concurrency()) * 2;
+        shard_count = std::clamp<size_t>(document_data_.size() / kSegmentSize, 1, max_shard_count);
+    }
+    // Every shard walks all the posting lists, each within its own ordinal range.
+    const uint64_t ordinal_count = document_data_.size();
+    std::vector<size_t> shards(shard_count);
+    std::iota(shards.begin(), shards.end(), 0);
+    std::for_each(policy, shards.begin(), shards.end(), [&](size_t shard) {
+        const auto begin_ordinal = static_cast<uint32_t>(ordinal_count * shard / shard_count);
+        const auto end_ordinal = static_cast<uint32_t>(ordinal_count * (shard + 1) / shard_count);
+        for (uint32_t term_id = 0; term_id < terms_.size(); ++term_id) {
+            terms_[term_id].postings.ForEach(begin_ordinal, end_ordinal, [&](uint32_t ordinal, uint32_t) {
+                if (!IsDeleted(ordinal)) {
+                    visitor(document_indexes[ordinal], term_id);
+                }
+                });
+        }
+        });
+}
+
+template <typename DocumentPredicate>
+std::future<SearchResult> SearchServer::FindTopDocumentsAsync(std::string raw_query, DocumentPredicate document_predicate, SearchDeadline deadline,
+    size_t max_result_count) const {
+    return std::async(std::launch::async, [this, raw_query = std::move(raw_query), document_predicate = std::move(document_predicate),
+        deadline = std::move(deadline), max_result_count] {
+        const StopCondition stop_condition(&deadline);
+        SearchResult result;
+        result.documents = FindTopDocumentsByPredicate(std::execution::seq, ParseQuery(raw_query), document_predicate, max_result_count,
+            stop_condition);
+        result.is_complete = !stop_condition.IsStopped();
+        if (!result.is_complete) {
+            METRICS_COUNT(MetricCounter::STOPPED_SEARCHES, 1);
+        }
+        return result;
         });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+}
+
+// Predicates see the document metadata, so every posting reads its DocumentData.
+template <typename DocumentPredicate, class ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocumentsByPredicate(const ExecutionPolicy& policy, const Query& query,
+    DocumentPredicate document_predicate, size_t max_result_count, const StopCondition& stop_condition) const {
+    const auto predicate_filter = [this, &document_predicate](uint32_t ordinal) {
+        const DocumentData& document_data = document_data_[ordinal];
+        return !IsDeleted(ordinal) && document_predicate(document_data.id, document_data.status, document_data.rating);
+    };
+    return EvaluateQuery(policy, query, predicate_filter, max_result_count, stop_condition);
+}
+
+// A status filter is a single bit test: the status bitset already leaves out
+// removed documents, and documents of other statuses are never scored.
+template <class ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocumentsByStatus(const ExecutionPolicy& policy, const Query& query, DocumentStatus status,
+    size_t max_result_count, const StopCondition& stop_condition) const {
+    const auto status_index = static_cast<size_t>(status);
+    if (status_index >= kDocumentStatusCount) {
+        return FindTopDocumentsByPredicate(policy, query, [status](int, DocumentStatus document_status, int) {
+            return document_status == status;
+            }, max_result_count, stop_condition);
+    }
+    const uint64_t* status_bits = status_documents_[status_index].data();
+    const auto status_filter = [status_bits](uint32_t ordinal) {
+        return (status_bits[ordinal / 64] >> (ordinal % 64)) & 1;
+    };
+    if (!query_cache_.IsEnabled()) {
+        return EvaluateQuery(policy, query, status_filter, max_result_count, stop_condition);
+    }
+    std::string key = MakeQueryCacheKey(query, status, max_result_count);
+    std::vector<Document> documents;
+    if (!query_cache_.Find(key, index_generation_, documents)) {
+        documents = EvaluateQuery(policy, query, status_filter, max_result_count, stop_condition);
+        if (!stop_condition.IsStopped()) {
+            query_cache_.Insert(std::move(key), index_generation_, documents);
+        }
+    }
+    return documents;
+}
+
+template <typename DocumentFilter>
+SearchPage SearchServer::FindPage(const Query& query, DocumentFilter document_filter, const PageCursor& cursor, size_t page_size,
+    uint64_t query_hash) const {
+    METRICS_COUNT(MetricCounter::SEARCHES, 1);
+    RelevanceAccumulator& accumulator = RelevanceAccumulator::ForCurrentThread();
+    FindAllDocuments(query, document_filter, accumulator, 0, static_cast<uint32_t>(document_data_.size()), StopCondition());
+    return SelectPage(accumulator, cursor, page_size, query_hash);
+}
+
+template <typename DocumentFilter>
+std::vector<Document> SearchServer::EvaluateQuery(const std::execution::sequenced_policy&, const Query& query, DocumentFilter document_filter,
+    size_t max_result_count, const StopCondition& stop_condition) const {
+    METRICS_COUNT(MetricCounter::SEARCHES, 1);
+    const auto ordinal_count = static_cast<uint32_t>(document_data_.size());
+    if (retrieval_mode_ == RetrievalMode::MAX_SCORE) {
+        return FindTopDocumentsMaxScore(query, document_filter, max_result_count, 0, ordinal_count, stop_condition);
     }
+    RelevanceAccumulator& accumulator = RelevanceAccumulator::ForCurrentThread();
+    FindAllDocuments(query, document_filter, accumulator, 0, ordinal_count, stop_condition);
+    return SelectTopDocuments(accumulator, max_result_count);
+}
+
+// Splits the ordinal space into shards, scores every shard with the accumulator of
+// whichever thread picks it up and merges the per-shard top-K. Each document is
+// scored by exactly one shard, adding plus-words in the same order as the
+// sequential engine, so relevance values are bit-identical.
+template <typename DocumentFilter>
+std::vector<Document> SearchServer::EvaluateQuery(const std::execution::parallel_policy&, const Query& query, DocumentFilter document_filter,
+    size_t max_result_count, const StopCondition& stop_condition) const {
+    size_t posting_count = 0;
+    for (const QueryTerms::Term& query_term : query.plus_terms) {
+        posting_count += terms_[query_term.id].postings.GetSize();
+    }
+    const size_t max_shard_count = std::max(1u, std::thread::hardware_concurrency()) * 2;
+    const size_t shard_count = std::min(posting_count / kMinPostingsPerShard, max_shard_count);
+    if (shard_count < 2) {
+        return EvaluateQuery(std::execution::seq, query, document_filter, max_result_count, stop_condition);
+    }
+    METRICS_COUNT(MetricCounter::SEARCHES, 1);
+
+    const uint64_t ordinal_count = document_data_.size();
+    std::vector<std::vector<Document>> shard_documents(shard_count);
+    std::vector<size_t> shards(shard_count);
+    std::iota(shards.begin(), shards.end(), 0);
+    std::for_each(std::execution::par, shards.begin(), shards.end(), [&](size_t shard) {
+        const auto begin_ordinal = static_cast<uint32_t>(ordinal_count * shard / shard_count);
+        const auto end_ordinal = static_cast<uint32_t>(ordinal_count * (shard + 1) / shard_count);
+        if (retrieval_mode_ == RetrievalMode::MAX_SCORE) {
+            shard_documents[shard] = FindTopDocumentsMaxScore(query, document_filter, max_result_count, begin_ordinal, end_ordinal,
+                stop_condition);
+            return;
+        }
+        RelevanceAccumulator& accumulator = RelevanceAccumulator::ForCurrentThread();
+        FindAllDocuments(query, document_filter, accumulator, begin_ordinal, end_ordinal, stop_condition);
+        shard_documents[shard] = SelectTopDocuments(accumulator, max_result_count);
+        });
+
+    METRICS_STAGE_TIMER(MetricStage::TOP_K_SELECTION);
+    std::vector<Document> matched_documents;
+    for (const std::vector<Document>& documents : shard_documents) {
+        matched_documents.insert(matched_documents.end(), documents.begin(), documents.end());
+    }
+    const size_t result_count = std::min(max_result_count, matched_documents.size());
+    std::partial_sort(matched_documents.begin(), matched_documents.begin() + result_count, matched_documents.end(), IsMoreRelevant);
+    matched_documents.resize(result_count);
     return matched_documents;
 }
 
-template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
-    for (const std::string_view& word : query.plus_words) {
-        std::string temp{ word };
-        if (word_to_document_freqs_.count(temp) == 0) {
+// Minus-words go first: their postings mark documents excluded in the accumulator,
+// and plus-word postings of excluded documents are skipped before the filter runs.
+// A search stopped among the minus-words scores nothing, so what a stopped search
+// has scored never includes a document with a minus-word.
+template <typename DocumentFilter>
+void SearchServer::FindAllDocuments(const Query& query, DocumentFilter document_filter, RelevanceAccumulator& accumulator,
+    uint32_t begin_ordinal, uint32_t end_ordinal, const StopCondition& stop_condition) const {
+    accumulator.Reset(document_data_.size());
+    const auto should_stop = [&stop_condition] {
+        return stop_condition.ShouldStop();
+    };
+    if (!query.minus_terms.empty()) {
+        METRICS_STAGE_TIMER(MetricStage::MINUS_WORDS);
+        for (const QueryTerms::Term& query_term : query.minus_terms) {
+            const bool is_done = terms_[query_term.id].postings.ForEachUntil(begin_ordinal, end_ordinal, should_stop,
+                [&accumulator](uint32_t ordinal, uint32_t /*count*/) {
+                    accumulator.Exclude(ordinal);
+                });
+            if (!is_done) {
+                return;
+            }
+        }
+    }
+
+    METRICS_STAGE_TIMER(MetricStage::POSTING_TRAVERSAL);
+    const bool has_minus_words = !query.minus_terms.empty();
+    for (const QueryTerms::Term& query_term : query.plus_terms) {
+        const TermData& term = terms_[query_term.id];
+        if (GetDocumentFreq(term) == 0) {
             continue;
         }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(temp)) {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
+        const double inverse_document_freq = ComputeWordInverseDocumentFreq(term);
+        const bool is_done = term.postings.ForEachUntil(begin_ordinal, end_ordinal, should_stop, [&](uint32_t ordinal, uint32_t count) {
+            if ((!has_minus_words || !accumulator.IsExcluded(ordinal)) && document_filter(ordinal)) {
+                accumulator.Add(ordinal, count * document_data_[ordinal].inv_word_count * inverse_document_freq);
             }
+            });
+        if (!is_done) {
+            return;
         }
     }
+}
 
-    for (const std::string_view& word : query.minus_words) {
-        std::string temp{ word };
-        if (word_to_document_freqs_.count(temp) == 0) {
-            continue;
+// MaxScore, term at a time. Plus-words are scored from the highest upper bound
+// down. The lowest partial relevance among any K scored documents (the
+// "champions") is a lower bound of the final top-K threshold; once the bounds of
+// the words still to go add up to less than it, a document not scored yet cannot
+// enter the top-K. From then on the remaining posting arrays are only probed for
+// the surviving candidates instead of being scanned, and candidates that can no
+// longer make it are dropped.
+// A stopped search ranks the candidates it has, with their relevance recomputed in full.
+template <typename DocumentFilter>
+std::vector<Document> SearchServer::FindTopDocumentsMaxScore(const Query& query, DocumentFilter document_filter, size_t max_result_count,
+    uint32_t begin_ordinal, uint32_t end_ordinal, const StopCondition& stop_condition) const {
+    std::vector<TermCursor> cursors = MakeTermCursors(query.plus_terms, begin_ordinal, end_ordinal);
+    if (max_result_count == 0 || cursors.empty()) {
+        return {};
+    }
+    std::sort(cursors.begin(), cursors.end(), [](const TermCursor& lhs, const TermCursor& rhs) {
+        return lhs.max_relevance > rhs.max_relevance;
+        });
+    std::vector<double> remaining_bounds(cursors.size() + 1, 0.0);
+    for (size_t i = cursors.size(); i-- > 0;) {
+        remaining_bounds[i] = remaining_bounds[i + 1] + cursors[i].max_relevance;
+    }
+
+    RelevanceAccumulator& accumulator = RelevanceAccumulator::ForCurrentThread();
+    accumulator.Reset(document_data_.size());
+    const auto should_stop = [&stop_condition] {
+        return stop_condition.ShouldStop();
+    };
+    // Minus-words go first, so excluded documents never raise the threshold.
+    if (!query.minus_terms.empty()) {
+        METRICS_STAGE_TIMER(MetricStage::MINUS_WORDS);
+        for (const TermCursor& cursor : MakeTermCursors(query.minus_terms, begin_ordinal, end_ordinal)) {
+            const bool is_done = cursor.postings->ForEachUntil(begin_ordinal, end_ordinal, should_stop,
+                [&accumulator](uint32_t ordinal, uint32_t /*count*/) {
+                    accumulator.Exclude(ordinal);
+                });
+            if (!is_done) {
+                return {};
+            }
         }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(temp)) {
-            document_to_relevance.erase(document_id);
+    }
+
+    std::vector<uint32_t> candidates;
+    {
+        METRICS_STAGE_TIMER(MetricStage::POSTING_TRAVERSAL);
+        // A document can only displace the worst of the top-K if its relevance is above
+        // threshold - kLittleNumber (the tolerance of IsMoreRelevant); keep one more
+        // kLittleNumber of slack for rounding in the bound sums.
+        double threshold = -std::numeric_limits<double>::infinity();
+        std::vector<uint32_t> champions;
+        champions.reserve(max_result_count);
+        double champion_floor = -std::numeric_limits<double>::infinity();
+        const auto update_champions = [&](uint32_t ordinal, double relevance) {
+            if (champions.size() == max_result_count && relevance <= champion_floor) {
+                return;
+            }
+            const auto it = std::find(champions.begin(), champions.end(), ordinal);
+            if (it == champions.end()) {
+                if (champions.size() < max_result_count) {
+                    champions.push_back(ordinal);
+                }
+                else {
+                    *std::min_element(champions.begin(), champions.end(), [&accumulator](uint32_t lhs, uint32_t rhs) {
+                        return accumulator.GetRelevance(lhs) < accumulator.GetRelevance(rhs);
+                        }) = ordinal;
+                }
+            }
+            if (champions.size() == max_result_count) {
+                champion_floor = accumulator.GetRelevance(champions[0]);
+                for (const uint32_t champion : champions) {
+                    champion_floor = std::min(champion_floor, accumulator.GetRelevance(champion));
+                }
+                threshold = champion_floor - 2 * kLittleNumber;
+            }
+        };
+
+        // An excluded document must not reach update_champions: its relevance slot is stale.
+        size_t term = 0;
+        for (; term < cursors.size() && remaining_bounds[term] >= threshold && !stop_condition.IsStopped(); ++term) {
+            const double inverse_document_freq = cursors[term].inverse_document_freq;
+            cursors[term].postings->ForEachUntil(begin_ordinal, end_ordinal, should_stop, [&](uint32_t ordinal, uint32_t count) {
+                if (!accumulator.IsExcluded(ordinal) && document_filter(ordinal)) {
+                    update_champions(ordinal, accumulator.Add(ordinal, count * document_data_[ordinal].inv_word_count * inverse_document_freq));
+                }
+                });
+        }
+
+        // Every scored document already passed the filter. After a stop in the middle of
+        // a word the bounds no longer hold, so every scored document stays a candidate.
+        const bool is_stopped = stop_condition.IsStopped();
+        for (const uint32_t ordinal : accumulator.GetTouched()) {
+            if (accumulator.IsActive(ordinal) && (is_stopped || accumulator.GetRelevance(ordinal) + remaining_bounds[term] >= threshold)) {
+                candidates.push_back(ordinal);
+            }
+        }
+        // Dropped candidates are excluded, so from here on "active" means "candidate".
+        bool are_candidates_sorted = false;
+        for (; term < cursors.size() && !candidates.empty() && !stop_condition.IsStopped(); ++term) {
+            TermCursor& cursor = cursors[term];
+            if (cursor.posting_count < candidates.size() * kPostingsPerProbe) {
+                cursor.postings->ForEachUntil(begin_ordinal, end_ordinal, should_stop, [&](uint32_t ordinal, uint32_t count) {
+                    if (accumulator.IsActive(ordinal)) {
+                        update_champions(ordinal, accumulator.Add(ordinal,
+                            count * document_data_[ordinal].inv_word_count * cursor.inverse_document_freq));
+                    }
+                    });
+            }
+            else {
+                if (!are_candidates_sorted) {
+                    std::sort(candidates.begin(), candidates.end());
+                    are_candidates_sorted = true;
+                }
+                for (size_t i = 0; i < candidates.size(); ++i) {
+                    if (i % PostingList::kBlockSize == 0 && should_stop()) {
+                        break;
+                    }
+                    const uint32_t ordinal = candidates[i];
+                    if (cursor.position.SeekTo(ordinal)) {
+                        update_champions(ordinal, accumulator.Add(ordinal,
+                            cursor.position.GetCount() * document_data_[ordinal].inv_word_count * cursor.inverse_document_freq));
+                    }
+                }
+            }
+            // The bounds do not hold for a word scored in part.
+            if (stop_condition.IsStopped()) {
+                break;
+            }
+            size_t kept = 0;
+            for (const uint32_t ordinal : candidates) {
+                if (accumulator.GetRelevance(ordinal) + remaining_bounds[term + 1] >= threshold) {
+                    candidates[kept++] = ordinal;
+                }
+                else {
+                    accumulator.Exclude(ordinal);
+                }
+            }
+            candidates.resize(kept);
         }
     }
 
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance) {
-        matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
+    METRICS_STAGE_TIMER(MetricStage::TOP_K_SELECTION);
+    std::vector<Document> top_documents;
+    top_documents.reserve(std::min(max_result_count, candidates.size()));
+    for (const uint32_t ordinal : candidates) {
+        const DocumentData& document_data = document_data_[ordinal];
+        PushTopDocument(top_documents, { document_data.id, accumulator.GetRelevance(ordinal), document_data.rating }, max_result_count);
     }
-    return matched_documents;
-}
 
+    // Words were added in bound order; recompute the winners' relevance in query
+    // word order so that it is bit-identical to the exhaustive engine.
+    std::sort(cursors.begin(), cursors.end(), [](const TermCursor& lhs, const TermCursor& rhs) {
+        return lhs.query_index < rhs.query_index;
+        });
+    for (Document& document : top_documents) {
+        const uint32_t ordinal = document_ordinals_.at(document.id);
+        const float inv_word_count = document_data_[ordinal].inv_word_count;
+        double relevance = 0.0;
+        for (const TermCursor& cursor : cursors) {
+            if (const uint32_t count = cursor.postings->GetCount(ordinal)) {
+                relevance += count * inv_word_count * cursor.inverse_document_freq;
+            }
+        }
+        document.relevance = relevance;
+    }
+    std::sort(top_documents.begin(), top_documents.end(), IsMoreRelevant);
+    return top_documents;
+}
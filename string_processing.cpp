@@ -2,6 +2,113 @@
 #include <string>
 #include <iostream>
 #include <algorithm>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SPLIT_INTO_WORDS_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+    uint32_t CountTrailingZeros(uint32_t mask) {
+#ifdef _MSC_VER
+        unsigned long index = 0;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    bool IsControlCharacter(char c) {
+        return static_cast<unsigned char>(c) < ' ';
+    }
+
+    // Walks the text a chunk at a time. Each chunk yields two bit masks, one bit per
+    // byte: bytes that belong to words and control characters. A word starts or ends
+    // wherever the word bit differs from the one before it, so the words of a chunk
+    // come from its transition bits; a chunk with no spaces has none to walk.
+    class WordSplitter {
+    public:
+        WordSplitter(std::string_view str, std::vector<std::string_view>& words)
+            : str_(str)
+            , words_(words) {
+        }
+
+        bool Split() {
+            size_t position = 0;
+#if defined(__AVX2__)
+            const __m256i spaces = _mm256_set1_epi8(' ');
+            const __m256i last_control = _mm256_set1_epi8(' ' - 1);
+            for (; position + 32 <= str_.size(); position += 32) {
+                const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(str_.data() + position));
+                const auto space_mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, spaces)));
+                // Unsigned c <= 31 exactly when min(c, 31) == c.
+                const __m256i controls = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, last_control), chunk);
+                has_control_ |= _mm256_movemask_epi8(controls) != 0;
+                AddChunk(position, ~space_mask, 32);
+            }
+#elif defined(SPLIT_INTO_WORDS_SSE2)
+            const __m128i spaces = _mm_set1_epi8(' ');
+            const __m128i last_control = _mm_set1_epi8(' ' - 1);
+            for (; position + 16 <= str_.size(); position += 16) {
+                const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str_.data() + position));
+                const auto space_mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, spaces)));
+                const __m128i controls = _mm_cmpeq_epi8(_mm_min_epu8(chunk, last_control), chunk);
+                has_control_ |= _mm_movemask_epi8(controls) != 0;
+                AddChunk(position, ~space_mask & 0xFFFF, 16);
+            }
+#endif
+            for (; position < str_.size(); ++position) {
+                const char c = str_[position];
+                has_control_ |= IsControlCharacter(c);
+                const uint32_t word_bit = c != ' ';
+                if (word_bit != previous_word_bit_) {
+                    AddBoundary(position);
+                }
+                previous_word_bit_ = word_bit;
+            }
+            if (word_begin_ != std::string_view::npos) {
+                words_.push_back(str_.substr(word_begin_));
+            }
+            return !has_control_;
+        }
+
+    private:
+        // word_mask holds one bit per byte of the chunk, starting at position.
+        void AddChunk(size_t position, uint32_t word_mask, uint32_t width) {
+            const uint32_t width_mask = width == 32 ? ~uint32_t{ 0 } : (uint32_t{ 1 } << width) - 1;
+            uint32_t transitions = (word_mask ^ ((word_mask << 1) | previous_word_bit_)) & width_mask;
+            previous_word_bit_ = (word_mask >> (width - 1)) & 1;
+            while (transitions != 0) {
+                AddBoundary(position + CountTrailingZeros(transitions));
+                transitions &= transitions - 1;
+            }
+        }
+
+        void AddBoundary(size_t boundary) {
+            if (word_begin_ == std::string_view::npos) {
+                word_begin_ = boundary;
+            }
+            else {
+                words_.push_back(str_.substr(word_begin_, boundary - word_begin_));
+                word_begin_ = std::string_view::npos;
+            }
+        }
+
+        std::string_view str_;
+        std::vector<std::string_view>& words_;
+        size_t word_begin_ = std::string_view::npos;
+        uint32_t previous_word_bit_ = 0;
+        bool has_control_ = false;
+    };
+}
 
 std::vector<std::string> SplitIntoWords(const std::string& text) {
     std::vector<std::string> words;
@@ -26,17 +133,11 @@ std::vector<std::string> SplitIntoWords(const std::string& text) {
 std::vector<std::string_view> SplitIntoWords(std::string_view str)
 {
     std::vector<std::string_view> words;
-    int pos = 0;
-    size_t pos_end = str.npos;
-    while (true) {
-        int space = str.find(' ', pos);
-        words.push_back(space == pos_end ? str.substr(pos) : str.substr(pos, space - pos));
-        if (space == pos_end) {
-            break;
-        }
-        else {
-            pos = space + 1;
-        }
-    }
+    SplitIntoWords(str, words);
     return words;
-}
\ No newline at end of file
+}
+
+bool SplitIntoWords(std::string_view str, std::vector<std::string_view>& words) {
+    words.clear();
+    return WordSplitter(str, words).Split();
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <set>
 #include <stdexcept>
@@ -8,9 +9,15 @@
 std::vector<std::string> SplitIntoWords(const std::string& text);
 std::vector<std::string_view> SplitIntoWords(std::string_view str);
 
+// Replaces the contents of words with the words of str: runs of characters between
+// spaces, never empty. Passing the same vector again reuses its capacity. The same
+// pass looks for control characters (codes 0 to 31); returns false if there are any,
+// after splitting the text all the same.
+bool SplitIntoWords(std::string_view str, std::vector<std::string_view>& words);
+
 template <typename StringContainer>
-std::set<std::string> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
-    std::set<std::string> non_empty_strings;
+std::set<std::string, std::less<>> MakeUniqueNonEmptyStrings(const StringContainer& strings) {
+    std::set<std::string, std::less<>> non_empty_strings;
     for (const std::string& str : strings) {
         if (!str.empty()) {
             non_empty_strings.insert(str);
@@ -0,0 +1,33 @@
+#include "test_example_functions.h"
+
+#include <cstdlib>
+#include <new>
+
+// Replacing the global allocation functions affects the whole program, so this file
+// belongs to the test binary only. Keeping the replacements out of the files that
+// allocate also keeps the compiler from pairing inlined new/delete calls with malloc/free.
+
+namespace {
+    // Allocations made by the current thread, counted by the replaced global operator new.
+    thread_local size_t allocation_count = 0;
+}
+
+void* operator new(std::size_t size) {
+    ++allocation_count;
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+size_t GetAllocationCount() {
+    return allocation_count;
+}
@@ -1,5 +1,33 @@
 #include "test_example_functions.h"
+#include "benchmark_functions.h"
+#include "concurrent_search_server.h"
+#include "document_loader.h"
+#include "process_queries.h"
+#include "query_executor.h"
+#include "remove_duplicates.h"
+#include "request_queue.h"
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+namespace {
+    // A path in the system temporary directory that no other test run uses.
+    std::string MakeTemporaryPath(const std::string& name) {
+        static std::atomic<unsigned> sequence = 0;
+        const std::string unique = std::to_string(std::random_device()()) + "_"s + std::to_string(sequence++);
+        return (std::filesystem::temp_directory_path() / ("search_server_"s + unique + "_"s + name)).string();
+    }
+}
 
 void AssertImpl(bool value, const std::string& expr_str, const std::string& file, const std::string& func, unsigned line,
     const std::string& hint) {
@@ -87,7 +115,7 @@ void TestSortByRelevance()
     const auto docs = search_server.FindTopDocuments("  ");
 
     for (size_t i = 0; i < docs.size(); i++)
-        if (i - 1 > 0)
+        if (i > 0)
         {
             ASSERT(docs[i - 1].relevance >= docs[i].relevance);
         }
@@ -132,7 +160,7 @@ void TestRelevanceFind() {
     SearchServer search_server("cvb"s);
     std::string_view str1 = "    ";
     std::string_view str2 = "   ";
-    std::string_view str3 = "    "s;
+    std::string_view str3 = "    ";
     search_server.AddDocument(0, str1, DocumentStatus::ACTUAL, { 8, -3 });
     search_server.AddDocument(1, str2, DocumentStatus::ACTUAL, { 7, 2, 7 });
     search_server.AddDocument(2, str3, DocumentStatus::ACTUAL, { 5, -12, 2, 1 });
@@ -167,6 +195,1540 @@ void TestRelevanceFind() {
     ASSERT(abs(document_to_relevance[0] - docs[1].relevance) < kSubtractionDiff);
 }
 
+void TestRemoveDocument() {
+    SearchServer search_server("and"s);
+    search_server.AddDocument(5, "white cat and fancy collar", DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(1, "fluffy cat fluffy tail", DocumentStatus::ACTUAL, { 2 });
+    search_server.AddDocument(3, "groomed dog expressive eyes", DocumentStatus::ACTUAL, { 3 });
+    ASSERT_EQUAL(search_server.FindTopDocuments("cat").size(), 2u);
+
+    search_server.RemoveDocument(5);
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 2);
+    const auto docs = search_server.FindTopDocuments("cat");
+    ASSERT_EQUAL(docs.size(), 1u);
+    ASSERT_EQUAL(docs[0].id, 1);
+
+    search_server.RemoveDocument(std::execution::par, 1);
+    ASSERT(search_server.FindTopDocuments("cat fluffy").empty());
+    ASSERT(search_server.GetWordFrequencies(1).empty());
+
+    search_server.AddDocument(5, "white cat", DocumentStatus::ACTUAL, { 4 });
+    const auto [words, status] = search_server.MatchDocument("cat dog", 5);
+    ASSERT_EQUAL(words.size(), 1u);
+    ASSERT_EQUAL(words[0], "cat");
+}
+
+void TestQueryLookupsDoNotAllocate() {
+    // Same index layout twice: short words fit into the std::string small buffer,
+    // long ones do not. Any temporary string built from a query word would make
+    // the long-word server allocate more.
+    const std::string long_prefix = "extraordinarily_long_prefix_";
+    SearchServer short_server("and"s);
+    SearchServer long_server("and"s);
+    const std::vector<std::string> words = { "cat", "dog", "bird", "tail" };
+    for (int id = 0; id < 8; ++id) {
+        const std::string& first = words[id % words.size()];
+        const std::string& second = words[(id + 1) % words.size()];
+        short_server.AddDocument(id, first + " and " + second, DocumentStatus::ACTUAL, { id });
+        long_server.AddDocument(id, long_prefix + first + " and " + long_prefix + second, DocumentStatus::ACTUAL, { id });
+    }
+    const std::string short_query = "cat dog and -bird fish";
+    const std::string long_query = long_prefix + "cat " + long_prefix + "dog and -" + long_prefix + "bird " + long_prefix + "fish";
+
+    // Warm up the per-thread scoring buffers first.
+    short_server.FindTopDocuments(short_query);
+    long_server.FindTopDocuments(long_query);
+
+    const size_t before_short = GetAllocationCount();
+    const auto short_docs = short_server.FindTopDocuments(short_query);
+    const size_t short_allocations = GetAllocationCount() - before_short;
+
+    const size_t before_long = GetAllocationCount();
+    const auto long_docs = long_server.FindTopDocuments(long_query);
+    const size_t long_allocations = GetAllocationCount() - before_long;
+
+    ASSERT_EQUAL(short_docs.size(), long_docs.size());
+    ASSERT_EQUAL_HINT(short_allocations, long_allocations, "Query lookups must not copy words into std::string"s);
+    // A warm query allocates nothing but its result vector.
+    ASSERT_HINT(short_allocations <= 1, "A warm FindTopDocuments must allocate only the result"s);
+    ASSERT_HINT(long_allocations <= 1, "A warm FindTopDocuments must allocate only the result"s);
+
+    const size_t before_match = GetAllocationCount();
+    const auto [matched_words, status] = long_server.MatchDocument(long_query, 0);
+    const size_t match_allocations = GetAllocationCount() - before_match;
+    const size_t before_short_match = GetAllocationCount();
+    short_server.MatchDocument(short_query, 0);
+    const size_t short_match_allocations = GetAllocationCount() - before_short_match;
+    ASSERT_EQUAL(match_allocations, short_match_allocations);
+    ASSERT_EQUAL(matched_words.size(), 2u);
+}
+
+void TestTopDocumentCount() {
+    SearchServer search_server("and"s);
+    for (int id = 0; id < 20; ++id) {
+        std::string text = id % 4 == 3 ? "bird" : "cat";
+        for (int i = 0; i < id % 7; ++i) {
+            text += " dog";
+        }
+        search_server.AddDocument(id * 3, text, DocumentStatus::ACTUAL, { id % 5 });
+    }
+    ASSERT_EQUAL(search_server.FindTopDocuments("cat"s).size(), static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT));
+    ASSERT_EQUAL(search_server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL, 12).size(), 12u);
+    ASSERT_EQUAL(search_server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL, 100).size(), 15u);
+    ASSERT(search_server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL, 0).empty());
+
+    // The K best must come out in the same order as the head of the full ranking
+    // (compared by relevance and rating, equal pairs may swap ids).
+    const auto all_docs = search_server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL, 100);
+    for (size_t count : { 1u, 4u, 11u }) {
+        const auto seq_docs = search_server.FindTopDocuments("cat"s, DocumentStatus::ACTUAL, count);
+        const auto par_docs = search_server.FindTopDocuments(std::execution::par, "cat"s, DocumentStatus::ACTUAL, count);
+        ASSERT_EQUAL(seq_docs.size(), count);
+        ASSERT_EQUAL(par_docs.size(), count);
+        for (size_t i = 0; i < count; ++i) {
+            ASSERT_EQUAL(seq_docs[i].relevance, all_docs[i].relevance);
+            ASSERT_EQUAL(seq_docs[i].rating, all_docs[i].rating);
+            ASSERT_EQUAL(par_docs[i].relevance, all_docs[i].relevance);
+            ASSERT_EQUAL(par_docs[i].rating, all_docs[i].rating);
+        }
+    }
+}
+
+void TestSparseDocumentIds() {
+    SearchServer search_server("and"s);
+    search_server.AddDocument(2'000'000'000, "cat and dog", DocumentStatus::ACTUAL, { 5 });
+    search_server.AddDocument(7, "cat", DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(1'000'000, "dog bird", DocumentStatus::ACTUAL, { 3 });
+
+    const auto docs = search_server.FindTopDocuments("cat dog");
+    ASSERT_EQUAL(docs.size(), 3u);
+    ASSERT_EQUAL(docs[0].id, 2'000'000'000);
+    ASSERT_EQUAL(docs[0].rating, 5);
+
+    // Scores of the previous query on this thread must not leak into the next one.
+    SearchServer other_server("and"s);
+    other_server.AddDocument(1, "cat and dog", DocumentStatus::ACTUAL, { 1 });
+    other_server.AddDocument(2, "bird", DocumentStatus::ACTUAL, { 1 });
+    const auto other_docs = other_server.FindTopDocuments("cat -bird");
+    ASSERT_EQUAL(other_docs.size(), 1u);
+    ASSERT_EQUAL(other_docs[0].id, 1);
+
+    const auto repeated_docs = search_server.FindTopDocuments("cat dog -bird");
+    ASSERT_EQUAL(repeated_docs.size(), 2u);
+    ASSERT_EQUAL(repeated_docs[0].id, 2'000'000'000);
+    ASSERT_EQUAL(repeated_docs[1].id, 7);
+    ASSERT(std::abs(repeated_docs[0].relevance - docs[0].relevance) < 1e-6);
+}
+
+void TestParallelFindMatchesSequential() {
+    SearchServer search_server("and with"s);
+    const std::vector<std::string> words = { "cat", "dog", "bird", "tail", "collar", "eyes", "hat" };
+    for (int id = 0; id < 30000; ++id) {
+        std::string text;
+        for (int i = 0; i < 1 + id % 5; ++i) {
+            text += words[(id * 7 + i * 3) % words.size()] + " ";
+        }
+        const DocumentStatus status = id % 11 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        search_server.AddDocument(id * 2 + 1, text + "and", status, { id % 1000, id % 7 });
+    }
+    for (const std::string& query : { "cat dog bird"s, "tail hat -eyes"s, "collar cat dog hat eyes -bird"s }) {
+        for (size_t count : { 1u, 5u, 40u }) {
+            const auto seq_docs = search_server.FindTopDocuments(std::execution::seq, query, DocumentStatus::ACTUAL, count);
+            const auto par_docs = search_server.FindTopDocuments(std::execution::par, query, DocumentStatus::ACTUAL, count);
+            ASSERT_EQUAL(seq_docs.size(), par_docs.size());
+            for (size_t i = 0; i < seq_docs.size(); ++i) {
+                ASSERT_EQUAL(seq_docs[i].relevance, par_docs[i].relevance);
+                ASSERT_EQUAL(seq_docs[i].rating, par_docs[i].rating);
+            }
+        }
+        const auto banned_docs = search_server.FindTopDocuments(std::execution::par, query, DocumentStatus::BANNED, 1000);
+        ASSERT(!banned_docs.empty());
+        for (const Document& document : banned_docs) {
+            ASSERT_EQUAL(((document.id - 1) / 2) % 11, 0);
+        }
+    }
+}
+
+void TestInverseDocumentFreqFollowsIndexChanges() {
+    const double kSubtractionDiff = 1e-6;
+    SearchServer search_server("and"s);
+    search_server.AddDocument(1, "cat dog", DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(2, "dog", DocumentStatus::ACTUAL, { 1 });
+    auto docs = search_server.FindTopDocuments("cat");
+    ASSERT_EQUAL(docs.size(), 1u);
+    ASSERT(std::abs(docs[0].relevance - 0.5 * std::log(2.0)) < kSubtractionDiff);
+    // A repeated query reads the cached value.
+    ASSERT_EQUAL(search_server.FindTopDocuments("cat")[0].relevance, docs[0].relevance);
+
+    search_server.AddDocument(3, "bird", DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(4, "bird", DocumentStatus::ACTUAL, { 1 });
+    docs = search_server.FindTopDocuments("cat");
+    ASSERT(std::abs(docs[0].relevance - 0.5 * std::log(4.0)) < kSubtractionDiff);
+
+    search_server.AddDocument(5, "cat", DocumentStatus::ACTUAL, { 1 });
+    search_server.RemoveDocument(3);
+    docs = search_server.FindTopDocuments("cat");
+    ASSERT_EQUAL(docs.size(), 2u);
+    ASSERT_EQUAL(docs[0].id, 5);
+    ASSERT(std::abs(docs[0].relevance - std::log(2.0)) < kSubtractionDiff);
+
+    search_server.RemoveDocument(std::execution::par, 1);
+    docs = search_server.FindTopDocuments("cat");
+    ASSERT(std::abs(docs[0].relevance - std::log(3.0)) < kSubtractionDiff);
+}
+
+void TestMaxScoreMatchesExhaustive() {
+    SearchServer search_server("and with"s);
+    std::mt19937 generator(7);
+    const std::vector<std::string> words = { "cat", "dog", "bird", "tail", "collar", "eyes", "hat", "fur", "paw", "nose", "ears", "grey" };
+    for (int id = 0; id < 3000; ++id) {
+        std::string text;
+        const int length = 1 + static_cast<int>(generator() % 12);
+        for (int i = 0; i < length; ++i) {
+            // Skewed word choice: low indexes are frequent, high ones rare.
+            const size_t index = static_cast<size_t>(words.size() * std::pow(std::uniform_real_distribution<double>(0, 1)(generator), 3));
+            text += words[index] + " ";
+        }
+        const DocumentStatus status = id % 9 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        search_server.AddDocument(id, text + "and", status, { static_cast<int>(generator() % 100) });
+    }
+    for (int id = 0; id < 3000; id += 13) {
+        search_server.RemoveDocument(id);
+    }
+    const std::vector<std::string> queries = { "cat dog bird tail collar eyes hat"s, "grey ears nose"s, "cat fur paw -dog"s,
+        "cat dog bird tail collar eyes hat fur paw nose ears grey"s, "unknown"s };
+    for (const std::string& query : queries) {
+        for (size_t count : { 1u, 5u, 50u }) {
+            search_server.SetRetrievalMode(RetrievalMode::EXHAUSTIVE);
+            const auto expected = search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, count);
+            const auto expected_odd = search_server.FindTopDocuments(query, [](int document_id, DocumentStatus, int) {
+                return document_id % 2 == 1;
+                }, count);
+            search_server.SetRetrievalMode(RetrievalMode::MAX_SCORE);
+            const auto pruned = search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, count);
+            const auto pruned_odd = search_server.FindTopDocuments(query, [](int document_id, DocumentStatus, int) {
+                return document_id % 2 == 1;
+                }, count);
+            const auto pruned_par = search_server.FindTopDocuments(std::execution::par, query, DocumentStatus::ACTUAL, count);
+            for (const auto& docs : { pruned, pruned_par }) {
+                ASSERT_EQUAL(docs.size(), expected.size());
+                for (size_t i = 0; i < docs.size(); ++i) {
+                    ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+                    ASSERT_EQUAL(docs[i].rating, expected[i].rating);
+                }
+            }
+            ASSERT_EQUAL(pruned_odd.size(), expected_odd.size());
+            for (size_t i = 0; i < pruned_odd.size(); ++i) {
+                ASSERT_EQUAL(pruned_odd[i].relevance, expected_odd[i].relevance);
+                ASSERT_EQUAL(pruned_odd[i].id % 2, 1);
+            }
+        }
+    }
+}
+
+void TestPostingListBlocks() {
+    // Irregular gaps and counts across several full blocks and a partial tail.
+    std::map<uint32_t, uint32_t> expected;
+    PostingList postings;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        const uint32_t ordinal = i * 3 + (i % 7 == 0 ? 100 : 0) + i / 100 * 5000;
+        const uint32_t count = i % 250 == 0 ? 70000 : 1 + i % 5;
+        if (expected.count(ordinal) == 0 && (expected.empty() || ordinal > expected.rbegin()->first)) {
+            postings.Append(ordinal, count);
+            expected[ordinal] = count;
+        }
+    }
+    const auto check = [&postings, &expected]() {
+        ASSERT_EQUAL(postings.GetSize(), expected.size());
+        const uint32_t last_ordinal = expected.rbegin()->first;
+        for (uint32_t ordinal = 0; ordinal <= last_ordinal + 1; ++ordinal) {
+            const auto it = expected.find(ordinal);
+            ASSERT_EQUAL(postings.GetCount(ordinal), it == expected.end() ? 0u : it->second);
+        }
+        for (const auto& [begin_ordinal, end_ordinal] : { std::pair{ 0u, last_ordinal + 1 }, std::pair{ 150u, 9000u },
+            std::pair{ 20001u, 20002u }, std::pair{ 40000u, last_ordinal } }) {
+            std::vector<std::pair<uint32_t, uint32_t>> range(expected.lower_bound(begin_ordinal), expected.lower_bound(end_ordinal));
+            ASSERT_EQUAL(postings.CountPostings(begin_ordinal, end_ordinal), range.size());
+            std::vector<std::pair<uint32_t, uint32_t>> walked;
+            for (auto cursor = postings.MakeCursor(begin_ordinal, end_ordinal); !cursor.IsEnd(); cursor.Next()) {
+                walked.push_back({ cursor.GetOrdinal(), cursor.GetCount() });
+            }
+            ASSERT(walked == range);
+            walked.clear();
+            postings.ForEach(begin_ordinal, end_ordinal, [&walked](uint32_t ordinal, uint32_t count) {
+                walked.push_back({ ordinal, count });
+                });
+            ASSERT(walked == range);
+        }
+        auto cursor = postings.MakeCursor(0, last_ordinal + 1);
+        for (uint32_t ordinal = 0; ordinal <= last_ordinal; ordinal += 37) {
+            ASSERT_EQUAL(cursor.SeekTo(ordinal), expected.count(ordinal) > 0);
+            ASSERT_EQUAL(cursor.GetOrdinal(), expected.lower_bound(ordinal)->first);
+        }
+        ASSERT(!cursor.SeekTo(last_ordinal + 1));
+        ASSERT(cursor.IsEnd());
+    };
+    check();
+
+    // Erase from block middles, whole blocks and the tail.
+    for (auto it = expected.begin(); it != expected.end();) {
+        if (it->first % 4 == 0 || (it->first > 5000 && it->first < 16000)) {
+            ASSERT(postings.Erase(it->first));
+            it = expected.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    ASSERT(!postings.Erase(1));
+    check();
+
+    // A batch erase only packs the blocks its ordinals span, and packs them full.
+    PostingList dense;
+    for (uint32_t ordinal = 0; ordinal < 10000; ++ordinal) {
+        dense.Append(ordinal, 1 + ordinal % 3);
+    }
+    const auto get_blocks = [](const PostingList& list) {
+        const PostingList::Storage storage = list.GetStorage();
+        return std::vector<PostingList::BlockHeader>(storage.blocks, storage.blocks + storage.block_count);
+    };
+    const auto old_blocks = get_blocks(dense);
+    std::vector<uint32_t> batch;
+    for (uint32_t ordinal = 4096; ordinal < 8192; ordinal += 2) {
+        batch.push_back(ordinal);
+    }
+    batch.push_back(9999);
+    ASSERT_EQUAL(dense.Erase(batch), batch.size());
+    const auto new_blocks = get_blocks(dense);
+    ASSERT_EQUAL(new_blocks.size(), old_blocks.size() - 16);
+    for (size_t block = 0; block < new_blocks.size(); ++block) {
+        ASSERT_EQUAL(static_cast<size_t>(new_blocks[block].posting_count), PostingList::kBlockSize);
+        if (block < 32) {
+            ASSERT(new_blocks[block].first_ordinal == old_blocks[block].first_ordinal);
+            ASSERT(new_blocks[block].data_offset == old_blocks[block].data_offset);
+        }
+    }
+    ASSERT_EQUAL(dense.GetSize(), 10000u - batch.size());
+    std::vector<uint32_t> kept;
+    dense.ForEach(0, 10000, [&kept](uint32_t ordinal, uint32_t count) {
+        ASSERT_EQUAL(count, 1 + ordinal % 3);
+        kept.push_back(ordinal);
+        });
+    for (size_t i = 0; i < kept.size(); ++i) {
+        ASSERT_EQUAL(kept[i], i < 4096 ? i : i < 6144 ? 4097 + 2 * (i - 4096) : i + 2048);
+    }
+
+    SearchServer search_server("and with"s);
+    for (int id = 0; id < 2000; ++id) {
+        search_server.AddDocument(id, id % 2 == 0 ? "white cat and yellow hat"s : "curly cat curly tail"s, DocumentStatus::ACTUAL, { id });
+    }
+    const IndexMemoryUsage usage = search_server.GetMemoryUsage();
+    ASSERT_EQUAL(usage.posting_count, 1000u * 4 + 1000u * 3);
+    ASSERT(usage.posting_bytes * 4 < usage.uncompressed_posting_bytes);
+    const auto [words, status] = search_server.MatchDocument("curly hat", 1001);
+    ASSERT_EQUAL(words.size(), 1u);
+    ASSERT(words[0] == "curly"s);
+}
+
+void TestSnapshotRoundTrip() {
+    const std::string path = MakeTemporaryPath("round_trip.snapshot"s);
+    SearchServer search_server("and with"s);
+    const std::vector<std::string> words = { "cat", "dog", "bird", "tail", "collar", "eyes", "hat", "fur" };
+    for (int id = 0; id < 1500; ++id) {
+        std::string text;
+        for (size_t i = 0; i < words.size(); ++i) {
+            if ((id + 1) % (i + 2) == 0 || static_cast<size_t>(id % 11) == i) {
+                text += words[i] + (id % 3 == 0 ? " and "s : " "s) + words[(i + id) % words.size()] + " "s;
+            }
+        }
+        const DocumentStatus status = id % 7 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        search_server.AddDocument(id * 3, text + "with"s, status, { id % 10, id % 4 });
+    }
+    for (int id = 0; id < 4500; id += 39) {
+        search_server.RemoveDocument(id);
+    }
+    search_server.SaveSnapshot(path);
+    SearchServer loaded = SearchServer::LoadSnapshot(path);
+    ASSERT(loaded.GetMemoryUsage().mapped_bytes > 0);
+
+    const auto check_same = [&search_server, &loaded]() {
+        ASSERT_EQUAL(loaded.GetDocumentCount(), search_server.GetDocumentCount());
+        ASSERT(std::equal(loaded.begin(), loaded.end(), search_server.begin(), search_server.end()));
+        const std::vector<std::string> queries = { "cat dog bird"s, "collar eyes -cat"s, "hat fur tail with"s, "unknown -dog"s };
+        for (const RetrievalMode mode : { RetrievalMode::EXHAUSTIVE, RetrievalMode::MAX_SCORE }) {
+            search_server.SetRetrievalMode(mode);
+            loaded.SetRetrievalMode(mode);
+            for (const std::string& query : queries) {
+                for (const DocumentStatus status : { DocumentStatus::ACTUAL, DocumentStatus::BANNED }) {
+                    const auto expected = search_server.FindTopDocuments(query, status, 20);
+                    for (const auto& docs : { loaded.FindTopDocuments(query, status, 20), loaded.FindTopDocuments(std::execution::par, query, status, 20) }) {
+                        ASSERT_EQUAL(docs.size(), expected.size());
+                        for (size_t i = 0; i < docs.size(); ++i) {
+                            ASSERT_EQUAL(docs[i].id, expected[i].id);
+                            ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+                            ASSERT_EQUAL(docs[i].rating, expected[i].rating);
+                        }
+                    }
+                }
+            }
+        }
+        const std::string match_query = "cat hat fur -eyes"s;
+        for (const int id : search_server) {
+            const auto [expected_words, expected_status] = search_server.MatchDocument(match_query, id);
+            const auto [words, status] = loaded.MatchDocument(match_query, id);
+            ASSERT(words == expected_words);
+            ASSERT(status == expected_status);
+            ASSERT(loaded.GetWordFrequencies(id) == search_server.GetWordFrequencies(id));
+        }
+    };
+    check_same();
+
+    // Saving over a mapped snapshot replaces the file and leaves the mapping intact.
+    SearchServer("and"s).SaveSnapshot(path);
+    ASSERT(!std::ifstream(path + ".tmp"s));
+    ASSERT_EQUAL(SearchServer::LoadSnapshot(path).GetDocumentCount(), 0);
+    check_same();
+    search_server.SaveSnapshot(path);
+
+    // Changing the loaded index copies it out of the snapshot first.
+    search_server.AddDocument(10000, "cat cat collar"s, DocumentStatus::ACTUAL, { 5 });
+    loaded.AddDocument(10000, "cat cat collar"s, DocumentStatus::ACTUAL, { 5 });
+    search_server.RemoveDocument(std::execution::par, 3);
+    loaded.RemoveDocument(std::execution::par, 3);
+    ASSERT_EQUAL(loaded.GetMemoryUsage().mapped_bytes, 0u);
+    check_same();
+
+    const auto is_rejected = [&path]() {
+        try {
+            SearchServer::LoadSnapshot(path, SnapshotVerification::CHECKSUM);
+        }
+        catch (const std::invalid_argument&) {
+            return true;
+        }
+        return false;
+    };
+    std::string bytes;
+    {
+        std::ifstream input(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+    const auto write_file = [&path](const std::string& content) {
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        output << content;
+    };
+    std::string damaged = bytes;
+    damaged[damaged.size() / 2] ^= 1;
+    write_file(damaged);
+    ASSERT_HINT(is_rejected(), "A damaged snapshot must fail its checksum"s);
+    damaged = bytes;
+    ++damaged[8];
+    write_file(damaged);
+    ASSERT_HINT(is_rejected(), "A snapshot of another version must be rejected"s);
+    write_file(bytes.substr(0, bytes.size() - 8));
+    ASSERT_HINT(is_rejected(), "A truncated snapshot must be rejected"s);
+    std::remove(path.c_str());
+}
+
+void TestAddDocumentsMatchesAddDocument() {
+    std::mt19937 generator(11);
+    const std::vector<std::string> words = { "cat", "dog", "bird", "tail", "collar", "eyes", "hat", "fur", "and" };
+    std::vector<std::string> texts;
+    for (int id = 0; id < 5000; ++id) {
+        std::string text;
+        const int length = 1 + static_cast<int>(generator() % 10);
+        for (int i = 0; i < length; ++i) {
+            text += words[generator() % words.size()] + " ";
+        }
+        texts.push_back(text + words[id % words.size()]);
+    }
+    std::vector<DocumentInput> head;
+    std::vector<DocumentInput> rest;
+    for (int id = 0; id < 5000; ++id) {
+        const DocumentStatus status = id % 5 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        (id < 1000 ? head : rest).push_back({ id * 2, texts[id], status, { id % 9, 1 } });
+    }
+
+    SearchServer one_by_one("and"s);
+    for (const DocumentInput& document : head) {
+        one_by_one.AddDocument(document.id, document.text, document.status, document.ratings);
+    }
+    for (const DocumentInput& document : rest) {
+        one_by_one.AddDocument(document.id, document.text, document.status, document.ratings);
+    }
+    SearchServer sequential("and"s);
+    sequential.AddDocuments(head);
+    sequential.AddDocuments(std::execution::seq, rest);
+    SearchServer parallel("and"s);
+    parallel.AddDocuments(std::execution::par, head);
+    parallel.AddDocuments(std::execution::par, rest);
+
+    for (SearchServer* search_server : { &sequential, &parallel }) {
+        ASSERT(std::equal(search_server->begin(), search_server->end(), one_by_one.begin(), one_by_one.end()));
+        for (const std::string& query : { "cat dog"s, "collar -fur"s, "eyes hat tail bird"s }) {
+            for (const RetrievalMode mode : { RetrievalMode::EXHAUSTIVE, RetrievalMode::MAX_SCORE }) {
+                one_by_one.SetRetrievalMode(mode);
+                search_server->SetRetrievalMode(mode);
+                const auto expected = one_by_one.FindTopDocuments(query, DocumentStatus::ACTUAL, 30);
+                const auto docs = search_server->FindTopDocuments(query, DocumentStatus::ACTUAL, 30);
+                ASSERT_EQUAL(docs.size(), expected.size());
+                for (size_t i = 0; i < docs.size(); ++i) {
+                    ASSERT_EQUAL(docs[i].id, expected[i].id);
+                    ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+                    ASSERT_EQUAL(docs[i].rating, expected[i].rating);
+                }
+            }
+        }
+        for (int id = 0; id < 10000; id += 97) {
+            ASSERT(search_server->GetWordFrequencies(id) == one_by_one.GetWordFrequencies(id));
+        }
+    }
+
+    // A bad document anywhere in the batch rejects the whole batch.
+    const std::vector<std::vector<DocumentInput>> bad_batches = {
+        { { 20001, "cat", DocumentStatus::ACTUAL, {} }, { 20001, "dog", DocumentStatus::ACTUAL, {} } },
+        { { 20001, "cat", DocumentStatus::ACTUAL, {} }, { 2, "dog", DocumentStatus::ACTUAL, {} } },
+        { { 20001, "cat", DocumentStatus::ACTUAL, {} }, { -1, "dog", DocumentStatus::ACTUAL, {} } },
+        { { 20001, "cat", DocumentStatus::ACTUAL, {} }, { 20002, "d\x12og", DocumentStatus::ACTUAL, {} } },
+    };
+    for (const auto& batch : bad_batches) {
+        for (const bool is_parallel : { false, true }) {
+            try {
+                if (is_parallel) {
+                    parallel.AddDocuments(std::execution::par, batch);
+                }
+                else {
+                    parallel.AddDocuments(batch);
+                }
+                ASSERT_HINT(false, "The batch must be rejected"s);
+            }
+            catch (const std::invalid_argument&) {
+            }
+            ASSERT_EQUAL(parallel.GetDocumentCount(), 5000);
+            ASSERT(parallel.GetWordFrequencies(20001).empty());
+        }
+    }
+}
+
+void TestTombstonesAndSegmentMerges() {
+    // Three segments' worth of documents (segments are 4096 ordinals).
+    const int document_count = 10000;
+    const std::vector<std::string> words = { "cat", "dog", "bird", "tail", "collar", "eyes", "hat", "fur", "and" };
+    std::vector<std::string> texts;
+    for (int id = 0; id < document_count; ++id) {
+        texts.push_back(words[id % 9] + " " + words[id / 9 % 9] + " " + words[id / 81 % 9] + " " + words[(id * 7) % 9]);
+    }
+    // All of segment 0 goes, which merges it away four times over, plus a few
+    // documents of segment 2 that stay tombstoned; one removed id comes back.
+    const auto is_removed = [](int id) {
+        return id < 4096 || (id > 9000 && id % 50 == 0);
+    };
+    SearchServer search_server("and"s);
+    for (int id = 0; id < document_count; ++id) {
+        search_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, { id % 11 });
+    }
+    for (int id = document_count - 1; id >= 0; --id) {
+        if (is_removed(id)) {
+            if (id % 2 == 0) {
+                search_server.RemoveDocument(id);
+            }
+            else {
+                search_server.RemoveDocument(std::execution::par, id);
+            }
+        }
+    }
+    search_server.AddDocument(7, texts[7], DocumentStatus::ACTUAL, { 7 % 11 });
+
+    SearchServer expected_server("and"s);
+    for (int id = 0; id < document_count; ++id) {
+        if (!is_removed(id)) {
+            expected_server.AddDocument(id, texts[id], DocumentStatus::ACTUAL, { id % 11 });
+        }
+    }
+    expected_server.AddDocument(7, texts[7], DocumentStatus::ACTUAL, { 7 % 11 });
+
+    ASSERT_EQUAL(search_server.GetDocumentCount(), expected_server.GetDocumentCount());
+    ASSERT(search_server.GetWordFrequencies(8).empty());
+    // The id list is still stale here, so this goes the slow way.
+    for (int index = 0; index < search_server.GetDocumentCount(); index += 101) {
+        ASSERT_EQUAL(search_server.GetDocumentId(index), expected_server.GetDocumentId(index));
+    }
+    ASSERT(std::equal(search_server.begin(), search_server.end(), expected_server.begin(), expected_server.end()));
+
+    for (const std::string& query : { "cat dog"s, "collar -fur"s, "eyes hat tail bird"s }) {
+        for (const RetrievalMode mode : { RetrievalMode::EXHAUSTIVE, RetrievalMode::MAX_SCORE }) {
+            search_server.SetRetrievalMode(mode);
+            expected_server.SetRetrievalMode(mode);
+            const auto expected = expected_server.FindTopDocuments(query, DocumentStatus::ACTUAL, 50);
+            for (const auto& docs : { search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, 50),
+                search_server.FindTopDocuments(std::execution::par, query, DocumentStatus::ACTUAL, 50) }) {
+                ASSERT_EQUAL(docs.size(), expected.size());
+                for (size_t i = 0; i < docs.size(); ++i) {
+                    ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+                    ASSERT_EQUAL(docs[i].rating, expected[i].rating);
+                }
+            }
+        }
+    }
+
+    // Merged segments hold no postings of removed documents; the tombstoned ones of segment 2 are still there.
+    size_t tombstoned_posting_count = 0;
+    for (int id = 9001; id < document_count; ++id) {
+        if (is_removed(id)) {
+            const auto document_words = SplitIntoWords(texts[id]);
+            std::set<std::string> distinct_words(document_words.begin(), document_words.end());
+            distinct_words.erase("and"s);
+            tombstoned_posting_count += distinct_words.size();
+        }
+    }
+    ASSERT_EQUAL(search_server.GetMemoryUsage().posting_count, expected_server.GetMemoryUsage().posting_count + tombstoned_posting_count);
+}
+
+// Readers check invariants that hold in every published version: the writer keeps
+// between 200 and 201 documents, and every one of them contains "cat".
+void TestConcurrentReadsDuringUpdates() {
+    const int initial_count = 200;
+    SearchServer initial_server("and"s);
+    for (int id = 0; id < initial_count; ++id) {
+        initial_server.AddDocument(id, "cat and dog " + std::to_string(id), DocumentStatus::ACTUAL, { id });
+    }
+    ConcurrentSearchServer search_server(std::move(initial_server));
+
+    std::atomic<bool> is_writing{ true };
+    std::atomic<int> read_count{ 0 };
+    const auto read = [&](bool is_parallel) {
+        while (is_writing.load() || read_count.load() < 100) {
+            const auto handle = search_server.Read();
+            const int document_count = handle->GetDocumentCount();
+            ASSERT(document_count == initial_count || document_count == initial_count + 1);
+            const auto documents = is_parallel
+                ? handle->FindTopDocuments(std::execution::par, "cat -bird", DocumentStatus::ACTUAL, 1000)
+                : handle->FindTopDocuments("cat -bird", DocumentStatus::ACTUAL, 1000);
+            ASSERT_EQUAL(static_cast<int>(documents.size()), document_count);
+            for (const Document& document : documents) {
+                const auto [words, status] = handle->MatchDocument("cat", document.id);
+                ASSERT_EQUAL(words.size(), 1u);
+                ASSERT_EQUAL(handle->GetWordFrequencies(document.id).size(), 3u);
+            }
+            ++read_count;
+        }
+    };
+    std::vector<std::thread> readers;
+    for (int reader = 0; reader < 3; ++reader) {
+        readers.emplace_back(read, reader == 0);
+    }
+    for (int id = initial_count; id < initial_count * 4; ++id) {
+        search_server.AddDocument(id, "cat and dog " + std::to_string(id), DocumentStatus::ACTUAL, { id });
+        if (id % 2 == 0) {
+            search_server.RemoveDocument(id - initial_count);
+        }
+        else {
+            search_server.Update([id](SearchServer& server) {
+                server.RemoveDocument(std::execution::par, id - initial_count);
+                });
+        }
+        ASSERT_EQUAL(ProcessQueries(search_server, { "cat"s, "dog -cat"s }).size(), 2u);
+    }
+    is_writing = false;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+
+    const auto handle = search_server.Read();
+    ASSERT_EQUAL(handle->GetDocumentCount(), initial_count);
+    ASSERT_EQUAL(handle->FindTopDocuments("dog").size(), 5u);
+    ASSERT(handle->GetWordFrequencies(0).empty());
+    ASSERT_EQUAL(handle->GetWordFrequencies(initial_count * 4 - 1).size(), 3u);
+}
+
+// A mutation that fails on the second copy is still published, and the lagging
+// copy catches up, so that readers see the same index whichever copy they get.
+void TestConcurrentUpdateRestoresLaggingCopy() {
+    ConcurrentSearchServer search_server(SearchServer("and"s));
+    search_server.AddDocument(1, "cat and dog"s, DocumentStatus::ACTUAL, { 1 });
+    try {
+        search_server.Update([](SearchServer& server) {
+            server.AddDocument(1, "duplicate"s, DocumentStatus::ACTUAL, { 1 });
+            });
+        ASSERT_HINT(false, "a mutation that fails on the first copy must throw"s);
+    }
+    catch (const std::invalid_argument&) {
+    }
+    int call_count = 0;
+    search_server.Update([&call_count](SearchServer& server) {
+        if (++call_count == 2) {
+            throw std::runtime_error("second copy");
+        }
+        server.AddDocument(2, "cat"s, DocumentStatus::ACTUAL, { 2 });
+        });
+    ASSERT_EQUAL(call_count, 2);
+    ASSERT_EQUAL(search_server.Read()->GetDocumentCount(), 2);
+    for (int id = 3; id < 5; ++id) {
+        search_server.AddDocument(id, "cat hat"s, DocumentStatus::ACTUAL, { id });
+        const auto handle = search_server.Read();
+        ASSERT_EQUAL(handle->GetDocumentCount(), id);
+        ASSERT_EQUAL(handle->FindTopDocuments("cat"s).size(), static_cast<size_t>(id));
+    }
+}
+
+void TestSplitIntoWords() {
+    std::vector<std::string_view> words;
+    ASSERT(SplitIntoWords("  cat   dog ", words));
+    ASSERT(words == std::vector<std::string_view>({ "cat", "dog" }));
+    ASSERT(SplitIntoWords("", words));
+    ASSERT(words.empty());
+
+    // Longer than any vector chunk, with words across chunk edges and a run of spaces over a whole chunk.
+    std::string text;
+    std::vector<std::string> expected_words;
+    for (int i = 0; i < 40; ++i) {
+        expected_words.push_back(std::string(i % 37 + 1, static_cast<char>('a' + i % 26)));
+        text += expected_words.back() + std::string(i % 7 == 0 ? 33 : 1, ' ');
+    }
+    const size_t capacity = words.capacity();
+    ASSERT(SplitIntoWords(text, words));
+    ASSERT(std::equal(words.begin(), words.end(), expected_words.begin(), expected_words.end()));
+    ASSERT(SplitIntoWords(text, words));
+    ASSERT_EQUAL(words.size(), expected_words.size());
+    ASSERT(capacity <= words.capacity());
+
+    // Control characters anywhere fail the text, but it is still split.
+    for (const size_t position : { size_t{ 0 }, size_t{ 15 }, size_t{ 16 }, size_t{ 31 }, size_t{ 32 }, text.size() - 1 }) {
+        std::string bad_text = text;
+        bad_text[position] = '\t';
+        ASSERT(!SplitIntoWords(bad_text, words));
+        ASSERT(!words.empty());
+    }
+    // Bytes above 127 are word characters.
+    ASSERT(SplitIntoWords("\xE9\xF2 \x80", words));
+    ASSERT_EQUAL(words.size(), 2u);
+
+    SearchServer search_server("and"s);
+    search_server.AddDocument(0, "cat  and   dog", DocumentStatus::ACTUAL, { 1 });
+    ASSERT_EQUAL(search_server.GetWordFrequencies(0).at("cat"), 0.5);
+    ASSERT_EQUAL(search_server.FindTopDocuments("  cat  -bird ").size(), 1u);
+    try {
+        search_server.AddDocument(1, text + "\x01", DocumentStatus::ACTUAL, { 1 });
+        ASSERT_HINT(false, "a control character must be rejected");
+    }
+    catch (const std::invalid_argument&) {
+    }
+    ASSERT_EQUAL(search_server.GetDocumentCount(), 1);
+}
+
+void TestLoadDocuments() {
+    // About 5 MB, so the dump takes a few batches and records straddle their edges.
+    const std::vector<std::string> words = { "cat", "dog", "bird", "tail", "collar", "eyes", "hat", "fur", "and" };
+    const std::vector<std::string> statuses = { "ACTUAL", "IRRELEVANT", "BANNED", "REMOVED" };
+    SearchServer expected_server("and"s);
+    std::string dump;
+    std::vector<std::string> texts;
+    for (int id = 0; id < 1200; ++id) {
+        std::string text;
+        for (int i = 0; i < 1000 + id % 300; ++i) {
+            text += words[(id * 5 + i * i) % words.size()] + " "s;
+        }
+        text += std::to_string(id);
+        std::vector<int> ratings;
+        std::string rating_field;
+        for (int i = 0; i < id % 4; ++i) {
+            ratings.push_back(id % 7 - 3 + i);
+            rating_field += (i > 0 ? " "s : ""s) + std::to_string(ratings.back());
+        }
+        expected_server.AddDocument(id * 2, text, static_cast<DocumentStatus>(id % 4), ratings);
+        dump += std::to_string(id * 2) + "\t"s + statuses[id % 4] + "\t"s + rating_field + "\t"s + text + (id % 5 == 0 ? "\r\n"s : "\n"s);
+        if (id % 100 == 0) {
+            dump += "\n"s;
+        }
+    }
+    dump.pop_back();
+
+    const std::string path = "search_server_test.dump"s;
+    std::ofstream(path, std::ios::binary) << dump;
+    SearchServer file_server("and"s);
+    ASSERT_EQUAL(LoadDocuments(file_server, path), 1200u);
+    std::istringstream input(dump);
+    SearchServer stream_server("and"s);
+    ASSERT_EQUAL(LoadDocuments(stream_server, input), 1200u);
+    std::istringstream concurrent_input(dump);
+    ConcurrentSearchServer concurrent_server(SearchServer("and"s));
+    ASSERT_EQUAL(LoadDocuments(concurrent_server, concurrent_input), 1200u);
+    std::remove(path.c_str());
+
+    const auto concurrent_handle = concurrent_server.Read();
+    for (const SearchServer* search_server : std::vector<const SearchServer*>{ &file_server, &stream_server, &*concurrent_handle }) {
+        ASSERT_EQUAL(search_server->GetDocumentCount(), expected_server.GetDocumentCount());
+        for (int index = 0; index < expected_server.GetDocumentCount(); index += 97) {
+            ASSERT_EQUAL(search_server->GetDocumentId(index), expected_server.GetDocumentId(index));
+        }
+        for (const std::string& query : { "cat -dog"s, "hat fur 1199"s, "collar"s }) {
+            for (const DocumentStatus status : { DocumentStatus::ACTUAL, DocumentStatus::BANNED }) {
+                const auto docs = search_server->FindTopDocuments(query, status, 20);
+                const auto expected = expected_server.FindTopDocuments(query, status, 20);
+                ASSERT_EQUAL(docs.size(), expected.size());
+                for (size_t i = 0; i < docs.size(); ++i) {
+                    ASSERT_EQUAL(docs[i].id, expected[i].id);
+                    ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+                    ASSERT_EQUAL(docs[i].rating, expected[i].rating);
+                }
+            }
+        }
+    }
+
+    // A bad line is reported by number; the batches before it are kept.
+    for (const std::string& bad_line : { "x\tACTUAL\t1\tcat"s, "5\tNEW\t\tcat"s, "5\tACTUAL\t1 y\tcat"s, "5\tACTUAL\tcat"s }) {
+        std::istringstream bad_input("1\tACTUAL\t\tcat\n\n"s + bad_line + "\n3\tACTUAL\t\tdog\n"s);
+        SearchServer search_server("and"s);
+        try {
+            LoadDocuments(search_server, bad_input);
+            ASSERT_HINT(false, "a malformed line must be rejected");
+        }
+        catch (const std::invalid_argument& error) {
+            ASSERT_EQUAL(std::string(error.what()), "Invalid document record at line 3"s);
+        }
+    }
+    std::istringstream duplicate_input("1\tACTUAL\t\tcat\n1\tACTUAL\t\tdog\n"s);
+    try {
+        LoadDocuments(stream_server, duplicate_input);
+        ASSERT_HINT(false, "a taken id must be rejected");
+    }
+    catch (const std::invalid_argument&) {
+    }
+    ASSERT_EQUAL(stream_server.GetDocumentCount(), 1200);
+}
+
+void TestQueryCache() {
+    SearchServer search_server("and in"s);
+    for (int id = 0; id < 60; ++id) {
+        search_server.AddDocument(id, (id % 2 == 0 ? "cat and dog "s : "dog in hat "s) + std::to_string(id), DocumentStatus::ACTUAL, { id });
+    }
+    SearchServer uncached_server = search_server;
+    search_server.SetQueryCacheSize(1 << 20);
+    const auto assert_same_results = [&](const std::string& query, DocumentStatus status, size_t count) {
+        const auto docs = search_server.FindTopDocuments(query, status, count);
+        const auto expected = uncached_server.FindTopDocuments(query, status, count);
+        ASSERT_EQUAL(docs.size(), expected.size());
+        for (size_t i = 0; i < docs.size(); ++i) {
+            ASSERT_EQUAL(docs[i].id, expected[i].id);
+            ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+        }
+    };
+
+    assert_same_results("cat hat -7"s, DocumentStatus::ACTUAL, 5);
+    // The same parsed query: other word order, repeats, stop words, the parallel engine.
+    assert_same_results("-7 hat and cat cat"s, DocumentStatus::ACTUAL, 5);
+    search_server.FindTopDocuments(std::execution::par, "hat in cat -7"s);
+    ASSERT_EQUAL(search_server.GetQueryCacheStatistics().hit_count, 2u);
+    ASSERT_EQUAL(search_server.GetQueryCacheStatistics().miss_count, 1u);
+    // Another status, count or minus-word set is another entry; predicates bypass the cache.
+    assert_same_results("cat hat -7"s, DocumentStatus::BANNED, 5);
+    assert_same_results("cat hat -7"s, DocumentStatus::ACTUAL, 6);
+    assert_same_results("cat hat"s, DocumentStatus::ACTUAL, 5);
+    search_server.FindTopDocuments("cat hat -7"s, [](int id, DocumentStatus, int) { return id > 10; });
+    QueryCacheStatistics statistics = search_server.GetQueryCacheStatistics();
+    ASSERT_EQUAL(statistics.hit_count, 2u);
+    ASSERT_EQUAL(statistics.miss_count, 4u);
+    ASSERT_EQUAL(statistics.entry_count, 4u);
+    ASSERT(statistics.memory_bytes > 0);
+
+    // Index changes invalidate every entry.
+    for (SearchServer* server : { &search_server, &uncached_server }) {
+        server->AddDocument(100, "hat hat hat"s, DocumentStatus::ACTUAL, { 1 });
+    }
+    assert_same_results("cat hat -7"s, DocumentStatus::ACTUAL, 5);
+    ASSERT_EQUAL(search_server.FindTopDocuments("cat hat -7"s)[0].id, 100);
+    for (SearchServer* server : { &search_server, &uncached_server }) {
+        server->RemoveDocument(100);
+    }
+    assert_same_results("cat hat -7"s, DocumentStatus::ACTUAL, 5);
+    statistics = search_server.GetQueryCacheStatistics();
+    ASSERT_EQUAL(statistics.invalidation_count, 2u);
+    ASSERT_EQUAL(statistics.hit_count, 3u);
+
+    // A copy starts empty; a small cap evicts the least recently used entries.
+    const SearchServer copied_server = search_server;
+    ASSERT_EQUAL(copied_server.GetQueryCacheStatistics().entry_count, 0u);
+    search_server.SetQueryCacheSize(16 * 512);
+    for (int id = 0; id < 60; ++id) {
+        assert_same_results("dog "s + std::to_string(id), DocumentStatus::ACTUAL, 5);
+    }
+    statistics = search_server.GetQueryCacheStatistics();
+    ASSERT(statistics.eviction_count > 0);
+    ASSERT_EQUAL(statistics.entry_count + statistics.eviction_count, 60u);
+    ASSERT(statistics.memory_bytes <= 16 * 512);
+    search_server.SetQueryCacheSize(0);
+    assert_same_results("dog 1"s, DocumentStatus::ACTUAL, 5);
+    ASSERT_EQUAL(search_server.GetQueryCacheStatistics().miss_count, 0u);
+}
+
+void TestCompiledQuery() {
+    SearchServer search_server("and in"s);
+    for (int id = 0; id < 40; ++id) {
+        search_server.AddDocument(id, (id % 2 == 0 ? "cat and dog "s : "dog in hat "s) + std::to_string(id % 5), DocumentStatus::ACTUAL, { id });
+    }
+    const auto assert_same_results = [](const std::vector<Document>& docs, const std::vector<Document>& expected) {
+        ASSERT_EQUAL(docs.size(), expected.size());
+        for (size_t i = 0; i < docs.size(); ++i) {
+            ASSERT_EQUAL(docs[i].id, expected[i].id);
+            ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+        }
+    };
+    // More words than fit inline, with repeats, stop words and unknown words.
+    const std::string raw_query = "hat cat 1 2 3 4 0 dog and hat -1 -fox owl -3 1"s;
+    const auto is_even = [](int id, DocumentStatus, int) { return id % 2 == 0; };
+    CompiledQuery query = search_server.CompileQuery(std::string(raw_query));
+    assert_same_results(search_server.FindTopDocuments(query), search_server.FindTopDocuments(raw_query));
+    assert_same_results(search_server.FindTopDocuments(std::execution::par, query, is_even, 10),
+        search_server.FindTopDocuments(raw_query, is_even, 10));
+    assert_same_results(search_server.FindTopDocuments(query, DocumentStatus::BANNED), {});
+    ASSERT_EQUAL(ProcessQueries(search_server, std::vector<CompiledQuery>{ query, query })[1].size(), 5u);
+
+    // Words that were unknown at compile time count once the dictionary has them.
+    search_server.AddDocument(100, "owl owl cat"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(101, "fox cat"s, DocumentStatus::ACTUAL, { 1 });
+    assert_same_results(search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, 50),
+        search_server.FindTopDocuments(raw_query, DocumentStatus::ACTUAL, 50));
+    ASSERT_EQUAL(search_server.FindTopDocuments(query)[0].id, 100);
+    const SearchServer empty_server("and"s);
+    try {
+        empty_server.FindTopDocuments(query);
+        ASSERT_HINT(false, "a query of a bigger dictionary must be rejected");
+    }
+    catch (const std::invalid_argument&) {
+    }
+
+    // A snapshot numbers terms in word order, so the query's ids mean other words there.
+    const std::string path = MakeTemporaryPath("compiled_query.snapshot"s);
+    search_server.SaveSnapshot(path);
+    const SearchServer loaded = SearchServer::LoadSnapshot(path);
+    try {
+        loaded.FindTopDocuments(query);
+        ASSERT_HINT(false, "a query of a renumbered dictionary must be rejected");
+    }
+    catch (const std::invalid_argument&) {
+    }
+    // Terms of a loaded server already are in word order, and saving it again keeps their ids.
+    const CompiledQuery loaded_query = loaded.CompileQuery(raw_query);
+    loaded.SaveSnapshot(path);
+    const SearchServer reloaded = SearchServer::LoadSnapshot(path);
+    std::remove(path.c_str());
+    assert_same_results(reloaded.FindTopDocuments(loaded_query), search_server.FindTopDocuments(raw_query));
+    for (const std::string& bad_query : { "cat -"s, "--cat"s, "cat\x01"s }) {
+        try {
+            search_server.CompileQuery(bad_query);
+            ASSERT_HINT(false, "an invalid query must be rejected");
+        }
+        catch (const std::invalid_argument&) {
+        }
+    }
+
+    // Both MatchDocument engines report the matched plus-words in word order.
+    for (const int id : { 0, 3, 100 }) {
+        const auto [words, status] = search_server.MatchDocument(raw_query, id);
+        const auto [parallel_words, parallel_status] = search_server.MatchDocument(std::execution::par, raw_query, id);
+        ASSERT(words == parallel_words);
+        ASSERT(std::is_sorted(words.begin(), words.end()));
+    }
+    ASSERT(std::get<0>(search_server.MatchDocument(std::execution::par, raw_query, 1)).empty());
+}
+
+void TestStatusFiltering() {
+    SearchServer search_server("and"s);
+    const DocumentStatus statuses[] = { DocumentStatus::ACTUAL, DocumentStatus::IRRELEVANT, DocumentStatus::BANNED,
+        DocumentStatus::REMOVED, static_cast<DocumentStatus>(7) };
+    for (int id = 0; id < 300; ++id) {
+        const std::string text = (id % 3 == 0 ? "cat and dog "s : "dog hat "s) + (id % 4 == 0 ? "fur"s : "tail"s);
+        search_server.AddDocument(id, text, statuses[id % 5], { id % 9 });
+    }
+    for (int id = 0; id < 300; id += 7) {
+        search_server.RemoveDocument(id);
+    }
+    // A removed id added again under another status is found only under the new one.
+    search_server.AddDocument(14, "cat hat fur"s, DocumentStatus::BANNED, { 5 });
+
+    for (const RetrievalMode mode : { RetrievalMode::EXHAUSTIVE, RetrievalMode::MAX_SCORE }) {
+        search_server.SetRetrievalMode(mode);
+        for (const std::string& query : { "cat hat"s, "dog fur -tail"s, "fur"s }) {
+            for (const DocumentStatus status : statuses) {
+                const auto status_predicate = [status](int, DocumentStatus document_status, int) {
+                    return document_status == status;
+                };
+                const auto expected = search_server.FindTopDocuments(query, status_predicate, 1000);
+                for (const auto& docs : { search_server.FindTopDocuments(query, status, 1000),
+                    search_server.FindTopDocuments(std::execution::par, query, status, 1000) }) {
+                    ASSERT_EQUAL(docs.size(), expected.size());
+                    for (size_t i = 0; i < docs.size(); ++i) {
+                        ASSERT_EQUAL(docs[i].id, expected[i].id);
+                        ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+                        ASSERT(docs[i].id == 14 || docs[i].id % 7 != 0);
+                    }
+                }
+            }
+        }
+    }
+    const auto banned = search_server.FindTopDocuments("cat fur"s, DocumentStatus::BANNED, 1000);
+    ASSERT(std::any_of(banned.begin(), banned.end(), [](const Document& document) { return document.id == 14; }));
+    ASSERT(search_server.FindTopDocuments("cat fur"s, DocumentStatus::ACTUAL, 1000).size() > 0);
+    for (const Document& document : search_server.FindTopDocuments("cat fur"s, DocumentStatus::ACTUAL, 1000)) {
+        ASSERT(document.id != 14);
+    }
+}
+
+void TestMinusWordsExcludeBeforeScoring() {
+    SearchServer search_server("and"s);
+    std::mt19937 generator(11);
+    const std::vector<std::string> words = { "cat", "dog", "bird", "tail", "collar", "eyes", "hat", "fur" };
+    for (int id = 0; id < 2000; ++id) {
+        std::string text;
+        for (int i = 0; i < 6; ++i) {
+            text += words[static_cast<size_t>(words.size() * std::pow(std::uniform_real_distribution<double>(0, 1)(generator), 2))] + " ";
+        }
+        search_server.AddDocument(id, text + "and", DocumentStatus::ACTUAL, { id % 7 });
+    }
+    // Each query with minus-words follows one that scores the documents it excludes,
+    // so stale relevance left in the accumulator would show up.
+    const std::vector<std::pair<std::string, std::string>> queries = { { "cat dog bird tail"s, "-cat -dog bird tail"s },
+        { "cat collar eyes hat"s, "collar eyes hat -cat"s }, { "bird tail eyes dog fur"s, "dog fur -bird -tail -eyes"s },
+        { "hat"s, "hat -hat"s } };
+    for (const RetrievalMode mode : { RetrievalMode::EXHAUSTIVE, RetrievalMode::MAX_SCORE }) {
+        search_server.SetRetrievalMode(mode);
+        for (const auto& [previous_query, query] : queries) {
+            // The plus-words alone, without the documents that have a minus-word.
+            std::string plus_query;
+            for (const std::string& word : SplitIntoWords(query)) {
+                if (word[0] != '-') {
+                    plus_query += word + " ";
+                }
+            }
+            std::vector<Document> expected;
+            search_server.SetRetrievalMode(RetrievalMode::EXHAUSTIVE);
+            for (const Document& document : search_server.FindTopDocuments(plus_query, DocumentStatus::ACTUAL, 2000)) {
+                if (!std::get<0>(search_server.MatchDocument(query, document.id)).empty()) {
+                    expected.push_back(document);
+                }
+            }
+            search_server.SetRetrievalMode(mode);
+            for (const size_t count : { 1u, 3u, 2000u }) {
+                search_server.FindTopDocuments(previous_query, DocumentStatus::ACTUAL, count);
+                for (const auto& docs : { search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, count),
+                    search_server.FindTopDocuments(std::execution::par, query, DocumentStatus::ACTUAL, count) }) {
+                    ASSERT_EQUAL(docs.size(), std::min(count, expected.size()));
+                    for (size_t i = 0; i < docs.size(); ++i) {
+                        ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void TestQueryExecutor() {
+    QueryExecutor executor(3);
+    ASSERT_EQUAL(executor.GetThreadCount(), 3u);
+    // Uneven tasks: every hundredth one is slow, so idle workers have to steal.
+    std::vector<std::atomic<int>> call_counts(1000);
+    executor.ForEach(call_counts.size(), [&call_counts](size_t index) {
+        if (index % 100 == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        ++call_counts[index];
+        });
+    ASSERT(std::all_of(call_counts.begin(), call_counts.end(), [](const std::atomic<int>& count) { return count == 1; }));
+
+    // A failing task does not stop the others; a nested batch runs on the calling thread.
+    std::atomic<int> call_count = 0;
+    try {
+        executor.ForEach(100, [&executor, &call_count](size_t index) {
+            executor.ForEach(2, [&call_count](size_t) { ++call_count; });
+            if (index == 42) {
+                throw std::invalid_argument("task failed");
+            }
+            });
+        ASSERT_HINT(false, "the exception of a task must reach the caller");
+    }
+    catch (const std::invalid_argument&) {
+    }
+    ASSERT_EQUAL(call_count.load(), 200);
+
+    SearchServer search_server("and"s);
+    for (int id = 0; id < 200; ++id) {
+        search_server.AddDocument(id, (id % 3 == 0 ? "cat and dog "s : "dog hat "s) + std::to_string(id % 17), DocumentStatus::ACTUAL, { id });
+    }
+    std::vector<std::string> queries;
+    for (int i = 0; i < 300; ++i) {
+        queries.push_back(i % 4 == 0 ? "cat dog hat"s : std::to_string(i % 20) + " -hat"s);
+    }
+    std::vector<Document> expected;
+    for (const std::string& query : queries) {
+        for (const Document& document : search_server.FindTopDocuments(query)) {
+            expected.push_back(document);
+        }
+    }
+    const auto check_joined = [&](QueryExecutor& query_executor) {
+        const auto documents = ProcessQueriesJoined(query_executor, search_server, queries);
+        ASSERT_EQUAL(documents.size(), expected.size());
+        for (size_t i = 0; i < documents.size(); ++i) {
+            ASSERT_EQUAL(documents[i].id, expected[i].id);
+            ASSERT_EQUAL(documents[i].relevance, expected[i].relevance);
+        }
+    };
+    for (QueryExecutor* const query_executor : { &executor, &QueryExecutor::GetDefault() }) {
+        check_joined(*query_executor);
+        ASSERT_EQUAL(ProcessQueries(*query_executor, search_server, queries)[4].size(), search_server.FindTopDocuments(queries[4]).size());
+    }
+    // MaxScore and the query cache hand over a result vector instead.
+    search_server.SetRetrievalMode(RetrievalMode::MAX_SCORE);
+    check_joined(executor);
+    search_server.SetQueryCacheSize(1 << 20);
+    check_joined(executor);
+    check_joined(executor);
+}
+
+void TestFindTopDocumentsAsync() {
+    SearchServer search_server("and"s);
+    for (int id = 0; id < 5000; ++id) {
+        search_server.AddDocument(id, (id % 3 == 0 ? "cat and dog "s : "dog hat "s) + (id % 5 == 0 ? "fur"s : "tail"s), DocumentStatus::ACTUAL,
+            { id % 11 });
+    }
+    search_server.SetQueryCacheSize(1 << 20);
+    for (const RetrievalMode mode : { RetrievalMode::EXHAUSTIVE, RetrievalMode::MAX_SCORE }) {
+        search_server.SetRetrievalMode(mode);
+        const SearchResult complete = search_server.FindTopDocumentsAsync("cat hat -fur"s, SearchDeadline()).get();
+        ASSERT(complete.is_complete);
+        const auto expected = search_server.FindTopDocuments("cat hat -fur"s);
+        ASSERT_EQUAL(complete.documents.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            ASSERT_EQUAL(complete.documents[i].id, expected[i].id);
+        }
+
+        // Reached before the first posting block: nothing is scored, and nothing is cached.
+        CancellationToken token;
+        token.Cancel();
+        for (const SearchDeadline& deadline : { SearchDeadline(token), SearchDeadline::After(-std::chrono::seconds(1)) }) {
+            const SearchResult stopped = search_server.FindTopDocumentsAsync("cat dog"s, DocumentStatus::ACTUAL, deadline).get();
+            ASSERT(!stopped.is_complete);
+            ASSERT(stopped.documents.empty());
+        }
+        ASSERT_EQUAL(search_server.FindTopDocuments("cat dog"s).size(), 5u);
+
+        // A predicate that cancels the search after some documents stops it at the next block.
+        CancellationToken partial_token;
+        int call_count = 0;
+        const SearchResult partial = search_server.FindTopDocumentsAsync("cat hat -fur"s,
+            [partial_token, &call_count](int, DocumentStatus, int) mutable {
+                if (++call_count == 300) {
+                    partial_token.Cancel();
+                }
+                return true;
+            }, SearchDeadline(partial_token), 1000).get();
+        ASSERT(!partial.is_complete);
+        ASSERT(!partial.documents.empty());
+        ASSERT(partial.documents.size() < search_server.FindTopDocuments("cat hat -fur"s, DocumentStatus::ACTUAL, 1000).size());
+        for (const Document& document : partial.documents) {
+            ASSERT(document.id % 5 != 0);
+        }
+    }
+
+    try {
+        search_server.FindTopDocumentsAsync("cat --dog"s, SearchDeadline()).get();
+        ASSERT_HINT(false, "an invalid query must be reported through the future");
+    }
+    catch (const std::invalid_argument&) {
+    }
+}
+
+void TestRequestQueue() {
+    SearchServer search_server("and"s);
+    search_server.AddDocument(1, "cat and dog"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(2, "dog hat"s, DocumentStatus::BANNED, { 2 });
+    {
+        RequestQueue request_queue(search_server, std::chrono::hours(1), 4);
+        ASSERT_EQUAL(request_queue.AddFindRequest("dog"s).size(), 1u);
+        ASSERT_EQUAL(request_queue.AddFindRequest("hat"s).size(), 0u);
+        ASSERT_EQUAL(request_queue.AddFindRequest("hat"s, DocumentStatus::BANNED).size(), 1u);
+        ASSERT_EQUAL(request_queue.AddFindRequest("dog"s, [](int document_id, DocumentStatus, int) { return document_id == 2; }).size(), 1u);
+        ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1);
+        const RequestStatistics statistics = request_queue.GetStatistics();
+        ASSERT_EQUAL(statistics.request_count, 4u);
+        ASSERT_EQUAL(statistics.no_result_rate, 0.25);
+        ASSERT(statistics.queries_per_second > 0.0);
+        ASSERT(statistics.latency_p50 <= statistics.latency_p90 && statistics.latency_p90 <= statistics.latency_p99);
+        const auto records = request_queue.GetRecentRequests();
+        ASSERT_EQUAL(records.size(), 4u);
+        ASSERT_EQUAL(records[1].query_hash, std::hash<std::string_view>{}("hat"));
+        ASSERT_EQUAL(records[1].result_count, 0u);
+        // The ring keeps the last four records; the counters keep every request of the window.
+        request_queue.AddFindRequest("cat"s);
+        ASSERT_EQUAL(request_queue.GetRecentRequests().size(), 4u);
+        ASSERT_EQUAL(request_queue.GetRecentRequests().back().query_hash, std::hash<std::string_view>{}("cat"));
+        ASSERT_EQUAL(request_queue.GetStatistics().request_count, 5u);
+    }
+    {
+        RequestQueue request_queue(search_server, std::chrono::milliseconds(100));
+        request_queue.AddFindRequest("hat"s);
+        ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        ASSERT_EQUAL(request_queue.GetNoResultRequests(), 0);
+        ASSERT(request_queue.GetRecentRequests().empty());
+    }
+    {
+        RequestQueue request_queue(search_server, std::chrono::hours(1), 256);
+        std::vector<std::thread> threads;
+        for (int thread = 0; thread < 4; ++thread) {
+            threads.emplace_back([&request_queue, thread] {
+                for (int i = 0; i < 500; ++i) {
+                    request_queue.AddFindRequest(i % 5 == 0 ? "hat"s : "dog"s);
+                    if (thread == 0 && i % 50 == 0) {
+                        request_queue.GetStatistics();
+                        request_queue.GetRecentRequests();
+                    }
+                }
+                });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        ASSERT_EQUAL(request_queue.GetStatistics().request_count, 2000u);
+        ASSERT_EQUAL(request_queue.GetNoResultRequests(), 400);
+        // A record whose slot an earlier, stalled writer still fills is dropped.
+        const size_t record_count = request_queue.GetRecentRequests().size();
+        ASSERT(record_count > 0 && record_count <= 256u);
+    }
+}
+
+// Duplicates are found by word set, not by frequencies or order; the first of a
+// group stays. A removed and re-added id counts as added last.
+void TestRemoveDuplicates() {
+    const auto make_server = []() {
+        SearchServer search_server("and with"s);
+        search_server.AddDocument(1, "funny pet and nasty rat"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+        search_server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, { 1, 2 });
+        search_server.AddDocument(3, "funny pet with curly hair"s, DocumentStatus::ACTUAL, { 1, 2 });
+        search_server.AddDocument(4, "funny pet and curly hair"s, DocumentStatus::ACTUAL, { 1, 2 });
+        search_server.AddDocument(5, "funny funny pet and nasty nasty rat"s, DocumentStatus::ACTUAL, { 1, 2 });
+        search_server.AddDocument(6, "funny pet and not very nasty rat"s, DocumentStatus::ACTUAL, { 1, 2 });
+        search_server.AddDocument(7, "very nasty rat and not very funny pet"s, DocumentStatus::ACTUAL, { 1, 2 });
+        search_server.AddDocument(8, "pet with rat and rat and rat"s, DocumentStatus::ACTUAL, { 1, 2 });
+        search_server.AddDocument(9, "nasty rat with curly hair"s, DocumentStatus::ACTUAL, { 1, 2 });
+        search_server.RemoveDocument(2);
+        search_server.AddDocument(2, "funny pet with curly hair"s, DocumentStatus::ACTUAL, { 1, 2 });
+        return search_server;
+    };
+    const auto get_ids = [](SearchServer& search_server) {
+        return std::vector<int>(search_server.begin(), search_server.end());
+    };
+
+    SearchServer search_server = make_server();
+    RemoveDuplicates(search_server);
+    ASSERT(get_ids(search_server) == std::vector<int>({ 1, 3, 6, 8, 9 }));
+
+    // Batch removal leaves the same documents as removal one at a time, but merges
+    // each segment once, after all its tombstones are set, so none stay behind.
+    SearchServer batch_server("and"s);
+    SearchServer one_by_one_server("and"s);
+    SearchServer expected_server("and"s);
+    const auto is_removed = [](int id) {
+        return id < 4096 || id % 3 == 0;
+    };
+    std::vector<int> ids_to_remove = { -1, 100000 };
+    for (int id = 0; id < 5000; ++id) {
+        const std::string text = "cat"s + std::to_string(id % 13) + " dog"s + std::to_string(id % 7);
+        batch_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 5 });
+        one_by_one_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 5 });
+        if (is_removed(id)) {
+            ids_to_remove.push_back(id);
+        }
+        else {
+            expected_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 5 });
+        }
+    }
+    for (const int id : ids_to_remove) {
+        one_by_one_server.RemoveDocument(id);
+    }
+    batch_server.RemoveDocuments(ids_to_remove);
+    ASSERT(get_ids(batch_server) == get_ids(one_by_one_server));
+    ASSERT(get_ids(batch_server) == get_ids(expected_server));
+    ASSERT_EQUAL(batch_server.GetMemoryUsage().posting_count, expected_server.GetMemoryUsage().posting_count);
+    ASSERT(one_by_one_server.GetMemoryUsage().posting_count > expected_server.GetMemoryUsage().posting_count);
+    const auto expected = expected_server.FindTopDocuments("cat3 dog5"s);
+    const auto docs = batch_server.FindTopDocuments("cat3 dog5"s);
+    ASSERT_EQUAL(docs.size(), expected.size());
+    for (size_t i = 0; i < docs.size(); ++i) {
+        ASSERT_EQUAL(docs[i].id, expected[i].id);
+        ASSERT_EQUAL(docs[i].relevance, expected[i].relevance);
+    }
+
+    // Near-duplicates: 20 shared words and one of their own are 0.91 similar, while
+    // only 10 shared words make 0.5.
+    SearchServer near_server(""s);
+    std::string shared_text;
+    for (int word = 0; word < 20; ++word) {
+        shared_text += "word"s + std::to_string(word) + " "s;
+    }
+    std::string half_text;
+    for (int word = 10; word < 30; ++word) {
+        half_text += "word"s + std::to_string(word) + " "s;
+    }
+    near_server.AddDocument(1, shared_text + "one"s, DocumentStatus::ACTUAL, { 1 });
+    near_server.AddDocument(2, shared_text + "two"s, DocumentStatus::ACTUAL, { 1 });
+    near_server.AddDocument(3, half_text, DocumentStatus::ACTUAL, { 1 });
+    near_server.AddDocument(4, shared_text + "one"s, DocumentStatus::ACTUAL, { 1 });
+    RemoveNearDuplicates(near_server, 0.75);
+    ASSERT(get_ids(near_server) == std::vector<int>({ 1, 3 }));
+    RemoveNearDuplicates(near_server, 1.0);
+    ASSERT(get_ids(near_server) == std::vector<int>({ 1, 3 }));
+    try {
+        RemoveNearDuplicates(near_server, 0.0);
+        ASSERT_HINT(false, "A zero threshold must be rejected"s);
+    }
+    catch (const std::invalid_argument&) {
+    }
+}
+
+// Paging through a broad query yields every match once, in strict rank order.
+void TestFindTopDocumentsPage() {
+    SearchServer search_server("and"s);
+    const std::vector<std::string> words = { "cat", "dog", "bird", "tail", "collar", "eyes", "hat", "fur" };
+    for (int id = 0; id < 500; ++id) {
+        const DocumentStatus status = id % 5 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        search_server.AddDocument(id * 2, words[id % 8] + " and "s + words[id / 8 % 8] + " "s + words[id % 3],
+            status, { id % 7 });
+    }
+    const std::string query = "cat dog hat -fur"s;
+    for (const DocumentStatus status : { DocumentStatus::ACTUAL, DocumentStatus::BANNED }) {
+        auto expected = search_server.FindTopDocuments(query, status, 1000);
+        std::sort(expected.begin(), expected.end(), [](const Document& lhs, const Document& rhs) {
+            return std::tuple(-lhs.relevance, -lhs.rating, lhs.id) < std::tuple(-rhs.relevance, -rhs.rating, rhs.id);
+            });
+        ASSERT(expected.size() > 50);
+
+        std::vector<Document> paged;
+        PageCursor cursor;
+        while (true) {
+            const SearchPage page = search_server.FindTopDocumentsPage(query, status, cursor, 7);
+            ASSERT(page.documents.size() <= 7);
+            paged.insert(paged.end(), page.documents.begin(), page.documents.end());
+            cursor = page.next_cursor;
+            if (!page.has_more) {
+                break;
+            }
+            ASSERT_EQUAL(page.documents.size(), 7u);
+        }
+        ASSERT_EQUAL(paged.size(), expected.size());
+        for (size_t i = 0; i < paged.size(); ++i) {
+            ASSERT_EQUAL(paged[i].id, expected[i].id);
+            ASSERT_EQUAL(paged[i].relevance, expected[i].relevance);
+        }
+        // Past the last page there is nothing, and the cursor stays put.
+        const SearchPage past_end = search_server.FindTopDocumentsPage(query, status, cursor, 7);
+        ASSERT(past_end.documents.empty() && !past_end.has_more);
+        ASSERT(!past_end.next_cursor.IsStart());
+    }
+
+    const SearchPage first_page = search_server.FindTopDocumentsPage(query, PageCursor());
+    ASSERT_EQUAL(first_page.documents.size(), static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT));
+    const auto is_rejected = [&search_server](const std::string& raw_query, DocumentStatus status, const PageCursor& cursor) {
+        try {
+            search_server.FindTopDocumentsPage(raw_query, status, cursor);
+        }
+        catch (const std::invalid_argument&) {
+            return true;
+        }
+        return false;
+    };
+    ASSERT(!is_rejected("hat cat -fur dog"s, DocumentStatus::ACTUAL, first_page.next_cursor));
+    ASSERT_HINT(is_rejected("cat dog"s, DocumentStatus::ACTUAL, first_page.next_cursor), "A cursor of another query must be rejected"s);
+    ASSERT_HINT(is_rejected(query, DocumentStatus::BANNED, first_page.next_cursor), "A cursor of another status must be rejected"s);
+    search_server.RemoveDocument(first_page.documents.back().id);
+    ASSERT_HINT(is_rejected(query, DocumentStatus::ACTUAL, first_page.next_cursor), "A cursor of an older index must be rejected"s);
+}
+
+void TestSearchMetrics() {
+    ResetMetrics();
+    SearchServer search_server("and"s);
+    search_server.AddDocument(1, "white cat and fancy collar"s, DocumentStatus::ACTUAL, { 8, -3 });
+    search_server.AddDocument(2, "fluffy cat fluffy tail"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    search_server.AddDocument(3, "groomed dog expressive eyes"s, DocumentStatus::ACTUAL, { 5, -12, 2, 1 });
+    search_server.RemoveDocument(3);
+    search_server.FindTopDocuments("fluffy cat"s);
+    search_server.FindTopDocuments("cat -collar"s);
+    search_server.SetRetrievalMode(RetrievalMode::MAX_SCORE);
+    search_server.FindTopDocuments("cat -tail"s);
+    search_server.FindTopDocumentsPage("cat"s, PageCursor());
+    // Metrics of a thread outlive it.
+    std::thread([&search_server] {
+        search_server.FindTopDocuments("tail"s);
+        }).join();
+
+    const MetricsSnapshot snapshot = GetMetricsSnapshot();
+#ifdef SEARCH_SERVER_NO_METRICS
+    ASSERT_EQUAL(snapshot.GetStage(MetricStage::PARSE_QUERY).count, 0u);
+    ASSERT_EQUAL(snapshot.GetCounter(MetricCounter::SEARCHES), 0u);
+    return;
+#endif
+    ASSERT_EQUAL(snapshot.GetStage(MetricStage::ADD_DOCUMENT).count, 3u);
+    ASSERT_EQUAL(snapshot.GetStage(MetricStage::REMOVE_DOCUMENT).count, 1u);
+    ASSERT_EQUAL(snapshot.GetStage(MetricStage::PARSE_QUERY).count, 5u);
+    ASSERT_EQUAL(snapshot.GetStage(MetricStage::MINUS_WORDS).count, 2u);
+    ASSERT_EQUAL(snapshot.GetStage(MetricStage::POSTING_TRAVERSAL).count, 5u);
+    ASSERT_EQUAL(snapshot.GetStage(MetricStage::TOP_K_SELECTION).count, 5u);
+    ASSERT_EQUAL(snapshot.GetCounter(MetricCounter::SEARCHES), 5u);
+    ASSERT_EQUAL(snapshot.GetCounter(MetricCounter::ADDED_DOCUMENTS), 3u);
+    ASSERT_EQUAL(snapshot.GetCounter(MetricCounter::REMOVED_DOCUMENTS), 1u);
+    for (const StageLatency& latency : snapshot.stages) {
+        ASSERT(latency.p50 <= latency.p90 && latency.p90 <= latency.p99 && latency.p99 <= latency.max);
+        // The maximum is rounded up by at most one bin, 1/16 of its power of two.
+        ASSERT(latency.count == 0 || latency.total <= latency.max * latency.count);
+    }
+    ASSERT(snapshot.ToText().find("parse_query: count 5,"s) != std::string::npos);
+    ASSERT(snapshot.ToText().find("searches: 5\n"s) != std::string::npos);
+    ASSERT(snapshot.ToJson().find("\"add_document\": {\"count\": 3,"s) != std::string::npos);
+    ASSERT(snapshot.ToJson().find("\"removed_documents\": 1"s) != std::string::npos);
+
+    ResetMetrics();
+    ASSERT_EQUAL(GetMetricsSnapshot().GetStage(MetricStage::PARSE_QUERY).count, 0u);
+    search_server.FindTopDocuments("cat"s);
+    ASSERT_EQUAL(GetMetricsSnapshot().GetCounter(MetricCounter::SEARCHES), 1u);
+}
+
+// The corpus depends only on the options, and word ranks follow the Zipf skew.
+void TestCorpusGenerator() {
+    CorpusOptions options;
+    options.vocabulary_size = 1'000;
+    options.duplicate_share = 0.1;
+    CorpusGenerator generator(options);
+    CorpusGenerator same_generator(options);
+    options.seed = 7;
+    CorpusGenerator other_generator(options);
+    ASSERT(generator.GetDictionary() == same_generator.GetDictionary());
+    ASSERT(generator.GetDictionary() != other_generator.GetDictionary());
+    ASSERT_EQUAL(std::set<std::string>(generator.GetDictionary().begin(), generator.GetDictionary().end()).size(), 1'000u);
+
+    std::map<std::string, int> word_counts;
+    std::array<int, 4> status_counts{};
+    for (int id = 0; id < 2'000; ++id) {
+        const auto document = generator.GenerateDocument(id);
+        const auto same_document = same_generator.GenerateDocument(id);
+        ASSERT_EQUAL(document.text, same_document.text);
+        ASSERT(document.status == same_document.status && document.ratings == same_document.ratings);
+        const auto words = SplitIntoWords(document.text);
+        ASSERT(words.size() >= 10u && words.size() <= 60u);
+        for (const std::string& word : words) {
+            ++word_counts[word];
+        }
+        ++status_counts[static_cast<size_t>(document.status)];
+    }
+    ASSERT_EQUAL(generator.GenerateQuery(2, 4, 0.5), same_generator.GenerateQuery(2, 4, 0.5));
+    const auto& dictionary = generator.GetDictionary();
+    ASSERT(word_counts[dictionary[0]] > 2 * word_counts[dictionary[9]]);
+    ASSERT(word_counts[dictionary[9]] > word_counts[dictionary[500]]);
+    ASSERT(status_counts[0] > 1'500 && status_counts[3] > 0);
+
+    // About one document in ten repeats the words of a recent one.
+    SearchServer search_server(""s);
+    CorpusGenerator duplicate_generator(options);
+    for (int id = 0; id < 1'000; ++id) {
+        const auto document = duplicate_generator.GenerateDocument(id);
+        search_server.AddDocument(id, document.text, document.status, document.ratings);
+    }
+    std::streambuf* const cout_buffer = std::cout.rdbuf(nullptr);
+    RemoveDuplicates(search_server);
+    std::cout.rdbuf(cout_buffer);
+    ASSERT(search_server.GetDocumentCount() > 850 && search_server.GetDocumentCount() < 950);
+
+    BenchmarkSuiteOptions suite_options;
+    suite_options.document_counts = { 10, 0 };
+    std::ostringstream suite_output;
+    try {
+        RunBenchmarkSuite(suite_options, suite_output);
+        ASSERT_HINT(false, "A document count of zero must be rejected"s);
+    }
+    catch (const std::invalid_argument&) {
+    }
+    ASSERT(suite_output.str().empty());
+}
+
+void TestSnapshotRejectsOversizedTail() {
+    const std::string path = MakeTemporaryPath("oversized_tail.snapshot"s);
+    SearchServer search_server(""s);
+    for (int id = 0; id < 200; ++id) {
+        search_server.AddDocument(id, id < 100 ? "alpha"s : "beta"s, DocumentStatus::ACTUAL, { 1 });
+    }
+    search_server.SaveSnapshot(path);
+    std::string bytes;
+    {
+        std::ifstream input(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+
+    // Both terms keep all 100 postings in the tail, stored back to back. Claiming that "alpha" owns
+    // all 200 keeps every ordinal in range and sorted, but makes its tail longer than a block.
+    uint64_t terms_offset = 0;
+    std::memcpy(&terms_offset, bytes.data() + 64, sizeof(terms_offset));
+    const uint32_t tail_size = 200;
+    const uint64_t posting_count = 200;
+    std::memcpy(bytes.data() + terms_offset + 64, &tail_size, sizeof(tail_size));
+    std::memcpy(bytes.data() + terms_offset + 40, &posting_count, sizeof(posting_count));
+    {
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        output << bytes;
+    }
+    bool is_rejected = false;
+    try {
+        SearchServer::LoadSnapshot(path);
+    }
+    catch (const std::invalid_argument&) {
+        is_rejected = true;
+    }
+    std::remove(path.c_str());
+    ASSERT_HINT(is_rejected, "A posting tail of a block or more must be rejected"s);
+}
+
+// Damage that the default check must catch without the checksum: a gap that decodes
+// past the block's last ordinal, and a document with terms but no words.
+void TestSnapshotRejectsBadBlockGaps() {
+    const std::string path = MakeTemporaryPath("bad_block_gaps.snapshot"s);
+    SearchServer search_server(""s);
+    for (int id = 0; id < 600; ++id) {
+        search_server.AddDocument(id, id % 3 == 0 ? "alpha"s : "beta"s, DocumentStatus::ACTUAL, { 1 });
+    }
+    search_server.SaveSnapshot(path);
+    std::string bytes;
+    {
+        std::ifstream input(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+    const auto is_rejected = [&path](const std::string& content) {
+        {
+            std::ofstream output(path, std::ios::binary | std::ios::trunc);
+            output << content;
+        }
+        try {
+            SearchServer::LoadSnapshot(path);
+        }
+        catch (const std::invalid_argument&) {
+            return true;
+        }
+        return false;
+    };
+    const auto read_offset = [&bytes](size_t position) {
+        uint64_t offset = 0;
+        std::memcpy(&offset, bytes.data() + position, sizeof(offset));
+        return offset;
+    };
+    ASSERT(!is_rejected(bytes));
+
+    // "alpha" fills a block with gaps of one byte each, stored first in the posting data section.
+    std::string damaged = bytes;
+    damaged[read_offset(96) + 5] = static_cast<char>(0xFF);
+    ASSERT_HINT(is_rejected(damaged), "A block whose gaps overshoot its last ordinal must be rejected"s);
+
+    damaged = bytes;
+    const uint32_t word_count = 0;
+    std::memcpy(damaged.data() + read_offset(128) + 16, &word_count, sizeof(word_count));
+    ASSERT_HINT(is_rejected(damaged), "A document with terms but no words must be rejected"s);
+    std::remove(path.c_str());
+}
+
 void TestSearchServer() {
     RUN_TEST(TestExcludeStopWordsFromAddedDocumentContent);
     RUN_TEST(TestExcludeStopWordsFromAddedDocumentContent);
@@ -176,4 +1738,32 @@ void TestSearchServer() {
     RUN_TEST(TestRatingCalculations);
     RUN_TEST(TestPredicateLambdaFunc);
     RUN_TEST(TestRelevanceFind);
+    RUN_TEST(TestRemoveDocument);
+    RUN_TEST(TestQueryLookupsDoNotAllocate);
+    RUN_TEST(TestTopDocumentCount);
+    RUN_TEST(TestSparseDocumentIds);
+    RUN_TEST(TestParallelFindMatchesSequential);
+    RUN_TEST(TestInverseDocumentFreqFollowsIndexChanges);
+    RUN_TEST(TestMaxScoreMatchesExhaustive);
+    RUN_TEST(TestPostingListBlocks);
+    RUN_TEST(TestSnapshotRoundTrip);
+    RUN_TEST(TestAddDocumentsMatchesAddDocument);
+    RUN_TEST(TestTombstonesAndSegmentMerges);
+    RUN_TEST(TestConcurrentReadsDuringUpdates);
+    RUN_TEST(TestSplitIntoWords);
+    RUN_TEST(TestLoadDocuments);
+    RUN_TEST(TestQueryCache);
+    RUN_TEST(TestCompiledQuery);
+    RUN_TEST(TestStatusFiltering);
+    RUN_TEST(TestMinusWordsExcludeBeforeScoring);
+    RUN_TEST(TestQueryExecutor);
+    RUN_TEST(TestFindTopDocumentsAsync);
+    RUN_TEST(TestRequestQueue);
+    RUN_TEST(TestRemoveDuplicates);
+    RUN_TEST(TestFindTopDocumentsPage);
+    RUN_TEST(TestSearchMetrics);
+    RUN_TEST(TestCorpusGenerator);
+    RUN_TEST(TestSnapshotRejectsOversizedTail);
+    RUN_TEST(TestSnapshotRejectsBadBlockGaps);
+    RUN_TEST(TestConcurrentUpdateRestoresLaggingCopy);
 }
\ No newline at end of file
@@ -58,4 +58,61 @@ void TestRatingCalculations();
 
 void TestPredicateLambdaFunc();
 
+void TestRemoveDocument();
+
+// Allocations made by the current thread so far. Defined in test_allocation_counter.cpp,
+// which replaces the global operator new and must be linked into the test binary only.
+size_t GetAllocationCount();
+
+void TestQueryLookupsDoNotAllocate();
+
+void TestTopDocumentCount();
+
+void TestSparseDocumentIds();
+
+void TestParallelFindMatchesSequential();
+
+void TestInverseDocumentFreqFollowsIndexChanges();
+
+void TestMaxScoreMatchesExhaustive();
+
+void TestPostingListBlocks();
+
+void TestSnapshotRoundTrip();
+
+void TestAddDocumentsMatchesAddDocument();
+
+void TestTombstonesAndSegmentMerges();
+
+void TestConcurrentReadsDuringUpdates();
+
+void TestSplitIntoWords();
+
+void TestLoadDocuments();
+
+void TestQueryCache();
+
+void TestCompiledQuery();
+
+void TestStatusFiltering();
+
+void TestMinusWordsExcludeBeforeScoring();
+
+void TestQueryExecutor();
+
+void TestFindTopDocumentsAsync();
+
+void TestRequestQueue();
+
+void TestRemoveDuplicates();
+
+void TestFindTopDocumentsPage();
+
+void TestSearchMetrics();
+
+void TestCorpusGenerator();
+void TestSnapshotRejectsOversizedTail();
+void TestSnapshotRejectsBadBlockGaps();
+void TestConcurrentUpdateRestoresLaggingCopy();
+
 void TestSearchServer();